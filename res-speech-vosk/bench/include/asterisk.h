@@ -0,0 +1,620 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Stand-in for the Asterisk API used by res_speech_vosk
+ *
+ * Declares just enough of Asterisk for the module to build into the
+ * benchmark harness: logging, locking, lists, ao2 objects, config, formats,
+ * the speech engine interface, websocket client and JSON packing. The
+ * declarations follow the Asterisk headers, behaviour is implemented in
+ * shim.c and websocket.c. The asterisk/ headers all resolve to this file.
+ */
+
+#ifndef BENCH_ASTERISK_H
+#define BENCH_ASTERISK_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <alloca.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#define ASTERISK_GPL_KEY "This paragraph is copyright (c) 2006 by Digium, Inc."
+
+#define ARRAY_LEN(a) (size_t) (sizeof(a) / sizeof(0[a]))
+#define MIN(a, b) ({ typeof(a) __a = (a); typeof(b) __b = (b); ((__a > __b) ? __b : __a);})
+#define MAX(a, b) ({ typeof(a) __a = (a); typeof(b) __b = (b); ((__a < __b) ? __b : __a);})
+#define AST_PTHREADT_NULL (pthread_t) -1
+
+/* logger */
+#define __LOG_DEBUG	0
+#define __LOG_NOTICE	2
+#define __LOG_WARNING	3
+#define __LOG_ERROR	4
+#define LOG_DEBUG	__LOG_DEBUG, __FILE__, __LINE__, __func__
+#define LOG_NOTICE	__LOG_NOTICE, __FILE__, __LINE__, __func__
+#define LOG_WARNING	__LOG_WARNING, __FILE__, __LINE__, __func__
+#define LOG_ERROR	__LOG_ERROR, __FILE__, __LINE__, __func__
+
+extern int option_debug;
+extern int option_verbose;
+
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
+	__attribute__((format(printf, 5, 6)));
+void __ast_verbose(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#define ast_debug(level, ...) do { \
+	if (option_debug >= (level)) { \
+		ast_log(LOG_DEBUG, __VA_ARGS__); \
+	} \
+} while (0)
+#define ast_verb(level, ...) do { \
+	if (option_verbose >= (level)) { \
+		__ast_verbose(level, __VA_ARGS__); \
+	} \
+} while (0)
+
+/* utils and strings */
+#define ast_calloc(num, len) calloc(num, len)
+#define ast_malloc(len) malloc(len)
+#define ast_realloc(p, len) realloc(p, len)
+#define ast_free(p) free(p)
+#define ast_strdup(str) ((str) ? strdup(str) : NULL)
+#define ast_strdupa(s) strdupa(s)
+
+#define ast_set_flag(p, flag) do { (p)->flags |= (flag); } while (0)
+#define ast_test_flag(p, flag) ((p)->flags & (flag))
+#define ast_clear_flag(p, flag) do { (p)->flags &= ~(flag); } while (0)
+
+struct ast_flags {
+	unsigned int flags;
+};
+
+#define AST_STRSEP_STRIP	(1 << 0)
+#define AST_STRSEP_TRIM		(1 << 1)
+
+static inline int ast_strlen_zero(const char *s)
+{
+	return !s || !*s;
+}
+
+#define S_OR(a, b) ({ typeof(&((a)[0])) __x = (a); ast_strlen_zero(__x) ? (b) : __x; })
+
+void ast_copy_string(char *dst, const char *src, size_t size);
+int ast_true(const char *val);
+int ast_false(const char *val);
+char *ast_skip_blanks(const char *str);
+char *ast_strip(char *s);
+char *ast_strsep(char **s, const char sep, uint32_t flags);
+long ast_random(void);
+int ast_wait_for_input(int fd, int ms);
+int ast_wait_for_output(int fd, int ms);
+int ast_mkdir(const char *path, int mode);
+
+/* time */
+struct timeval ast_tvnow(void);
+struct timeval ast_tv(time_t sec, suseconds_t usec);
+struct timeval ast_tvadd(struct timeval a, struct timeval b);
+struct timeval ast_tvsub(struct timeval a, struct timeval b);
+struct timeval ast_samp2tv(unsigned int _nsamp, unsigned int _rate);
+int ast_tvcmp(struct timeval _a, struct timeval _b);
+int64_t ast_tvdiff_ms(struct timeval end, struct timeval start);
+int64_t ast_tvdiff_us(struct timeval end, struct timeval start);
+
+static inline int ast_tvzero(const struct timeval t)
+{
+	return (t.tv_sec == 0 && t.tv_usec == 0);
+}
+
+/* lock */
+typedef pthread_mutex_t ast_mutex_t;
+typedef pthread_cond_t ast_cond_t;
+
+#define AST_MUTEX_DEFINE_STATIC(mutex) static ast_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER
+#define ast_mutex_init(m) pthread_mutex_init(m, NULL)
+#define ast_mutex_destroy(m) pthread_mutex_destroy(m)
+#define ast_mutex_lock(m) pthread_mutex_lock(m)
+#define ast_mutex_unlock(m) pthread_mutex_unlock(m)
+#define ast_mutex_trylock(m) pthread_mutex_trylock(m)
+#define ast_cond_init(c, a) pthread_cond_init(c, a)
+#define ast_cond_destroy(c) pthread_cond_destroy(c)
+#define ast_cond_signal(c) pthread_cond_signal(c)
+#define ast_cond_broadcast(c) pthread_cond_broadcast(c)
+#define ast_cond_wait(c, m) pthread_cond_wait(c, m)
+#define ast_cond_timedwait(c, m, t) pthread_cond_timedwait(c, m, t)
+
+#define ast_atomic_fetch_add(ptr, val, memorder) __atomic_fetch_add((ptr), (val), (memorder))
+#define ast_atomic_add_fetch(ptr, val, memorder) __atomic_add_fetch((ptr), (val), (memorder))
+#define ast_atomic_fetch_sub(ptr, val, memorder) __atomic_fetch_sub((ptr), (val), (memorder))
+#define ast_atomic_sub_fetch(ptr, val, memorder) __atomic_sub_fetch((ptr), (val), (memorder))
+
+/* threads */
+int ast_pthread_create_background(pthread_t *thread, pthread_attr_t *attr, void *(*start_routine)(void *), void *data);
+int ast_pthread_create_detached_background(pthread_t *thread, pthread_attr_t *attr, void *(*start_routine)(void *), void *data);
+
+/* logger call ids */
+typedef unsigned int ast_callid;
+
+ast_callid ast_read_threadstorage_callid(void);
+
+/* linkedlists */
+#define AST_LIST_HEAD_NOLOCK(name, type) \
+struct name { \
+	struct type *first; \
+	struct type *last; \
+}
+#define AST_LIST_ENTRY(type) \
+struct { \
+	struct type *next; \
+}
+#define AST_LIST_HEAD_INIT_NOLOCK(head) do { \
+	(head)->first = NULL; \
+	(head)->last = NULL; \
+} while (0)
+#define AST_LIST_FIRST(head) ((head)->first)
+#define AST_LIST_LAST(head) ((head)->last)
+#define AST_LIST_NEXT(elm, field) ((elm)->field.next)
+#define AST_LIST_EMPTY(head) (AST_LIST_FIRST(head) == NULL)
+#define AST_LIST_TRAVERSE(head, var, field) \
+	for ((var) = (head)->first; (var); (var) = (var)->field.next)
+#define AST_LIST_TRAVERSE_SAFE_BEGIN(head, var, field) { \
+	typeof((head)) __list_head = head; \
+	typeof(__list_head->first) __list_next; \
+	typeof(__list_head->first) __list_prev = NULL; \
+	typeof(__list_head->first) __list_current; \
+	for ((var) = __list_head->first, \
+		__list_current = (var), \
+		__list_next = (var) ? (var)->field.next : NULL; \
+		(var); \
+		__list_prev = __list_current, \
+		(var) = __list_next, \
+		__list_current = (var), \
+		__list_next = (var) ? (var)->field.next : NULL \
+		)
+#define AST_LIST_REMOVE_CURRENT(field) do { \
+	__list_current->field.next = NULL; \
+	__list_current = __list_prev; \
+	if (__list_prev) { \
+		__list_prev->field.next = __list_next; \
+	} else { \
+		__list_head->first = __list_next; \
+	} \
+	if (!__list_next) { \
+		__list_head->last = __list_prev; \
+	} \
+} while (0)
+#define AST_LIST_TRAVERSE_SAFE_END }
+#define AST_LIST_INSERT_HEAD(head, elm, field) do { \
+	(elm)->field.next = (head)->first; \
+	(head)->first = (elm); \
+	if (!(head)->last) { \
+		(head)->last = (elm); \
+	} \
+} while (0)
+#define AST_LIST_INSERT_TAIL(head, elm, field) do { \
+	if (!(head)->first) { \
+		(head)->first = (elm); \
+		(head)->last = (elm); \
+	} else { \
+		(head)->last->field.next = (elm); \
+		(head)->last = (elm); \
+	} \
+} while (0)
+#define AST_LIST_APPEND_LIST(head, list, field) do { \
+	if (!(list)->first) { \
+		break; \
+	} \
+	if (!(head)->first) { \
+		(head)->first = (list)->first; \
+		(head)->last = (list)->last; \
+	} else { \
+		(head)->last->field.next = (list)->first; \
+		(head)->last = (list)->last; \
+	} \
+	(list)->first = NULL; \
+	(list)->last = NULL; \
+} while (0)
+#define AST_LIST_REMOVE_HEAD(head, field) ({ \
+	typeof((head)->first) __cur = (head)->first; \
+	if (__cur) { \
+		(head)->first = __cur->field.next; \
+		__cur->field.next = NULL; \
+		if ((head)->last == __cur) { \
+			(head)->last = NULL; \
+		} \
+	} \
+	__cur; \
+})
+#define AST_LIST_REMOVE(head, elm, field) ({ \
+	typeof(elm) __elm = (elm); \
+	if (__elm) { \
+		if ((head)->first == __elm) { \
+			(head)->first = __elm->field.next; \
+			__elm->field.next = NULL; \
+			if ((head)->last == __elm) { \
+				(head)->last = NULL; \
+			} \
+		} else { \
+			typeof(elm) __prev = (head)->first; \
+			while (__prev && __prev->field.next != __elm) { \
+				__prev = __prev->field.next; \
+			} \
+			if (__prev) { \
+				__prev->field.next = __elm->field.next; \
+				__elm->field.next = NULL; \
+				if ((head)->last == __elm) { \
+					(head)->last = __prev; \
+				} \
+			} else { \
+				__elm = NULL; \
+			} \
+		} \
+	} \
+	__elm; \
+})
+
+/* vector */
+#define AST_VECTOR(name, type) \
+struct name { \
+	type *elems; \
+	size_t max; \
+	size_t current; \
+}
+#define AST_VECTOR_INIT(vec, size) ({ \
+	size_t __size = (size); \
+	(vec)->elems = __size ? ast_calloc(__size, sizeof(*(vec)->elems)) : NULL; \
+	(vec)->max = (vec)->elems ? __size : 0; \
+	(vec)->current = 0; \
+	(__size && !(vec)->elems) ? -1 : 0; \
+})
+#define AST_VECTOR_FREE(vec) do { \
+	ast_free((vec)->elems); \
+	(vec)->elems = NULL; \
+	(vec)->max = 0; \
+	(vec)->current = 0; \
+} while (0)
+#define AST_VECTOR_SIZE(vec) (vec)->current
+#define AST_VECTOR_GET(vec, idx) ((vec)->elems[(idx)])
+#define AST_VECTOR_APPEND(vec, elem) ({ \
+	int __res = 0; \
+	if ((vec)->current + 1 > (vec)->max) { \
+		size_t __new_max = (vec)->max ? 2 * (vec)->max : 1; \
+		typeof((vec)->elems) __new_elems = ast_realloc((vec)->elems, __new_max * sizeof(*(vec)->elems)); \
+		if (__new_elems) { \
+			(vec)->elems = __new_elems; \
+			(vec)->max = __new_max; \
+		} else { \
+			__res = -1; \
+		} \
+	} \
+	if (!__res) { \
+		(vec)->elems[(vec)->current++] = (elem); \
+	} \
+	__res; \
+})
+#define AST_VECTOR_ELEM_CLEANUP_NOOP(elem)
+#define AST_VECTOR_RESET(vec, cleanup) do { \
+	size_t __idx; \
+	for (__idx = 0; __idx < (vec)->current; __idx++) { \
+		cleanup((vec)->elems[__idx]); \
+	} \
+	(vec)->current = 0; \
+} while (0)
+
+/* astobj2, objects carry a recursive mutex like AO2_ALLOC_OPT_LOCK_MUTEX */
+typedef void (*ao2_destructor_fn)(void *vdoomed);
+
+void *ao2_alloc(size_t data_size, ao2_destructor_fn destructor_fn);
+int ao2_ref(void *o, int delta);
+void ao2_cleanup(void *obj);
+int ao2_lock(void *o);
+int ao2_trylock(void *o);
+int ao2_unlock(void *o);
+void *ao2_object_get_lockaddr(void *obj);
+
+/* module */
+struct ast_module;
+struct ast_module_info {
+	struct ast_module *self;
+};
+
+enum ast_module_load_result {
+	AST_MODULE_LOAD_SUCCESS = 0,
+	AST_MODULE_LOAD_DECLINE = 1,
+	AST_MODULE_LOAD_SKIP = 2,
+	AST_MODULE_LOAD_PRIORITY = 3,
+	AST_MODULE_LOAD_FAILURE = -1,
+};
+
+extern const struct ast_module_info *ast_module_info;
+
+void ast_module_ref(struct ast_module *mod);
+void ast_module_unref(struct ast_module *mod);
+
+/* The module is linked into the harness, which loads it through these */
+#define AST_MODULE_INFO_STANDARD(keystr, desc) \
+	int bench_module_load(void) \
+	{ \
+		return load_module(); \
+	} \
+	int bench_module_unload(void) \
+	{ \
+		return unload_module(); \
+	}
+
+/* config */
+struct ast_config;
+
+struct ast_variable {
+	const char *name;
+	const char *value;
+	struct ast_variable *next;
+};
+
+struct ast_config *ast_config_load(const char *filename, struct ast_flags flags);
+void ast_config_destroy(struct ast_config *cfg);
+char *ast_category_browse(struct ast_config *config, const char *prev_name);
+const char *ast_variable_retrieve(struct ast_config *config, const char *category, const char *variable);
+struct ast_variable *ast_variable_browse(const struct ast_config *config, const char *category_name);
+
+/* format */
+struct ast_format;
+struct ast_format_cap;
+
+enum ast_format_cmp_res {
+	AST_FORMAT_CMP_EQUAL = 0,
+	AST_FORMAT_CMP_NOT_EQUAL,
+	AST_FORMAT_CMP_SUBSET,
+};
+
+#define AST_FORMAT_CAP_FLAG_DEFAULT 0
+
+extern struct ast_format *ast_format_slin;
+extern struct ast_format *ast_format_slin16;
+extern struct ast_format *ast_format_ulaw;
+extern struct ast_format *ast_format_alaw;
+
+enum ast_format_cmp_res ast_format_cmp(const struct ast_format *format1, const struct ast_format *format2);
+const char *ast_format_get_name(const struct ast_format *format);
+unsigned int ast_format_get_sample_rate(const struct ast_format *format);
+struct ast_format_cap *ast_format_cap_alloc(int flags);
+int ast_format_cap_append(struct ast_format_cap *cap, struct ast_format *format, unsigned int framing);
+
+/* speech */
+enum ast_speech_states {
+	AST_SPEECH_STATE_NOT_READY = 0,
+	AST_SPEECH_STATE_READY,
+	AST_SPEECH_STATE_WAIT,
+	AST_SPEECH_STATE_DONE,
+};
+
+enum ast_speech_flags {
+	AST_SPEECH_QUIET = (1 << 0),
+	AST_SPEECH_SPOKE = (1 << 1),
+	AST_SPEECH_HAVE_RESULTS = (1 << 2),
+};
+
+enum ast_speech_results_type {
+	AST_SPEECH_RESULTS_TYPE_NORMAL = 0,
+	AST_SPEECH_RESULTS_TYPE_NBEST,
+};
+
+struct ast_speech_result {
+	char *text;
+	int score;
+	int nbest_number;
+	char *grammar;
+	AST_LIST_ENTRY(ast_speech_result) list;
+};
+
+struct ast_speech {
+	ast_mutex_t lock;
+	unsigned int flags;
+	char *processing_sound;
+	int state;
+	struct ast_speech_result *results;
+	struct ast_speech_engine *engine;
+	enum ast_speech_results_type results_type;
+	void *data;
+	struct ast_format *format;
+};
+
+struct ast_speech_engine {
+	char *name;
+	int (*create)(struct ast_speech *speech, struct ast_format *format);
+	int (*destroy)(struct ast_speech *speech);
+	int (*load)(struct ast_speech *speech, const char *grammar_name, const char *grammar);
+	int (*unload)(struct ast_speech *speech, const char *grammar_name);
+	int (*activate)(struct ast_speech *speech, const char *grammar_name);
+	int (*deactivate)(struct ast_speech *speech, const char *grammar_name);
+	int (*write)(struct ast_speech *speech, void *data, int len);
+	int (*dtmf)(struct ast_speech *speech, const char *dtmf);
+	int (*start)(struct ast_speech *speech);
+	int (*change)(struct ast_speech *speech, const char *name, const char *value);
+	int (*get_setting)(struct ast_speech *speech, const char *name, char *buf, size_t len);
+	int (*change_results_type)(struct ast_speech *speech, enum ast_speech_results_type results_type);
+	struct ast_speech_result *(*get)(struct ast_speech *speech);
+	struct ast_format_cap *formats;
+	AST_LIST_ENTRY(ast_speech_engine) list;
+};
+
+int ast_speech_register(struct ast_speech_engine *engine);
+int ast_speech_unregister(const char *engine_name);
+int ast_speech_change_state(struct ast_speech *speech, int state);
+
+/* http_websocket, client side only */
+struct ast_websocket;
+struct ast_tls_config;
+
+enum ast_websocket_opcode {
+	AST_WEBSOCKET_OPCODE_TEXT = 0x1,
+	AST_WEBSOCKET_OPCODE_BINARY = 0x2,
+	AST_WEBSOCKET_OPCODE_PING = 0x9,
+	AST_WEBSOCKET_OPCODE_PONG = 0xA,
+	AST_WEBSOCKET_OPCODE_CLOSE = 0x8,
+	AST_WEBSOCKET_OPCODE_CONTINUATION = 0x0,
+};
+
+enum ast_websocket_result {
+	WS_OK,
+	WS_ALLOCATE_ERROR,
+	WS_KEY_ERROR,
+	WS_URI_PARSE_ERROR,
+	WS_URI_RESOLVE_ERROR,
+	WS_BAD_STATUS,
+	WS_INVALID_RESPONSE,
+	WS_BAD_REQUEST,
+	WS_URL_NOT_FOUND,
+	WS_HEADER_MISMATCH,
+	WS_HEADER_MISSING,
+	WS_NOT_SUPPORTED,
+	WS_WRITE_ERROR,
+	WS_CLIENT_START_ERROR,
+};
+
+struct ast_websocket *ast_websocket_client_create(const char *uri, const char *protocols,
+	struct ast_tls_config *tls_cfg, enum ast_websocket_result *result);
+
+struct ast_websocket_client_options {
+	const char *uri;
+	const char *protocols;
+	const char *username;
+	const char *password;
+	/* Longest connect (ms), -1 waits as long as the system does */
+	int timeout;
+	int suppress_connection_msgs;
+	struct ast_tls_config *tls_cfg;
+};
+
+struct ast_websocket *ast_websocket_client_create_with_options(struct ast_websocket_client_options *options,
+	enum ast_websocket_result *result);
+int ast_websocket_write(struct ast_websocket *session, enum ast_websocket_opcode opcode, char *payload, uint64_t payload_size);
+int ast_websocket_write_string(struct ast_websocket *ws, const char *buf);
+int ast_websocket_read(struct ast_websocket *session, char **payload, uint64_t *payload_len,
+	enum ast_websocket_opcode *opcode, int *fragmented);
+int ast_websocket_wait_for_input(struct ast_websocket *session, int timeout);
+int ast_websocket_fd(struct ast_websocket *session);
+int ast_websocket_close(struct ast_websocket *session, uint16_t reason);
+void ast_websocket_reconstruct_enable(struct ast_websocket *session, size_t bytes);
+void ast_websocket_ref(struct ast_websocket *session);
+void ast_websocket_unref(struct ast_websocket *session);
+int ast_websocket_is_secure(struct ast_websocket *session);
+
+/* json, packing and dumping only */
+struct ast_json;
+typedef intmax_t ast_json_int_t;
+
+struct ast_json *ast_json_pack(char const *format, ...);
+char *ast_json_dump_string(struct ast_json *root);
+void ast_json_unref(struct ast_json *value);
+void ast_json_free(void *p);
+
+/* cli */
+struct ast_cli_args {
+	const int fd;
+	const int argc;
+	const char * const *argv;
+	const char *line;
+	const char *word;
+	const int pos;
+	int n;
+};
+
+struct ast_cli_entry {
+	const char * const cmda[32];
+	const char * const summary;
+	const char *usage;
+	char *(*handler)(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a);
+	char *command;
+};
+
+enum {
+	CLI_INIT = -2,
+	CLI_GENERATE = -3,
+};
+
+#define CLI_SUCCESS	(char *)0
+#define CLI_SHOWUSAGE	(char *)1
+#define CLI_FAILURE	(char *)2
+
+#define AST_CLI_DEFINE(fn, txt, ...) { .handler = fn, .summary = txt, ## __VA_ARGS__ }
+
+void ast_cli(int fd, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int ast_cli_register_multiple(struct ast_cli_entry *e, int len);
+int ast_cli_unregister_multiple(struct ast_cli_entry *e, int len);
+
+/* manager */
+struct mansession;
+struct message;
+
+#define EVENT_FLAG_SYSTEM	(1 << 0)
+#define EVENT_FLAG_REPORTING	(1 << 9)
+
+const char *astman_get_header(const struct message *m, char *var);
+void astman_append(struct mansession *s, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void astman_send_listack(struct mansession *s, const struct message *m, char *msg, char *listflag);
+void astman_send_list_complete_start(struct mansession *s, const struct message *m, const char *event_name, int count);
+void astman_send_list_complete_end(struct mansession *s);
+int ast_manager_register_xml(const char *action, int authority, int (*func)(struct mansession *s, const struct message *m));
+int ast_manager_unregister(const char *action);
+
+/* channel, datastore and pbx, the harness has no channels */
+struct ast_channel;
+
+struct ast_datastore_info {
+	const char *type;
+	void *(*duplicate)(void *data);
+	void (*destroy)(void *data);
+};
+
+struct ast_datastore {
+	const char *uid;
+	void *data;
+	const struct ast_datastore_info *info;
+};
+
+struct ast_custom_function {
+	const char *name;
+	int (*read)(struct ast_channel *chan, const char *cmd, char *data, char *buf, size_t len);
+	int (*write)(struct ast_channel *chan, const char *cmd, char *data, const char *value);
+};
+
+void ast_channel_lock(struct ast_channel *chan);
+void ast_channel_unlock(struct ast_channel *chan);
+ast_callid ast_channel_callid(const struct ast_channel *chan);
+struct ast_datastore *ast_datastore_alloc(const struct ast_datastore_info *info, const char *uid);
+int ast_datastore_free(struct ast_datastore *datastore);
+int ast_channel_datastore_add(struct ast_channel *chan, struct ast_datastore *datastore);
+int ast_channel_datastore_remove(struct ast_channel *chan, struct ast_datastore *datastore);
+struct ast_datastore *ast_channel_datastore_find(struct ast_channel *chan, const struct ast_datastore_info *info, const char *uid);
+int ast_custom_function_register(struct ast_custom_function *acf);
+int ast_custom_function_unregister(struct ast_custom_function *acf);
+
+#endif /* BENCH_ASTERISK_H */
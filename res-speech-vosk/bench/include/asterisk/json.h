@@ -0,0 +1,2 @@
+/* Harness stand-in, everything is declared in ../asterisk.h */
+#include "../asterisk.h"
@@ -0,0 +1,1155 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Asterisk stand-in for the benchmark harness
+ *
+ * Implements the core API declared in include/asterisk.h closely enough
+ * for res_speech_vosk to run unchanged: the parts that matter for
+ * performance (locking, objects, time) behave like Asterisk, the rest is
+ * kept to what the module calls.
+ */
+
+#include "asterisk.h"
+
+#include <ctype.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include "shim.h"
+
+int option_debug;
+int option_verbose;
+
+/* logger */
+
+static const char *log_levels[] = { "DEBUG", "TRACE", "NOTICE", "WARNING", "ERROR" };
+
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
+{
+	char date[32];
+	struct timeval now = ast_tvnow();
+	struct tm tm;
+	va_list ap;
+
+	if ((level == __LOG_DEBUG && !option_debug) || (level == __LOG_NOTICE && !option_verbose)) {
+		return;
+	}
+	localtime_r(&now.tv_sec, &tm);
+	strftime(date, sizeof(date), "%b %e %T", &tm);
+
+	flockfile(stderr);
+	fprintf(stderr, "[%s.%03ld] %s[%ld] %s:%d %s: ", date, (long) now.tv_usec / 1000,
+		log_levels[level], (long) syscall(SYS_gettid), file, line, function);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	funlockfile(stderr);
+}
+
+void __ast_verbose(int level, const char *fmt, ...)
+{
+	va_list ap;
+
+	flockfile(stderr);
+	fputs(level >= 4 ? "    -- " : "  == ", stderr);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	funlockfile(stderr);
+}
+
+/* utils and strings */
+
+void ast_copy_string(char *dst, const char *src, size_t size)
+{
+	if (!size) {
+		return;
+	}
+	while (*src && --size) {
+		*dst++ = *src++;
+	}
+	*dst = '\0';
+}
+
+int ast_true(const char *s)
+{
+	if (ast_strlen_zero(s)) {
+		return 0;
+	}
+	return !strcasecmp(s, "yes") || !strcasecmp(s, "true") || !strcasecmp(s, "y")
+		|| !strcasecmp(s, "t") || !strcasecmp(s, "1") || !strcasecmp(s, "on") ? -1 : 0;
+}
+
+int ast_false(const char *s)
+{
+	if (ast_strlen_zero(s)) {
+		return 0;
+	}
+	return !strcasecmp(s, "no") || !strcasecmp(s, "false") || !strcasecmp(s, "n")
+		|| !strcasecmp(s, "f") || !strcasecmp(s, "0") || !strcasecmp(s, "off") ? -1 : 0;
+}
+
+char *ast_skip_blanks(const char *str)
+{
+	while (*str && isspace((unsigned char) *str)) {
+		str++;
+	}
+	return (char *) str;
+}
+
+char *ast_strip(char *s)
+{
+	char *end;
+
+	if (!s) {
+		return NULL;
+	}
+	s = ast_skip_blanks(s);
+	end = s + strlen(s);
+	while (end > s && isspace((unsigned char) end[-1])) {
+		*--end = '\0';
+	}
+	return s;
+}
+
+char *ast_strsep(char **iss, const char sep, uint32_t flags)
+{
+	char *st = *iss;
+	char *is;
+
+	if (!st) {
+		return NULL;
+	}
+	is = strchr(st, sep);
+	if (is) {
+		*is = '\0';
+		*iss = is + 1;
+	} else {
+		*iss = NULL;
+	}
+	if (flags & (AST_STRSEP_STRIP | AST_STRSEP_TRIM)) {
+		st = ast_strip(st);
+	}
+	return st;
+}
+
+long ast_random(void)
+{
+	return random();
+}
+
+int ast_mkdir(const char *path, int mode)
+{
+	char *copy = ast_strdupa(path);
+	char *p = copy;
+
+	/* Parents first, like mkdir -p */
+	while ((p = strchr(p + 1, '/'))) {
+		*p = '\0';
+		if (mkdir(copy, mode) && errno != EEXIST) {
+			return errno;
+		}
+		*p = '/';
+	}
+	if (mkdir(copy, mode) && errno != EEXIST) {
+		return errno;
+	}
+	return 0;
+}
+
+int ast_wait_for_input(int fd, int ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN | POLLPRI };
+
+	return poll(&pfd, 1, ms);
+}
+
+int ast_wait_for_output(int fd, int ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+
+	return poll(&pfd, 1, ms);
+}
+
+/* time */
+
+struct timeval ast_tvnow(void)
+{
+	struct timeval t;
+
+	gettimeofday(&t, NULL);
+	return t;
+}
+
+struct timeval ast_tv(time_t sec, suseconds_t usec)
+{
+	struct timeval t = { .tv_sec = sec, .tv_usec = usec };
+
+	return t;
+}
+
+static struct timeval tvfix(struct timeval a)
+{
+	if (a.tv_usec >= 1000000) {
+		a.tv_sec += a.tv_usec / 1000000;
+		a.tv_usec %= 1000000;
+	} else if (a.tv_usec < 0) {
+		a.tv_usec = 0;
+	}
+	return a;
+}
+
+struct timeval ast_tvadd(struct timeval a, struct timeval b)
+{
+	a = tvfix(a);
+	b = tvfix(b);
+	a.tv_sec += b.tv_sec;
+	a.tv_usec += b.tv_usec;
+	if (a.tv_usec >= 1000000) {
+		a.tv_sec++;
+		a.tv_usec -= 1000000;
+	}
+	return a;
+}
+
+struct timeval ast_tvsub(struct timeval a, struct timeval b)
+{
+	a = tvfix(a);
+	b = tvfix(b);
+	a.tv_sec -= b.tv_sec;
+	a.tv_usec -= b.tv_usec;
+	if (a.tv_usec < 0) {
+		a.tv_sec--;
+		a.tv_usec += 1000000;
+	}
+	return a;
+}
+
+struct timeval ast_samp2tv(unsigned int _nsamp, unsigned int _rate)
+{
+	return ast_tv(_nsamp / _rate, (_nsamp % _rate) * (1000000 / (float) _rate));
+}
+
+int ast_tvcmp(struct timeval _a, struct timeval _b)
+{
+	if (_a.tv_sec < _b.tv_sec) {
+		return -1;
+	}
+	if (_a.tv_sec > _b.tv_sec) {
+		return 1;
+	}
+	if (_a.tv_usec < _b.tv_usec) {
+		return -1;
+	}
+	return _a.tv_usec > _b.tv_usec;
+}
+
+int64_t ast_tvdiff_ms(struct timeval end, struct timeval start)
+{
+	/* Same rounding as Asterisk, towards negative infinity */
+	return ((end.tv_sec - start.tv_sec) * 1000) +
+		(((1000000 + end.tv_usec - start.tv_usec) / 1000) - 1000);
+}
+
+int64_t ast_tvdiff_us(struct timeval end, struct timeval start)
+{
+	return (end.tv_sec - start.tv_sec) * (int64_t) 1000000 + end.tv_usec - start.tv_usec;
+}
+
+/* threads */
+
+int ast_pthread_create_background(pthread_t *thread, pthread_attr_t *attr, void *(*start_routine)(void *), void *data)
+{
+	return pthread_create(thread, attr, start_routine, data);
+}
+
+int ast_pthread_create_detached_background(pthread_t *thread, pthread_attr_t *attr, void *(*start_routine)(void *), void *data)
+{
+	pthread_attr_t detached;
+	int res;
+
+	if (attr) {
+		pthread_attr_setdetachstate(attr, PTHREAD_CREATE_DETACHED);
+		return pthread_create(thread, attr, start_routine, data);
+	}
+	pthread_attr_init(&detached);
+	pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+	res = pthread_create(thread, &detached, start_routine, data);
+	pthread_attr_destroy(&detached);
+	return res;
+}
+
+ast_callid ast_read_threadstorage_callid(void)
+{
+	/* Harness threads are not bound to calls */
+	return 0;
+}
+
+/* astobj2 */
+
+#define AO2_MAGIC 0xa570b123
+
+/*! \brief Header in front of every object */
+struct astobj2 {
+	pthread_mutex_t		lock;
+	ao2_destructor_fn	destructor_fn;
+	int			ref_counter;
+	uint32_t		magic;
+	/* Keeps the user data aligned like malloc would */
+	long double		user_data[0];
+};
+
+static struct astobj2 *INTERNAL_OBJ(void *user_data)
+{
+	struct astobj2 *p;
+
+	if (!user_data) {
+		ast_log(LOG_ERROR, "user_data is NULL\n");
+		abort();
+	}
+	p = (struct astobj2 *) ((char *) user_data - offsetof(struct astobj2, user_data));
+	if (p->magic != AO2_MAGIC) {
+		ast_log(LOG_ERROR, "bad magic number 0x%x for object %p\n", p->magic, user_data);
+		abort();
+	}
+	return p;
+}
+
+void *ao2_alloc(size_t data_size, ao2_destructor_fn destructor_fn)
+{
+	pthread_mutexattr_t attr;
+	struct astobj2 *obj = ast_calloc(1, sizeof(*obj) + data_size);
+
+	if (!obj) {
+		return NULL;
+	}
+	/* ao2 locks may be taken recursively */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&obj->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	obj->destructor_fn = destructor_fn;
+	obj->ref_counter = 1;
+	obj->magic = AO2_MAGIC;
+
+	return obj->user_data;
+}
+
+int ao2_ref(void *user_data, int delta)
+{
+	struct astobj2 *obj = INTERNAL_OBJ(user_data);
+	int current, ret;
+
+	if (!delta) {
+		return __atomic_load_n(&obj->ref_counter, __ATOMIC_RELAXED);
+	}
+	ret = __atomic_fetch_add(&obj->ref_counter, delta, __ATOMIC_ACQ_REL);
+	current = ret + delta;
+	if (current > 0) {
+		return ret;
+	}
+	if (current < 0) {
+		ast_log(LOG_ERROR, "Invalid refcount %d on ao2 object %p\n", current, user_data);
+		abort();
+	}
+
+	if (obj->destructor_fn) {
+		obj->destructor_fn(user_data);
+	}
+	pthread_mutex_destroy(&obj->lock);
+	obj->magic = 0;
+	ast_free(obj);
+
+	return ret;
+}
+
+void ao2_cleanup(void *obj)
+{
+	if (obj) {
+		ao2_ref(obj, -1);
+	}
+}
+
+int ao2_lock(void *user_data)
+{
+	return pthread_mutex_lock(&INTERNAL_OBJ(user_data)->lock);
+}
+
+int ao2_trylock(void *user_data)
+{
+	return pthread_mutex_trylock(&INTERNAL_OBJ(user_data)->lock);
+}
+
+int ao2_unlock(void *user_data)
+{
+	return pthread_mutex_unlock(&INTERNAL_OBJ(user_data)->lock);
+}
+
+void *ao2_object_get_lockaddr(void *user_data)
+{
+	return &INTERNAL_OBJ(user_data)->lock;
+}
+
+/* module */
+
+static int module_refs;
+
+static const struct ast_module_info bench_module_info;
+const struct ast_module_info *ast_module_info = &bench_module_info;
+
+void ast_module_ref(struct ast_module *mod)
+{
+	__atomic_fetch_add(&module_refs, 1, __ATOMIC_RELAXED);
+}
+
+void ast_module_unref(struct ast_module *mod)
+{
+	__atomic_fetch_sub(&module_refs, 1, __ATOMIC_RELAXED);
+}
+
+int bench_module_refs(void)
+{
+	return __atomic_load_n(&module_refs, __ATOMIC_RELAXED);
+}
+
+/* config */
+
+/*! \brief Section of a loaded configuration */
+struct bench_category {
+	char			*name;
+	struct ast_variable	*root;
+	struct ast_variable	*last;
+	struct bench_category	*next;
+};
+
+struct ast_config {
+	struct bench_category	*root;
+	struct bench_category	*last;
+};
+
+static char *config_path;
+/* Overrides of [general], in the order given */
+static struct ast_variable *config_overrides;
+
+void bench_config_file(const char *path)
+{
+	ast_free(config_path);
+	config_path = ast_strdup(path);
+}
+
+static struct ast_variable *variable_new(const char *name, const char *value)
+{
+	size_t name_len = strlen(name) + 1;
+	size_t value_len = strlen(value) + 1;
+	struct ast_variable *var = ast_calloc(1, sizeof(*var) + name_len + value_len);
+	char *buf;
+
+	if (!var) {
+		return NULL;
+	}
+	buf = (char *) (var + 1);
+	var->name = memcpy(buf, name, name_len);
+	var->value = memcpy(buf + name_len, value, value_len);
+	return var;
+}
+
+static void variables_destroy(struct ast_variable *var)
+{
+	struct ast_variable *next;
+
+	for (; var; var = next) {
+		next = var->next;
+		ast_free(var);
+	}
+}
+
+int bench_config_set(const char *option)
+{
+	char *parse = ast_strdupa(option);
+	char *name = ast_strsep(&parse, '=', AST_STRSEP_STRIP);
+	struct ast_variable *var, **tail;
+
+	if (ast_strlen_zero(name) || !parse) {
+		return -1;
+	}
+	var = variable_new(name, ast_strip(parse));
+	if (!var) {
+		return -1;
+	}
+	for (tail = &config_overrides; *tail; tail = &(*tail)->next) {
+	}
+	*tail = var;
+	return 0;
+}
+
+void bench_config_cleanup(void)
+{
+	variables_destroy(config_overrides);
+	config_overrides = NULL;
+	bench_config_file(NULL);
+}
+
+static struct bench_category *category_get(struct ast_config *cfg, const char *name, int create)
+{
+	struct bench_category *cat;
+
+	for (cat = cfg->root; cat; cat = cat->next) {
+		if (!strcasecmp(cat->name, name)) {
+			return cat;
+		}
+	}
+	if (!create || !(cat = ast_calloc(1, sizeof(*cat)))) {
+		return NULL;
+	}
+	cat->name = ast_strdup(name);
+	if (cfg->last) {
+		cfg->last->next = cat;
+	} else {
+		cfg->root = cat;
+	}
+	cfg->last = cat;
+	return cat;
+}
+
+static void category_append(struct bench_category *cat, struct ast_variable *var)
+{
+	if (cat->last) {
+		cat->last->next = var;
+	} else {
+		cat->root = var;
+	}
+	cat->last = var;
+}
+
+/* Remove every variable of the given name */
+static void category_remove(struct bench_category *cat, const char *name)
+{
+	struct ast_variable **link = &cat->root;
+	struct ast_variable *var;
+
+	cat->last = NULL;
+	while ((var = *link)) {
+		if (!strcasecmp(var->name, name)) {
+			*link = var->next;
+			ast_free(var);
+			continue;
+		}
+		cat->last = var;
+		link = &var->next;
+	}
+}
+
+/* Read "[category]" and "name = value" lines, ';' starts a comment */
+static int config_parse(struct ast_config *cfg, const char *path)
+{
+	struct bench_category *cat = NULL;
+	char line[1024];
+	int lineno = 0;
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		ast_log(LOG_WARNING, "Unable to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		char *comment = strchr(line, ';');
+		char *s, *value;
+
+		lineno++;
+		if (comment) {
+			*comment = '\0';
+		}
+		s = ast_strip(line);
+		if (!*s) {
+			continue;
+		}
+		if (*s == '[') {
+			char *end = strchr(s, ']');
+			if (!end) {
+				ast_log(LOG_WARNING, "parse error: no closing ']', line %d of %s\n", lineno, path);
+				continue;
+			}
+			*end = '\0';
+			cat = category_get(cfg, s + 1, 1);
+			continue;
+		}
+		value = strchr(s, '=');
+		if (!value || !cat) {
+			ast_log(LOG_WARNING, "No '=' or category at line %d of %s\n", lineno, path);
+			continue;
+		}
+		*value++ = '\0';
+		if (*value == '>') {
+			value++;
+		}
+		category_append(cat, variable_new(ast_strip(s), ast_strip(value)));
+	}
+	fclose(f);
+	return 0;
+}
+
+struct ast_config *ast_config_load(const char *filename, struct ast_flags flags)
+{
+	struct ast_config *cfg = ast_calloc(1, sizeof(*cfg));
+	struct bench_category *general;
+	struct ast_variable *var, *seen;
+
+	if (!cfg) {
+		return NULL;
+	}
+	if (config_path && config_parse(cfg, config_path)) {
+		ast_config_destroy(cfg);
+		return NULL;
+	}
+	if (!config_path && !config_overrides) {
+		ast_log(LOG_WARNING, "No configuration given for %s\n", filename);
+		ast_config_destroy(cfg);
+		return NULL;
+	}
+
+	general = category_get(cfg, "general", 1);
+	for (var = config_overrides; var; var = var->next) {
+		/* Only the first override of a name replaces the file's values */
+		for (seen = config_overrides; seen != var && strcasecmp(seen->name, var->name); seen = seen->next) {
+		}
+		if (seen == var) {
+			category_remove(general, var->name);
+		}
+		category_append(general, variable_new(var->name, var->value));
+	}
+	return cfg;
+}
+
+void ast_config_destroy(struct ast_config *cfg)
+{
+	struct bench_category *cat, *next;
+
+	if (!cfg) {
+		return;
+	}
+	for (cat = cfg->root; cat; cat = next) {
+		next = cat->next;
+		variables_destroy(cat->root);
+		ast_free(cat->name);
+		ast_free(cat);
+	}
+	ast_free(cfg);
+}
+
+char *ast_category_browse(struct ast_config *config, const char *prev_name)
+{
+	struct bench_category *cat = config->root;
+
+	if (prev_name) {
+		while (cat && cat->name != prev_name) {
+			cat = cat->next;
+		}
+		cat = cat ? cat->next : NULL;
+	}
+	return cat ? cat->name : NULL;
+}
+
+const char *ast_variable_retrieve(struct ast_config *config, const char *category, const char *variable)
+{
+	struct bench_category *cat = category_get(config, category, 0);
+	struct ast_variable *var;
+
+	for (var = cat ? cat->root : NULL; var; var = var->next) {
+		if (!strcasecmp(var->name, variable)) {
+			return var->value;
+		}
+	}
+	return NULL;
+}
+
+struct ast_variable *ast_variable_browse(const struct ast_config *config, const char *category_name)
+{
+	struct bench_category *cat = category_get((struct ast_config *) config, category_name, 0);
+
+	return cat ? cat->root : NULL;
+}
+
+/* format */
+
+struct ast_format {
+	const char		*name;
+	unsigned int		sample_rate;
+};
+
+#define BENCH_FORMAT_CAP_SIZE 8
+
+struct ast_format_cap {
+	struct ast_format	*formats[BENCH_FORMAT_CAP_SIZE];
+	int			count;
+};
+
+static struct ast_format format_slin = { "slin", 8000 };
+static struct ast_format format_slin16 = { "slin16", 16000 };
+static struct ast_format format_ulaw = { "ulaw", 8000 };
+static struct ast_format format_alaw = { "alaw", 8000 };
+
+struct ast_format *ast_format_slin = &format_slin;
+struct ast_format *ast_format_slin16 = &format_slin16;
+struct ast_format *ast_format_ulaw = &format_ulaw;
+struct ast_format *ast_format_alaw = &format_alaw;
+
+enum ast_format_cmp_res ast_format_cmp(const struct ast_format *format1, const struct ast_format *format2)
+{
+	return format1 == format2 ? AST_FORMAT_CMP_EQUAL : AST_FORMAT_CMP_NOT_EQUAL;
+}
+
+const char *ast_format_get_name(const struct ast_format *format)
+{
+	return format->name;
+}
+
+unsigned int ast_format_get_sample_rate(const struct ast_format *format)
+{
+	return format->sample_rate;
+}
+
+struct ast_format_cap *ast_format_cap_alloc(int flags)
+{
+	return ao2_alloc(sizeof(struct ast_format_cap), NULL);
+}
+
+int ast_format_cap_append(struct ast_format_cap *cap, struct ast_format *format, unsigned int framing)
+{
+	if (cap->count == BENCH_FORMAT_CAP_SIZE) {
+		return -1;
+	}
+	cap->formats[cap->count++] = format;
+	return 0;
+}
+
+/* speech */
+
+static AST_LIST_HEAD_NOLOCK(, ast_speech_engine) engines;
+AST_MUTEX_DEFINE_STATIC(engines_lock);
+
+static struct ast_speech_engine *speech_engine_find(const char *name)
+{
+	struct ast_speech_engine *engine;
+
+	AST_LIST_TRAVERSE(&engines, engine, list) {
+		if (!strcasecmp(engine->name, name)) {
+			break;
+		}
+	}
+	return engine;
+}
+
+int ast_speech_register(struct ast_speech_engine *engine)
+{
+	int res = 0;
+
+	if (!engine->create || !engine->write || !engine->destroy) {
+		ast_log(LOG_WARNING, "Speech recognition engine '%s' did not meet minimum API requirements.\n", engine->name);
+		return -1;
+	}
+	ast_mutex_lock(&engines_lock);
+	if (speech_engine_find(engine->name)) {
+		ast_log(LOG_WARNING, "Speech recognition engine '%s' already exists.\n", engine->name);
+		res = -1;
+	} else {
+		AST_LIST_INSERT_TAIL(&engines, engine, list);
+	}
+	ast_mutex_unlock(&engines_lock);
+	return res;
+}
+
+int ast_speech_unregister(const char *engine_name)
+{
+	struct ast_speech_engine *engine;
+
+	ast_mutex_lock(&engines_lock);
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&engines, engine, list) {
+		if (!strcasecmp(engine->name, engine_name)) {
+			AST_LIST_REMOVE_CURRENT(list);
+			break;
+		}
+	}
+	AST_LIST_TRAVERSE_SAFE_END;
+	ast_mutex_unlock(&engines_lock);
+	return engine ? 0 : -1;
+}
+
+struct ast_speech_engine *bench_speech_engine(const char *name)
+{
+	struct ast_speech_engine *engine;
+
+	ast_mutex_lock(&engines_lock);
+	engine = speech_engine_find(name);
+	ast_mutex_unlock(&engines_lock);
+	return engine;
+}
+
+int ast_speech_change_state(struct ast_speech *speech, int state)
+{
+	switch (state) {
+	case AST_SPEECH_STATE_WAIT:
+		/* The engine heard audio, so they spoke */
+		ast_set_flag(speech, AST_SPEECH_SPOKE);
+	default:
+		speech->state = state;
+		break;
+	}
+	return 0;
+}
+
+/* json, enough of jansson's pack to build messages */
+
+struct ast_json {
+	char			*text;
+};
+
+/*! \brief Text being packed */
+struct json_out {
+	char			*buf;
+	size_t			len;
+	size_t			size;
+	int			error;
+};
+
+static void json_put(struct json_out *out, const char *s, size_t len)
+{
+	if (out->error) {
+		return;
+	}
+	if (out->len + len + 1 > out->size) {
+		size_t size = MAX(out->size * 2, out->len + len + 64);
+		char *buf = ast_realloc(out->buf, size);
+		if (!buf) {
+			out->error = 1;
+			return;
+		}
+		out->buf = buf;
+		out->size = size;
+	}
+	memcpy(out->buf + out->len, s, len);
+	out->len += len;
+	out->buf[out->len] = '\0';
+}
+
+static void json_put_string(struct json_out *out, const char *s)
+{
+	char esc[8];
+
+	json_put(out, "\"", 1);
+	for (; *s; s++) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\') {
+			esc[0] = '\\';
+			esc[1] = c;
+			json_put(out, esc, 2);
+		} else if (c < 0x20) {
+			json_put(out, esc, snprintf(esc, sizeof(esc), "\\u%04x", c));
+		} else {
+			json_put(out, s, 1);
+		}
+	}
+	json_put(out, "\"", 1);
+}
+
+struct ast_json *ast_json_pack(char const *format, ...)
+{
+	/* Open containers: '{' or '[' and members written so far */
+	char stack[16];
+	int members[16];
+	int depth = 0;
+	struct json_out out = { NULL, };
+	struct ast_json *json;
+	char num[64];
+	const char *s;
+	va_list ap;
+
+	va_start(ap, format);
+	for (s = format; *s && !out.error; s++) {
+		int is_key;
+
+		if (isspace((unsigned char) *s) || *s == ':' || *s == ',') {
+			continue;
+		}
+		if (*s == '}' || *s == ']') {
+			if (!depth || stack[depth - 1] != (*s == '}' ? '{' : '[')) {
+				out.error = 1;
+				break;
+			}
+			json_put(&out, s, 1);
+			depth--;
+			continue;
+		}
+
+		/* Separators ahead of the next key or value */
+		is_key = depth && stack[depth - 1] == '{' && !(members[depth - 1] % 2);
+		if (depth) {
+			if (members[depth - 1] && (stack[depth - 1] == '[' || is_key)) {
+				json_put(&out, ",", 1);
+			} else if (stack[depth - 1] == '{' && !is_key) {
+				json_put(&out, ":", 1);
+			}
+			members[depth - 1]++;
+		}
+		if (is_key && *s != 's') {
+			out.error = 1;
+			break;
+		}
+
+		switch (*s) {
+		case '{':
+		case '[':
+			if (depth == ARRAY_LEN(stack)) {
+				out.error = 1;
+				break;
+			}
+			stack[depth] = *s;
+			members[depth++] = 0;
+			json_put(&out, s, 1);
+			break;
+		case 's':
+			json_put_string(&out, va_arg(ap, const char *));
+			break;
+		case 'i':
+			json_put(&out, num, snprintf(num, sizeof(num), "%d", va_arg(ap, int)));
+			break;
+		case 'I':
+			json_put(&out, num, snprintf(num, sizeof(num), "%jd", va_arg(ap, intmax_t)));
+			break;
+		case 'f':
+			json_put(&out, num, snprintf(num, sizeof(num), "%.17g", va_arg(ap, double)));
+			break;
+		case 'b':
+			if (va_arg(ap, int)) {
+				json_put(&out, "true", 4);
+			} else {
+				json_put(&out, "false", 5);
+			}
+			break;
+		case 'n':
+			json_put(&out, "null", 4);
+			break;
+		default:
+			out.error = 1;
+			break;
+		}
+	}
+	va_end(ap);
+
+	if (out.error || depth || !(json = ast_calloc(1, sizeof(*json)))) {
+		ast_log(LOG_ERROR, "Error building JSON from '%s'\n", format);
+		ast_free(out.buf);
+		return NULL;
+	}
+	json->text = out.buf;
+	return json;
+}
+
+char *ast_json_dump_string(struct ast_json *root)
+{
+	return root ? ast_strdup(root->text) : NULL;
+}
+
+void ast_json_unref(struct ast_json *value)
+{
+	if (value) {
+		ast_free(value->text);
+		ast_free(value);
+	}
+}
+
+void ast_json_free(void *p)
+{
+	ast_free(p);
+}
+
+/* cli */
+
+static AST_VECTOR(, struct ast_cli_entry *) cli_entries;
+AST_MUTEX_DEFINE_STATIC(cli_lock);
+
+void ast_cli(int fd, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vdprintf(fd, fmt, ap);
+	va_end(ap);
+}
+
+int ast_cli_register_multiple(struct ast_cli_entry *e, int len)
+{
+	int i, res = 0;
+
+	ast_mutex_lock(&cli_lock);
+	for (i = 0; i < len; i++) {
+		/* The handler fills in the command */
+		e[i].handler(&e[i], CLI_INIT, NULL);
+		res |= AST_VECTOR_APPEND(&cli_entries, &e[i]);
+	}
+	ast_mutex_unlock(&cli_lock);
+	return res;
+}
+
+int ast_cli_unregister_multiple(struct ast_cli_entry *e, int len)
+{
+	size_t i;
+	int j;
+
+	ast_mutex_lock(&cli_lock);
+	for (i = 0; i < AST_VECTOR_SIZE(&cli_entries);) {
+		struct ast_cli_entry *entry = AST_VECTOR_GET(&cli_entries, i);
+
+		for (j = 0; j < len && entry != &e[j]; j++) {
+		}
+		if (j < len) {
+			AST_VECTOR_GET(&cli_entries, i) = AST_VECTOR_GET(&cli_entries, AST_VECTOR_SIZE(&cli_entries) - 1);
+			AST_VECTOR_SIZE(&cli_entries)--;
+		} else {
+			i++;
+		}
+	}
+	if (!AST_VECTOR_SIZE(&cli_entries)) {
+		AST_VECTOR_FREE(&cli_entries);
+	}
+	ast_mutex_unlock(&cli_lock);
+	return 0;
+}
+
+int bench_cli_exec(int fd, const char *line)
+{
+	char *argv[16];
+	char *parse = ast_strdupa(line);
+	char *word;
+	int argc = 0;
+	size_t i;
+
+	while ((word = strsep(&parse, " \t")) && argc < (int) ARRAY_LEN(argv)) {
+		if (*word) {
+			argv[argc++] = word;
+		}
+	}
+
+	ast_mutex_lock(&cli_lock);
+	for (i = 0; i < AST_VECTOR_SIZE(&cli_entries); i++) {
+		struct ast_cli_entry *e = AST_VECTOR_GET(&cli_entries, i);
+		char *command = ast_strdupa(e->command);
+		char *cmd_word;
+		int n = 0;
+
+		while ((cmd_word = strsep(&command, " ")) && n < argc && !strcasecmp(cmd_word, argv[n])) {
+			n++;
+		}
+		if (!cmd_word) {
+			struct ast_cli_args a = { .fd = fd, .argc = argc, .argv = (const char * const *) argv, .line = line };
+			char *res = e->handler(e, 0, &a);
+
+			ast_mutex_unlock(&cli_lock);
+			if (res == CLI_SHOWUSAGE) {
+				ast_cli(fd, "%s", e->usage);
+			}
+			return res == CLI_SUCCESS ? 0 : -1;
+		}
+	}
+	ast_mutex_unlock(&cli_lock);
+	ast_cli(fd, "No such command '%s'\n", line);
+	return -1;
+}
+
+/* manager, the harness has no manager sessions */
+
+const char *astman_get_header(const struct message *m, char *var)
+{
+	return "";
+}
+
+void astman_append(struct mansession *s, const char *fmt, ...)
+{
+}
+
+void astman_send_listack(struct mansession *s, const struct message *m, char *msg, char *listflag)
+{
+}
+
+void astman_send_list_complete_start(struct mansession *s, const struct message *m, const char *event_name, int count)
+{
+}
+
+void astman_send_list_complete_end(struct mansession *s)
+{
+}
+
+int ast_manager_register_xml(const char *action, int authority, int (*func)(struct mansession *s, const struct message *m))
+{
+	return 0;
+}
+
+int ast_manager_unregister(const char *action)
+{
+	return 0;
+}
+
+/* channel, datastore and pbx, the harness has no channels */
+
+void ast_channel_lock(struct ast_channel *chan)
+{
+}
+
+void ast_channel_unlock(struct ast_channel *chan)
+{
+}
+
+ast_callid ast_channel_callid(const struct ast_channel *chan)
+{
+	return 0;
+}
+
+struct ast_datastore *ast_datastore_alloc(const struct ast_datastore_info *info, const char *uid)
+{
+	return NULL;
+}
+
+int ast_datastore_free(struct ast_datastore *datastore)
+{
+	return 0;
+}
+
+int ast_channel_datastore_add(struct ast_channel *chan, struct ast_datastore *datastore)
+{
+	return -1;
+}
+
+int ast_channel_datastore_remove(struct ast_channel *chan, struct ast_datastore *datastore)
+{
+	return -1;
+}
+
+struct ast_datastore *ast_channel_datastore_find(struct ast_channel *chan, const struct ast_datastore_info *info, const char *uid)
+{
+	return NULL;
+}
+
+int ast_custom_function_register(struct ast_custom_function *acf)
+{
+	return 0;
+}
+
+int ast_custom_function_unregister(struct ast_custom_function *acf)
+{
+	return 0;
+}
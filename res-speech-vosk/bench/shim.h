@@ -0,0 +1,64 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Harness side of the Asterisk stand-in
+ *
+ * What the benchmark needs from the stand-in on top of the Asterisk API:
+ * where the configuration comes from, access to the registered engine
+ * and CLI commands, and the module entry points.
+ */
+
+#ifndef BENCH_SHIM_H
+#define BENCH_SHIM_H
+
+#include "asterisk.h"
+
+/*! \brief File ast_config_load reads instead of the one it is asked for, NULL for none */
+void bench_config_file(const char *path);
+
+/*!
+ * \brief Override a [general] option given as "name=value"
+ *
+ * The first override of a name replaces what the file has, later ones
+ * of the same name add to it, so several backends can be given.
+ */
+int bench_config_set(const char *option);
+
+/*! \brief Drop all overrides */
+void bench_config_cleanup(void);
+
+/*! \brief Registered speech engine of the given name, NULL if none */
+struct ast_speech_engine *bench_speech_engine(const char *name);
+
+/*!
+ * \brief Run a registered CLI command, output goes to fd
+ *
+ * \retval 0 command ran
+ * \retval -1 no such command or it failed
+ */
+int bench_cli_exec(int fd, const char *line);
+
+/*! \brief References the module currently holds on itself */
+int bench_module_refs(void);
+
+/*! \brief Websocket connections currently open */
+int bench_websocket_count(void);
+
+/* Entry points of the module, see AST_MODULE_INFO_STANDARD */
+int bench_module_load(void);
+int bench_module_unload(void);
+
+#endif /* BENCH_SHIM_H */
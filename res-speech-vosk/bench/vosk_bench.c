@@ -0,0 +1,690 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Load generator for the Vosk speech engine
+ *
+ * Loads res_speech_vosk into the Asterisk stand-in and drives sessions
+ * through the speech engine callbacks the way SpeechBackground does: one
+ * thread per channel creates a session, writes the audio of a WAV file
+ * frame by frame at a multiple of real time, keeps writing silence until
+ * the engine reports a result and destroys the session again. Reports
+ * throughput, CPU time per session and latency percentiles.
+ *
+ * Also replays the audio the module captured (see capture_dir): a
+ * capture directory given instead of a WAV file stands for all its
+ * utterances, and results are checked against the captured text.
+ */
+
+#include "asterisk.h"
+
+#include <dirent.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "shim.h"
+#include "../vosk_hist.h"
+#include "../vosk_result.h"
+
+/* Speech engine run by default, the one of a configuration without engine sections */
+#define BENCH_ENGINE "vosk"
+/* Stack of the channel threads */
+#define BENCH_STACK_SIZE (256 * 1024)
+
+/*! \brief Audio of one WAV file, ready to write in the channel format */
+typedef struct bench_audio_t {
+	const char		*path;
+	char			*data;
+	size_t			len;
+	/* Sample rate of the file */
+	int			rate;
+	/* Captured final result, NULL if not a capture */
+	char			*expected;
+	/* Set when path was allocated here */
+	int			owned;
+} bench_audio_t;
+
+/*! \brief Run settings and results shared by the channel threads */
+typedef struct bench_t {
+	struct ast_speech_engine *engine;
+	struct ast_format	*format;
+	bench_audio_t		*audio;
+	int			audio_count;
+	/* Frame duration (ms) and size in the channel format */
+	int			frame_ms;
+	size_t			frame_bytes;
+	/* Byte of silence in the channel format */
+	char			silence;
+	/* Audio speed, multiple of real time */
+	double			speed;
+	/* Concurrent channels and sessions to run in total */
+	int			concurrency;
+	int			total;
+	/* Spread of the first session starts (ms) */
+	int			ramp;
+	/* Longest wait for a result after the audio ended (ms) */
+	int			wait;
+	/* Next session to run */
+	int			next;
+	/* Outcomes */
+	int			completed;
+	int			timeouts;
+	int			failures;
+	int			recognized;
+	/* Results checked against a capture and how many of them matched */
+	int			checked;
+	int			matched;
+	/* Audio written (ms) */
+	uint64_t		audio_ms;
+	/* Session create time and time from the end of the audio to the result (ms) */
+	vosk_hist_t		create;
+	vosk_hist_t		final;
+} bench_t;
+
+/*! \brief Channel thread */
+typedef struct bench_channel_t {
+	bench_t			*bench;
+	int			index;
+	pthread_t		thread;
+	char			*silence;
+} bench_channel_t;
+
+static int64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_us(int64_t deadline)
+{
+	struct timespec ts = { .tv_sec = deadline / 1000000, .tv_nsec = (deadline % 1000000) * 1000 };
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+	}
+}
+
+/* G.711 encoders, the classic reference implementation */
+static int g711_segment(int value, const int *ends)
+{
+	int i;
+
+	for (i = 0; i < 8 && value > ends[i]; i++) {
+	}
+	return i;
+}
+
+static uint8_t linear2ulaw(int16_t sample)
+{
+	static const int ends[8] = { 0x3f, 0x7f, 0xff, 0x1ff, 0x3ff, 0x7ff, 0xfff, 0x1fff };
+	int value = sample >> 2;
+	int mask = 0xff;
+	int seg;
+
+	if (value < 0) {
+		value = -value;
+		mask = 0x7f;
+	}
+	value = MIN(value, 8159) + (0x84 >> 2);
+	seg = g711_segment(value, ends);
+	if (seg >= 8) {
+		return 0x7f ^ mask;
+	}
+	return ((seg << 4) | ((value >> (seg + 1)) & 0xf)) ^ mask;
+}
+
+static uint8_t linear2alaw(int16_t sample)
+{
+	static const int ends[8] = { 0x1f, 0x3f, 0x7f, 0xff, 0x1ff, 0x3ff, 0x7ff, 0xfff };
+	int value = sample >> 3;
+	int mask = 0xd5;
+	int seg;
+
+	if (value < 0) {
+		value = -value - 1;
+		mask = 0x55;
+	}
+	seg = g711_segment(value, ends);
+	if (seg >= 8) {
+		return 0x7f ^ mask;
+	}
+	return ((seg << 4) | ((value >> (seg < 2 ? 1 : seg)) & 0xf)) ^ mask;
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint16_t le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+/*! \brief Load a 16 bit mono PCM WAV file */
+static int bench_audio_load(bench_audio_t *audio, const char *path)
+{
+	uint8_t *file = NULL, *p, *end;
+	struct stat st;
+	FILE *f;
+	int format_ok = 0;
+
+	f = fopen(path, "rb");
+	if (!f || fstat(fileno(f), &st) || !(file = ast_malloc(st.st_size))
+		|| fread(file, 1, st.st_size, f) != (size_t) st.st_size) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		goto error;
+	}
+	if (st.st_size < 12 || memcmp(file, "RIFF", 4) || memcmp(file + 8, "WAVE", 4)) {
+		fprintf(stderr, "%s: not a WAV file\n", path);
+		goto error;
+	}
+
+	end = file + st.st_size;
+	for (p = file + 12; p + 8 <= end; p += 8 + ((le32(p + 4) + 1) & ~1U)) {
+		uint32_t size = le32(p + 4);
+
+		if (size > (size_t) (end - p - 8)) {
+			size = end - p - 8;
+		}
+		if (!memcmp(p, "fmt ", 4) && size >= 16) {
+			if (le16(p + 8) != 1 || le16(p + 10) != 1 || le16(p + 22) != 16) {
+				fprintf(stderr, "%s: only 16 bit mono PCM is supported\n", path);
+				goto error;
+			}
+			audio->rate = le32(p + 12);
+			format_ok = 1;
+		} else if (!memcmp(p, "data", 4) && format_ok) {
+			audio->len = size & ~1U;
+			audio->data = ast_malloc(audio->len);
+			if (!audio->data) {
+				goto error;
+			}
+			memcpy(audio->data, p + 8, audio->len);
+			break;
+		}
+	}
+	if (!audio->data) {
+		fprintf(stderr, "%s: no audio found\n", path);
+		goto error;
+	}
+	if (audio->rate != 8000 && audio->rate != 16000) {
+		fprintf(stderr, "%s: sample rate must be 8000 or 16000, not %d\n", path, audio->rate);
+		goto error;
+	}
+	fclose(f);
+	ast_free(file);
+	return 0;
+
+error:
+	if (f) {
+		fclose(f);
+	}
+	ast_free(file);
+	return -1;
+}
+
+/*!
+ * \brief Pick up the final result captured with the audio
+ *
+ * Captures are <name>.wav with the metadata in <name>.json.
+ */
+static void bench_audio_load_expected(bench_audio_t *audio)
+{
+	vosk_result_t *result;
+	char meta[PATH_MAX], buf[8192];
+	size_t len = strlen(audio->path);
+	FILE *f;
+
+	if (len < 4 || strcasecmp(audio->path + len - 4, ".wav")) {
+		return;
+	}
+	snprintf(meta, sizeof(meta), "%.*s.json", (int) len - 4, audio->path);
+	f = fopen(meta, "r");
+	if (!f) {
+		return;
+	}
+	len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+
+	/* The metadata carries the text the way recognizers do */
+	result = ast_malloc(sizeof(*result));
+	if (result && !vosk_result_scan(result, buf, len) && result->kind == VOSK_RESULT_TEXT) {
+		audio->expected = ast_strdup(result->text);
+	}
+	ast_free(result);
+}
+
+static int bench_wav_filter(const struct dirent *entry)
+{
+	size_t len = strlen(entry->d_name);
+
+	return len > 4 && !strcasecmp(entry->d_name + len - 4, ".wav");
+}
+
+/*!
+ * \brief Add the files of the command line, directories by their WAV files
+ *
+ * Directory entries are taken in name order, so a replay is repeatable.
+ */
+static int bench_audio_add_path(bench_t *bench, const char *path)
+{
+	struct dirent **entries;
+	bench_audio_t *audio;
+	int count, i, res = 0;
+	struct stat st;
+
+	if (stat(path, &st) || !S_ISDIR(st.st_mode)) {
+		entries = NULL;
+		count = 1;
+	} else {
+		count = scandir(path, &entries, bench_wav_filter, alphasort);
+		if (count <= 0) {
+			fprintf(stderr, "%s: no WAV files\n", path);
+			return -1;
+		}
+	}
+
+	audio = ast_realloc(bench->audio, (bench->audio_count + count) * sizeof(*audio));
+	if (!audio) {
+		return -1;
+	}
+	bench->audio = audio;
+	memset(audio + bench->audio_count, 0, count * sizeof(*audio));
+
+	for (i = 0; i < count; i++) {
+		audio = &bench->audio[bench->audio_count++];
+		if (entries) {
+			char *file = ast_malloc(strlen(path) + strlen(entries[i]->d_name) + 2);
+
+			sprintf(file, "%s/%s", path, entries[i]->d_name);
+			audio->path = file;
+			audio->owned = 1;
+			free(entries[i]);
+		} else {
+			audio->path = path;
+		}
+		if (!res && bench_audio_load(audio, audio->path)) {
+			res = -1;
+		}
+		bench_audio_load_expected(audio);
+	}
+	free(entries);
+	return res;
+}
+
+/*! \brief Bring the audio to the channel format */
+static int bench_audio_encode(bench_audio_t *audio, struct ast_format *format)
+{
+	const int16_t *pcm = (const int16_t *) audio->data;
+	size_t samples = audio->len / 2;
+	uint8_t *out;
+	size_t i;
+
+	if (audio->rate != (int) ast_format_get_sample_rate(format)) {
+		fprintf(stderr, "%s: %d Hz audio cannot be sent as %s\n", audio->path, audio->rate, ast_format_get_name(format));
+		return -1;
+	}
+	if (format != ast_format_ulaw && format != ast_format_alaw) {
+		return 0;
+	}
+	/* Encoded in place, every sample shrinks to one byte */
+	out = (uint8_t *) audio->data;
+	for (i = 0; i < samples; i++) {
+		out[i] = format == ast_format_ulaw ? linear2ulaw(pcm[i]) : linear2alaw(pcm[i]);
+	}
+	audio->len = samples;
+	return 0;
+}
+
+/*!
+ * \brief Write one frame and pick up the engine verdict
+ *
+ * \retval 1 the engine has a result
+ */
+static int bench_write(struct ast_speech *speech, void *data, size_t len)
+{
+	speech->engine->write(speech, data, len);
+	return speech->state == AST_SPEECH_STATE_DONE;
+}
+
+/*! \brief Run one session, as SpeechCreate, SpeechStart and SpeechBackground would */
+static void bench_session(bench_channel_t *channel, int index)
+{
+	bench_t *bench = channel->bench;
+	bench_audio_t *audio = &bench->audio[index % bench->audio_count];
+	struct ast_speech speech = { .engine = bench->engine, .format = bench->format };
+	struct ast_speech_result *result;
+	int64_t interval = bench->frame_ms * 1000 / bench->speed;
+	int64_t start, next, audio_end;
+	size_t pos, len;
+	int done = 0;
+
+	ast_mutex_init(&speech.lock);
+
+	start = now_us();
+	if (bench->engine->create(&speech, bench->format)) {
+		ast_log(LOG_WARNING, "Session %d: create failed\n", index);
+		__atomic_fetch_add(&bench->failures, 1, __ATOMIC_RELAXED);
+		ast_mutex_destroy(&speech.lock);
+		return;
+	}
+	vosk_hist_record(&bench->create, (now_us() - start) / 1000);
+
+	speech.flags = 0;
+	speech.state = AST_SPEECH_STATE_NOT_READY;
+	if (bench->engine->start) {
+		bench->engine->start(&speech);
+	}
+
+	/* Frames go out on a fixed schedule, a slow write does not shift later frames */
+	next = now_us();
+	for (pos = 0; pos < audio->len && !done; pos += len) {
+		len = MIN(bench->frame_bytes, audio->len - pos);
+		sleep_until_us(next);
+		next += interval;
+		done = bench_write(&speech, audio->data + pos, len);
+	}
+	audio_end = now_us();
+	__atomic_fetch_add(&bench->audio_ms, (uint64_t) pos * bench->frame_ms / bench->frame_bytes, __ATOMIC_RELAXED);
+
+	/* The caller stays silent until the engine is through */
+	while (!done && now_us() - audio_end < (int64_t) bench->wait * 1000) {
+		sleep_until_us(next);
+		next += interval;
+		done = bench_write(&speech, channel->silence, bench->frame_bytes);
+	}
+
+	if (done) {
+		vosk_hist_record(&bench->final, (now_us() - audio_end) / 1000);
+		__atomic_fetch_add(&bench->completed, 1, __ATOMIC_RELAXED);
+		result = bench->engine->get(&speech);
+		if (result) {
+			if (!ast_strlen_zero(result->text)) {
+				__atomic_fetch_add(&bench->recognized, 1, __ATOMIC_RELAXED);
+			}
+			ast_verb(3, "Session %d (%s): '%s'\n", index, audio->path, S_OR(result->text, ""));
+			if (audio->expected) {
+				__atomic_fetch_add(&bench->checked, 1, __ATOMIC_RELAXED);
+				if (!strcmp(audio->expected, S_OR(result->text, ""))) {
+					__atomic_fetch_add(&bench->matched, 1, __ATOMIC_RELAXED);
+				} else {
+					ast_verb(2, "Session %d (%s): '%s', captured '%s'\n", index, audio->path,
+						S_OR(result->text, ""), audio->expected);
+				}
+			}
+			ast_free(result->text);
+			ast_free(result);
+		}
+	} else {
+		ast_log(LOG_WARNING, "Session %d: no result within %d ms\n", index, bench->wait);
+		__atomic_fetch_add(&bench->timeouts, 1, __ATOMIC_RELAXED);
+	}
+
+	bench->engine->destroy(&speech);
+	ast_mutex_destroy(&speech.lock);
+}
+
+static void *bench_channel_thread(void *data)
+{
+	bench_channel_t *channel = data;
+	bench_t *bench = channel->bench;
+	int index;
+
+	/* Channels come up spread over the ramp, not all at once */
+	sleep_until_us(now_us() + (int64_t) bench->ramp * 1000 * channel->index / bench->concurrency);
+	while ((index = __atomic_fetch_add(&bench->next, 1, __ATOMIC_RELAXED)) < bench->total) {
+		bench_session(channel, index);
+	}
+	return NULL;
+}
+
+static void bench_report_hist(const char *name, const vosk_hist_t *hist)
+{
+	printf("  %-14s %10" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n",
+		name, vosk_hist_count(hist), vosk_hist_mean(hist), vosk_hist_percentile(hist, 50),
+		vosk_hist_percentile(hist, 90), vosk_hist_percentile(hist, 99), vosk_hist_max(hist));
+}
+
+static double tv_seconds(struct timeval tv)
+{
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void bench_report(bench_t *bench, int64_t wall_us, struct rusage *ru_start, struct rusage *ru_end)
+{
+	double wall = wall_us / 1e6;
+	double user = tv_seconds(ru_end->ru_utime) - tv_seconds(ru_start->ru_utime);
+	double sys = tv_seconds(ru_end->ru_stime) - tv_seconds(ru_start->ru_stime);
+	int sessions = bench->completed + bench->timeouts;
+
+	printf("Sessions:      %d completed (%d with text), %d timed out, %d failed\n",
+		bench->completed, bench->recognized, bench->timeouts, bench->failures);
+	if (bench->checked) {
+		printf("Replay:        %d of %d results match the capture\n", bench->matched, bench->checked);
+	}
+	printf("Wall time:     %.3f s\n", wall);
+	printf("Throughput:    %.2f sessions/s, %.1f s of audio per second\n",
+		wall > 0 ? bench->completed / wall : 0, wall > 0 ? bench->audio_ms / 1000.0 / wall : 0);
+	printf("CPU:           %.3f s user, %.3f s system, %.2f ms per session, %.2f cores\n",
+		user, sys, sessions ? (user + sys) * 1000 / sessions : 0, wall > 0 ? (user + sys) / wall : 0);
+	printf("Latency (ms)        Count     Mean      P50      P90      P99      Max\n");
+	bench_report_hist("create", &bench->create);
+	bench_report_hist("final", &bench->final);
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [options] file.wav|directory [file.wav|directory ...]\n"
+		"\n"
+		"Runs sessions of the Vosk speech engine on the given 16 bit mono WAV\n"
+		"files, taking them in turn. A directory stands for its WAV files; for\n"
+		"captured audio the results are checked against the captured text.\n"
+		"\n"
+		"  -c <file>       module configuration, e.g. res_speech_vosk.conf\n"
+		"  -o <name=value> set a [general] option, may be repeated\n"
+		"  -e <engine>     speech engine, i.e. configuration section (default " BENCH_ENGINE ")\n"
+		"  -n <count>      concurrent sessions (default 10)\n"
+		"  -t <count>      sessions to run in total (default: the -n value)\n"
+		"  -s <factor>     audio speed as a multiple of real time (default 1)\n"
+		"  -f <format>     channel format: slin, slin16, ulaw or alaw\n"
+		"                  (default slin or slin16, by the WAV sample rate)\n"
+		"  -p <ms>         frame duration (default 20)\n"
+		"  -r <ms>         spread the first session starts over this time (default 1000)\n"
+		"  -w <ms>         longest wait for a result after the audio (default 10000)\n"
+		"  -q              do not print the module statistics\n"
+		"  -v              more verbose, -vvv prints every result\n"
+		"  -d              more debug output\n",
+		argv0);
+}
+
+int main(int argc, char *argv[])
+{
+	bench_t bench = {
+		.concurrency = 10,
+		.speed = 1,
+		.frame_ms = 20,
+		.ramp = 1000,
+		.wait = 10000,
+	};
+	bench_channel_t *channels = NULL;
+	const char *format_name = NULL;
+	const char *engine_name = BENCH_ENGINE;
+	struct rusage ru_start, ru_end;
+	pthread_attr_t attr;
+	int64_t start;
+	int quiet = 0;
+	int res = 1;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "c:o:e:n:t:s:f:p:r:w:qvdh")) != -1) {
+		switch (opt) {
+		case 'c':
+			bench_config_file(optarg);
+			break;
+		case 'o':
+			if (bench_config_set(optarg)) {
+				fprintf(stderr, "Option must be name=value: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'e':
+			engine_name = optarg;
+			break;
+		case 'n':
+			bench.concurrency = atoi(optarg);
+			break;
+		case 't':
+			bench.total = atoi(optarg);
+			break;
+		case 's':
+			bench.speed = atof(optarg);
+			break;
+		case 'f':
+			format_name = optarg;
+			break;
+		case 'p':
+			bench.frame_ms = atoi(optarg);
+			break;
+		case 'r':
+			bench.ramp = atoi(optarg);
+			break;
+		case 'w':
+			bench.wait = atoi(optarg);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		case 'v':
+			option_verbose++;
+			break;
+		case 'd':
+			option_debug++;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind == argc || bench.concurrency < 1 || bench.speed <= 0 || bench.frame_ms < 1
+		|| bench.ramp < 0 || bench.wait < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (!bench.total) {
+		bench.total = bench.concurrency;
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (bench_audio_add_path(&bench, argv[i])) {
+			goto cleanup;
+		}
+	}
+
+	if (!format_name) {
+		bench.format = bench.audio[0].rate == 16000 ? ast_format_slin16 : ast_format_slin;
+	} else if (!strcasecmp(format_name, "slin")) {
+		bench.format = ast_format_slin;
+	} else if (!strcasecmp(format_name, "slin16")) {
+		bench.format = ast_format_slin16;
+	} else if (!strcasecmp(format_name, "ulaw")) {
+		bench.format = ast_format_ulaw;
+	} else if (!strcasecmp(format_name, "alaw")) {
+		bench.format = ast_format_alaw;
+	} else {
+		fprintf(stderr, "Unknown format %s\n", format_name);
+		goto cleanup;
+	}
+	for (i = 0; i < bench.audio_count; i++) {
+		if (bench_audio_encode(&bench.audio[i], bench.format)) {
+			goto cleanup;
+		}
+	}
+	if (bench.format == ast_format_ulaw) {
+		bench.frame_bytes = 8 * bench.frame_ms;
+		bench.silence = (char) 0xff;
+	} else if (bench.format == ast_format_alaw) {
+		bench.frame_bytes = 8 * bench.frame_ms;
+		bench.silence = (char) 0xd5;
+	} else {
+		bench.frame_bytes = ast_format_get_sample_rate(bench.format) / 1000 * 2 * bench.frame_ms;
+	}
+
+	if (bench_module_load() != AST_MODULE_LOAD_SUCCESS) {
+		fprintf(stderr, "Module failed to load\n");
+		goto cleanup;
+	}
+	bench.engine = bench_speech_engine(engine_name);
+	if (!bench.engine) {
+		fprintf(stderr, "Module did not register the %s engine\n", engine_name);
+		bench_module_unload();
+		goto cleanup;
+	}
+
+	channels = ast_calloc(bench.concurrency, sizeof(*channels));
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, BENCH_STACK_SIZE);
+	getrusage(RUSAGE_SELF, &ru_start);
+	start = now_us();
+	for (i = 0; i < bench.concurrency; i++) {
+		channels[i].bench = &bench;
+		channels[i].index = i;
+		channels[i].silence = ast_malloc(bench.frame_bytes);
+		memset(channels[i].silence, bench.silence, bench.frame_bytes);
+		if (pthread_create(&channels[i].thread, &attr, bench_channel_thread, &channels[i])) {
+			fprintf(stderr, "Failed to start channel %d\n", i);
+			channels[i].thread = AST_PTHREADT_NULL;
+		}
+	}
+	for (i = 0; i < bench.concurrency; i++) {
+		if (channels[i].thread != AST_PTHREADT_NULL) {
+			pthread_join(channels[i].thread, NULL);
+		}
+		ast_free(channels[i].silence);
+	}
+	getrusage(RUSAGE_SELF, &ru_end);
+	pthread_attr_destroy(&attr);
+
+	bench_report(&bench, now_us() - start, &ru_start, &ru_end);
+	if (!quiet) {
+		printf("\n");
+		fflush(stdout);
+		bench_cli_exec(STDOUT_FILENO, "vosk show stats");
+	}
+
+	bench_module_unload();
+	if (bench_websocket_count() || bench_module_refs()) {
+		fprintf(stderr, "Leaked %d websockets and %d module references\n",
+			bench_websocket_count(), bench_module_refs());
+	}
+	res = bench.failures || bench.timeouts ? 2 : 0;
+
+cleanup:
+	for (i = 0; i < bench.audio_count; i++) {
+		ast_free(bench.audio[i].data);
+		ast_free(bench.audio[i].expected);
+		if (bench.audio[i].owned) {
+			ast_free((char *) bench.audio[i].path);
+		}
+	}
+	ast_free(bench.audio);
+	ast_free(channels);
+	bench_config_cleanup();
+	return res;
+}
@@ -0,0 +1,898 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Stand-in for vosk-server with scripted results
+ *
+ * Speaks the vosk-server websocket protocol: a configuration message,
+ * binary 16 bit audio answered one reply per message with a "partial" or
+ * a final "text" result, "reset" and "eof". Nothing is recognized; every
+ * utterance gets the next transcript of a script, revealed word by word
+ * in the partials. Replies can be delayed, delayed at random, stalled and
+ * connections dropped in the middle of an utterance, and clients pinged
+ * between messages, all from a seeded generator so a run can be repeated.
+ *
+ * One thread serves each connection and handles its messages in order,
+ * like vosk-server does, so a slow reply holds back reading the next
+ * message and the client sees backpressure.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define MOCK_SAMPLE_RATE 8000
+/* Largest message accepted from a client */
+#define MOCK_MAX_MESSAGE (1024 * 1024)
+/* Mean absolute sample value above which audio counts as speech */
+#define MOCK_VOICE_LEVEL 300
+#define MOCK_STACK_SIZE (128 * 1024)
+
+#define WS_OP_CONTINUATION	0x0
+#define WS_OP_TEXT		0x1
+#define WS_OP_BINARY		0x2
+#define WS_OP_CLOSE		0x8
+#define WS_OP_PING		0x9
+#define WS_OP_PONG		0xa
+
+/*! \brief Server settings */
+typedef struct mock_config_t {
+	/* Transcripts, handed out in turn, one per utterance */
+	char			**script;
+	int			script_len;
+	/* Audio after which an utterance ends, 0 to end on silence (ms) */
+	int			utterance;
+	/* Silence after speech that ends an utterance (ms) */
+	int			endpoint;
+	/* Audio per word revealed in the partials (ms) */
+	int			word;
+	/* Delay of every reply and random extra delay up to jitter (ms) */
+	int			delay;
+	int			jitter;
+	/* Chance per message (%) to stop serving the connection for stall ms */
+	int			stall_pct;
+	int			stall;
+	/* Chance per utterance (%) to drop the connection half way */
+	int			drop_pct;
+	/* Chance per message (%) to ping the client */
+	int			ping_pct;
+	unsigned int		seed;
+	int			verbose;
+} mock_config_t;
+
+/*! \brief Counters, printed at exit */
+typedef struct mock_stats_t {
+	unsigned int		connections;
+	unsigned int		active;
+	uint64_t		messages;
+	uint64_t		bytes;
+	unsigned int		utterances;
+	unsigned int		stalls;
+	unsigned int		drops;
+	unsigned int		pings;
+} mock_stats_t;
+
+/*! \brief One client connection */
+typedef struct mock_conn_t {
+	int			fd;
+	unsigned int		id;
+	/* Generator state, seeded from the connection number */
+	unsigned int		rand;
+	int			sample_rate;
+	/* Message being received */
+	uint8_t			*msg;
+	size_t			msg_len;
+	int			msg_opcode;
+	/* Current utterance: transcript, audio and speech seen, trailing silence (ms) */
+	const char		*text;
+	int			audio_ms;
+	int			voice_ms;
+	int			silence_ms;
+	/* Audio after which the connection is dropped, -1 for never (ms) */
+	int			drop_ms;
+} mock_conn_t;
+
+static mock_config_t config = {
+	.endpoint = 600,
+	.word = 250,
+	.seed = 1,
+};
+static mock_stats_t stats;
+static unsigned int next_utterance;
+static volatile sig_atomic_t stopping;
+
+#define mock_log(conn, fmt, ...) do { \
+	if (config.verbose) { \
+		fprintf(stderr, "[%u] " fmt "\n", (conn)->id, ##__VA_ARGS__); \
+	} \
+} while (0)
+
+/* SHA-1 of the handshake key, RFC 3174; keys are short, so the input is at most 3 blocks */
+static int sha1(const uint8_t *data, size_t len, uint8_t digest[20])
+{
+	uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+	uint8_t msg[192] = { 0 };
+	size_t padded = (len + 8) / 64 * 64 + 64;
+	uint64_t bits = (uint64_t) len * 8;
+	size_t pos, i;
+
+	if (padded > sizeof(msg)) {
+		return -1;
+	}
+	memcpy(msg, data, len);
+	msg[len] = 0x80;
+	for (i = 0; i < 8; i++) {
+		msg[padded - 1 - i] = bits >> (8 * i);
+	}
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+	for (pos = 0; pos < padded; pos += 64) {
+		uint32_t w[80], a, b, c, d, e, f, k, t;
+
+		for (i = 0; i < 16; i++) {
+			const uint8_t *p = msg + pos + 4 * i;
+
+			w[i] = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+		}
+		for (i = 16; i < 80; i++) {
+			w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+		}
+		a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+		for (i = 0; i < 80; i++) {
+			if (i < 20) {
+				f = (b & c) | (~b & d);
+				k = 0x5a827999;
+			} else if (i < 40) {
+				f = b ^ c ^ d;
+				k = 0x6ed9eba1;
+			} else if (i < 60) {
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8f1bbcdc;
+			} else {
+				f = b ^ c ^ d;
+				k = 0xca62c1d6;
+			}
+			t = ROL(a, 5) + f + e + k + w[i];
+			e = d; d = c; c = ROL(b, 30); b = a; a = t;
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+	}
+#undef ROL
+
+	for (i = 0; i < 20; i++) {
+		digest[i] = h[i / 4] >> (24 - 8 * (i % 4));
+	}
+	return 0;
+}
+
+static void base64_encode(char *dst, const uint8_t *src, size_t len)
+{
+	static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t i;
+
+	for (i = 0; i + 2 < len; i += 3) {
+		*dst++ = b64[src[i] >> 2];
+		*dst++ = b64[((src[i] & 0x03) << 4) | (src[i + 1] >> 4)];
+		*dst++ = b64[((src[i + 1] & 0x0f) << 2) | (src[i + 2] >> 6)];
+		*dst++ = b64[src[i + 2] & 0x3f];
+	}
+	if (i < len) {
+		*dst++ = b64[src[i] >> 2];
+		if (i + 1 < len) {
+			*dst++ = b64[((src[i] & 0x03) << 4) | (src[i + 1] >> 4)];
+			*dst++ = b64[(src[i + 1] & 0x0f) << 2];
+		} else {
+			*dst++ = b64[(src[i] & 0x03) << 4];
+			*dst++ = '=';
+		}
+		*dst++ = '=';
+	}
+	*dst = '\0';
+}
+
+static void sleep_ms(int ms)
+{
+	struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (long) (ms % 1000) * 1000000 };
+
+	while (nanosleep(&ts, &ts) && errno == EINTR) {
+	}
+}
+
+/* Random number below n, 0 if n is not positive */
+static int mock_rand(mock_conn_t *conn, int n)
+{
+	return n > 0 ? rand_r(&conn->rand) % n : 0;
+}
+
+static int send_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t res;
+
+	while (len) {
+		res = send(fd, p, len, MSG_NOSIGNAL);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		if (res <= 0) {
+			return -1;
+		}
+		p += res;
+		len -= res;
+	}
+	return 0;
+}
+
+static int recv_all(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t res;
+
+	while (len) {
+		res = recv(fd, p, len, 0);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		if (res <= 0) {
+			return -1;
+		}
+		p += res;
+		len -= res;
+	}
+	return 0;
+}
+
+/*! \brief Send one unmasked frame, servers never mask */
+static int ws_send(mock_conn_t *conn, int opcode, const void *data, size_t len)
+{
+	uint8_t header[10];
+	size_t header_len = 2;
+	int i;
+
+	header[0] = 0x80 | opcode;
+	if (len < 126) {
+		header[1] = len;
+	} else if (len < 65536) {
+		header[1] = 126;
+		header[2] = len >> 8;
+		header[3] = len;
+		header_len = 4;
+	} else {
+		header[1] = 127;
+		for (i = 0; i < 8; i++) {
+			header[2 + i] = (uint64_t) len >> (56 - 8 * i);
+		}
+		header_len = 10;
+	}
+	if (send_all(conn->fd, header, header_len)) {
+		return -1;
+	}
+	return len ? send_all(conn->fd, data, len) : 0;
+}
+
+/*!
+ * \brief Receive the next data message, answering control frames on the way
+ *
+ * \retval 1 message in conn->msg
+ * \retval 0 the client closed the connection
+ * \retval -1 error
+ */
+static int ws_recv(mock_conn_t *conn)
+{
+	uint8_t header[14], mask[4], control[125];
+	uint64_t len;
+	uint8_t *payload;
+	int opcode, fin, masked, i;
+
+	conn->msg_len = 0;
+	for (;;) {
+		if (recv_all(conn->fd, header, 2)) {
+			return -1;
+		}
+		fin = header[0] & 0x80;
+		opcode = header[0] & 0x0f;
+		masked = header[1] & 0x80;
+		len = header[1] & 0x7f;
+		if (len == 126) {
+			if (recv_all(conn->fd, header, 2)) {
+				return -1;
+			}
+			len = header[0] << 8 | header[1];
+		} else if (len == 127) {
+			if (recv_all(conn->fd, header, 8)) {
+				return -1;
+			}
+			for (len = 0, i = 0; i < 8; i++) {
+				len = len << 8 | header[i];
+			}
+		}
+		/* Clients always mask */
+		if (!masked) {
+			mock_log(conn, "unmasked frame");
+			return -1;
+		}
+		if (recv_all(conn->fd, mask, 4)) {
+			return -1;
+		}
+
+		if (opcode >= WS_OP_CLOSE) {
+			if (len > sizeof(control) || recv_all(conn->fd, control, len)) {
+				return -1;
+			}
+			for (i = 0; i < (int) len; i++) {
+				control[i] ^= mask[i % 4];
+			}
+			if (opcode == WS_OP_CLOSE) {
+				ws_send(conn, WS_OP_CLOSE, control, len >= 2 ? 2 : 0);
+				return 0;
+			}
+			if (opcode == WS_OP_PING) {
+				ws_send(conn, WS_OP_PONG, control, len);
+			}
+			continue;
+		}
+
+		if (len > MOCK_MAX_MESSAGE - conn->msg_len) {
+			mock_log(conn, "message too large");
+			return -1;
+		}
+		if (opcode != WS_OP_CONTINUATION) {
+			conn->msg_opcode = opcode;
+		}
+		payload = conn->msg + conn->msg_len;
+		if (recv_all(conn->fd, payload, len)) {
+			return -1;
+		}
+		for (i = 0; i < (int) len; i++) {
+			payload[i] ^= mask[i % 4];
+		}
+		conn->msg_len += len;
+		if (fin) {
+			return 1;
+		}
+	}
+}
+
+/* Value of a request header, NULL if missing; the request is modified */
+static char *http_header(char *request, const char *name)
+{
+	size_t name_len = strlen(name);
+	char *line, *end;
+
+	for (line = strstr(request, "\r\n"); line; line = strstr(line, "\r\n")) {
+		line += 2;
+		if (!strncasecmp(line, name, name_len) && line[name_len] == ':') {
+			line += name_len + 1;
+			line += strspn(line, " \t");
+			end = strstr(line, "\r\n");
+			if (end) {
+				*end = '\0';
+			}
+			return line;
+		}
+	}
+	return NULL;
+}
+
+/*! \brief Answer the upgrade request */
+static int ws_handshake(mock_conn_t *conn)
+{
+	static const char *guid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+	char request[8192], reply[512], key_guid[160], accept[32], protocol[64] = "";
+	char *key, *protocols;
+	uint8_t digest[20];
+	size_t len = 0;
+	ssize_t res;
+
+	request[0] = '\0';
+	while (!strstr(request, "\r\n\r\n")) {
+		if (len == sizeof(request) - 1) {
+			return -1;
+		}
+		res = recv(conn->fd, request + len, sizeof(request) - 1 - len, 0);
+		if (res <= 0) {
+			return -1;
+		}
+		len += res;
+		request[len] = '\0';
+	}
+
+	/* The first protocol the client asks for is taken, the client checks it */
+	protocols = http_header(request, "Sec-WebSocket-Protocol");
+	if (protocols) {
+		snprintf(protocol, sizeof(protocol), "%.*s", (int) strcspn(protocols, ", \t"), protocols);
+	}
+	key = http_header(request, "Sec-WebSocket-Key");
+	if (!key || snprintf(key_guid, sizeof(key_guid), "%s%s", key, guid) >= (int) sizeof(key_guid)
+		|| sha1((uint8_t *) key_guid, strlen(key_guid), digest)) {
+		send_all(conn->fd, "HTTP/1.1 400 Bad Request\r\n\r\n", 28);
+		return -1;
+	}
+	base64_encode(accept, digest, sizeof(digest));
+
+	len = snprintf(reply, sizeof(reply),
+		"HTTP/1.1 101 Switching Protocols\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Accept: %s\r\n"
+		"%s%s%s"
+		"\r\n",
+		accept, *protocol ? "Sec-WebSocket-Protocol: " : "", protocol, *protocol ? "\r\n" : "");
+	return send_all(conn->fd, reply, len);
+}
+
+/* Append s to buf as the inside of a JSON string */
+static size_t json_string(char *buf, size_t size, size_t pos, const char *s)
+{
+	for (; *s && pos + 7 < size; s++) {
+		if (*s == '"' || *s == '\\') {
+			buf[pos++] = '\\';
+			buf[pos++] = *s;
+		} else if ((unsigned char) *s < 0x20) {
+			pos += snprintf(buf + pos, size - pos, "\\u%04x", *s);
+		} else {
+			buf[pos++] = *s;
+		}
+	}
+	buf[pos] = '\0';
+	return pos;
+}
+
+/* Length of the first words of s */
+static size_t words_prefix(const char *s, int words)
+{
+	const char *p = s + strspn(s, " ");
+
+	while (*p && words > 0) {
+		p += strcspn(p, " ");
+		if (--words) {
+			p += strspn(p, " ");
+		}
+	}
+	return p - s;
+}
+
+static int word_count(const char *s)
+{
+	int words = 0;
+
+	for (s += strspn(s, " "); *s; s += strspn(s, " ")) {
+		words++;
+		s += strcspn(s, " ");
+	}
+	return words;
+}
+
+/*!
+ * \brief Send a result after the configured delay
+ *
+ * A final result takes the whole transcript of the utterance and ends it,
+ * a partial the given number of its words.
+ */
+static int mock_reply(mock_conn_t *conn, int final, int words)
+{
+	char buf[4096], text[2048];
+	const char *transcript = conn->text ? conn->text : "";
+	size_t len;
+
+	if (config.delay || config.jitter) {
+		sleep_ms(config.delay + mock_rand(conn, config.jitter + 1));
+	}
+
+	len = final ? strlen(transcript) : words_prefix(transcript, words);
+	snprintf(text, sizeof(text), "%.*s", (int) len, transcript);
+	/* Spaced out like vosk-server prints it */
+	len = snprintf(buf, sizeof(buf), "{\n  \"%s\" : \"", final ? "text" : "partial");
+	len = json_string(buf, sizeof(buf) - 4, len, text);
+	len += snprintf(buf + len, sizeof(buf) - len, "\"\n}");
+
+	if (final) {
+		mock_log(conn, "final '%s'", text);
+		conn->text = NULL;
+	}
+	return ws_send(conn, WS_OP_TEXT, buf, len);
+}
+
+/* Pick the transcript of a new utterance and whether the connection dies in it */
+static void mock_utterance_begin(mock_conn_t *conn)
+{
+	unsigned int n = __atomic_fetch_add(&next_utterance, 1, __ATOMIC_RELAXED);
+
+	conn->text = config.script[n % config.script_len];
+	conn->audio_ms = conn->voice_ms = conn->silence_ms = 0;
+	conn->drop_ms = -1;
+	if (config.drop_pct && mock_rand(conn, 100) < config.drop_pct) {
+		conn->drop_ms = mock_rand(conn, config.utterance ? config.utterance : 2000);
+	}
+	__atomic_fetch_add(&stats.utterances, 1, __ATOMIC_RELAXED);
+}
+
+/*!
+ * \brief Take a chunk of audio and answer it
+ *
+ * \retval -1 the connection is to be dropped
+ */
+static int mock_audio(mock_conn_t *conn)
+{
+	const int16_t *pcm = (const int16_t *) conn->msg;
+	size_t samples = conn->msg_len / sizeof(int16_t), i;
+	uint64_t level = 0;
+	int ms, words;
+
+	if (!conn->text) {
+		mock_utterance_begin(conn);
+	}
+
+	for (i = 0; i < samples; i++) {
+		level += abs(pcm[i]);
+	}
+	ms = samples * 1000 / conn->sample_rate;
+	conn->audio_ms += ms;
+	if (samples && level / samples >= MOCK_VOICE_LEVEL) {
+		conn->voice_ms += ms;
+		conn->silence_ms = 0;
+	} else {
+		conn->silence_ms += ms;
+	}
+
+	if (conn->drop_ms >= 0 && conn->audio_ms >= conn->drop_ms) {
+		mock_log(conn, "dropping connection after %d ms of audio", conn->audio_ms);
+		__atomic_fetch_add(&stats.drops, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+
+	if (config.utterance ? conn->audio_ms >= config.utterance
+		: conn->voice_ms && conn->silence_ms >= config.endpoint) {
+		return mock_reply(conn, 1, 0);
+	}
+
+	if (config.utterance) {
+		words = (int64_t) word_count(conn->text) * conn->audio_ms / config.utterance;
+	} else {
+		words = conn->voice_ms / config.word;
+	}
+	return mock_reply(conn, 0, words);
+}
+
+/*!
+ * \brief Take a control message
+ *
+ * \retval 1 the client ended the stream
+ */
+static int mock_command(mock_conn_t *conn)
+{
+	char *msg = (char *) conn->msg, *rate;
+	int eof;
+
+	conn->msg[conn->msg_len] = '\0';
+	mock_log(conn, "command %s", msg);
+	eof = strstr(msg, "\"eof\"") != NULL;
+	if (eof || strstr(msg, "\"reset\"")) {
+		/* Nothing was said if no speech was heard */
+		if (conn->text && !conn->voice_ms && !config.utterance) {
+			conn->text = "";
+		}
+		if (mock_reply(conn, 1, 0)) {
+			return -1;
+		}
+		/* After eof vosk-server hangs up */
+		return eof;
+	}
+	if ((rate = strstr(msg, "\"sample_rate\""))) {
+		rate += strlen("\"sample_rate\"");
+		rate += strspn(rate, " \t\r\n:");
+		if (atoi(rate) >= 8000) {
+			conn->sample_rate = atoi(rate);
+		}
+	}
+	return 0;
+}
+
+static void *mock_conn_thread(void *data)
+{
+	mock_conn_t *conn = data;
+	int res;
+
+	if (ws_handshake(conn)) {
+		mock_log(conn, "handshake failed");
+		goto done;
+	}
+	mock_log(conn, "connected");
+
+	while (ws_recv(conn) > 0) {
+		__atomic_fetch_add(&stats.messages, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&stats.bytes, conn->msg_len, __ATOMIC_RELAXED);
+
+		/* A stalled server neither reads nor answers, the client's writes back up */
+		if (config.stall_pct && mock_rand(conn, 100) < config.stall_pct) {
+			mock_log(conn, "stalling for %d ms", config.stall);
+			__atomic_fetch_add(&stats.stalls, 1, __ATOMIC_RELAXED);
+			sleep_ms(config.stall);
+		}
+		/* The pong has to come between the client's frames, never inside one */
+		if (config.ping_pct && mock_rand(conn, 100) < config.ping_pct) {
+			__atomic_fetch_add(&stats.pings, 1, __ATOMIC_RELAXED);
+			if (ws_send(conn, WS_OP_PING, "mock", 4)) {
+				break;
+			}
+		}
+
+		if (conn->msg_opcode == WS_OP_BINARY) {
+			res = mock_audio(conn);
+		} else {
+			res = mock_command(conn);
+			if (res == 1) {
+				ws_send(conn, WS_OP_CLOSE, "\x03\xe8", 2);
+			}
+		}
+		if (res) {
+			break;
+		}
+	}
+	mock_log(conn, "disconnected");
+
+done:
+	close(conn->fd);
+	free(conn->msg);
+	free(conn);
+	__atomic_fetch_sub(&stats.active, 1, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+static int mock_listen(const char *address)
+{
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE };
+	struct addrinfo *addrs, *ai;
+	char *host = strdup(address), *port = strrchr(host, ':');
+	int fd = -1, on = 1, res;
+
+	if (port) {
+		*port++ = '\0';
+	} else {
+		port = host;
+	}
+	res = getaddrinfo(port != host && *host ? host : NULL, port, &hints, &addrs);
+	if (res) {
+		fprintf(stderr, "%s: %s\n", address, gai_strerror(res));
+		free(host);
+		return -1;
+	}
+	for (ai = addrs; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (!bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, 1024)) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0) {
+		fprintf(stderr, "Cannot listen on %s: %s\n", address, strerror(errno));
+	}
+	freeaddrinfo(addrs);
+	free(host);
+	return fd;
+}
+
+static int script_add(const char *text)
+{
+	char **script = realloc(config.script, (config.script_len + 1) * sizeof(*script));
+
+	if (!script) {
+		return -1;
+	}
+	config.script = script;
+	if (!(script[config.script_len] = strdup(text))) {
+		return -1;
+	}
+	config.script_len++;
+	return 0;
+}
+
+/* One transcript per line, empty lines and lines starting with # are skipped */
+static int script_load(const char *path)
+{
+	char line[2048];
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (*line && *line != '#' && script_add(line)) {
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+static void mock_stop(int sig)
+{
+	stopping = 1;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"\n"
+		"Answers vosk-server protocol clients with scripted results.\n"
+		"\n"
+		"  -l [host:]port  listen address (default 2700)\n"
+		"  -t <text>       transcript, may be repeated\n"
+		"  -T <file>       transcripts, one per line\n"
+		"                  utterances take the transcripts in turn (default \"hello world\")\n"
+		"  -u <ms>         end every utterance after this much audio\n"
+		"                  (default: on silence after speech)\n"
+		"  -e <ms>         silence after speech that ends an utterance (default 600)\n"
+		"  -W <ms>         audio per word revealed in the partials (default 250)\n"
+		"  -d <ms>         delay of every reply\n"
+		"  -j <ms>         random extra delay of every reply, up to this much\n"
+		"  -s <pct>:<ms>   stall the connection for ms on pct %% of the messages\n"
+		"  -x <pct>        drop the connection in the middle of pct %% of the utterances\n"
+		"  -P <pct>        ping the client on pct %% of the messages\n"
+		"  -S <seed>       seed of the random choices (default 1)\n"
+		"  -v              log connections and messages\n",
+		argv0);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *address = "2700";
+	struct sigaction sa = { .sa_handler = mock_stop };
+	pthread_attr_t attr;
+	pthread_t thread;
+	unsigned int id = 0;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "l:t:T:u:e:W:d:j:s:x:P:S:vh")) != -1) {
+		switch (opt) {
+		case 'l':
+			address = optarg;
+			break;
+		case 't':
+			if (script_add(optarg)) {
+				return 1;
+			}
+			break;
+		case 'T':
+			if (script_load(optarg)) {
+				return 1;
+			}
+			break;
+		case 'u':
+			config.utterance = atoi(optarg);
+			break;
+		case 'e':
+			config.endpoint = atoi(optarg);
+			break;
+		case 'W':
+			config.word = atoi(optarg);
+			break;
+		case 'd':
+			config.delay = atoi(optarg);
+			break;
+		case 'j':
+			config.jitter = atoi(optarg);
+			break;
+		case 's':
+			if (sscanf(optarg, "%d:%d", &config.stall_pct, &config.stall) != 2) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'x':
+			config.drop_pct = atoi(optarg);
+			break;
+		case 'P':
+			config.ping_pct = atoi(optarg);
+			break;
+		case 'S':
+			config.seed = strtoul(optarg, NULL, 10);
+			break;
+		case 'v':
+			config.verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc || config.utterance < 0 || config.endpoint < 1 || config.word < 1
+		|| config.delay < 0 || config.jitter < 0 || config.stall_pct < 0 || config.stall < 0
+		|| config.drop_pct < 0 || config.ping_pct < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (!config.script_len && script_add("hello world")) {
+		return 1;
+	}
+
+	fd = mock_listen(address);
+	if (fd < 0) {
+		return 1;
+	}
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setstacksize(&attr, MOCK_STACK_SIZE);
+	fprintf(stderr, "Listening on %s with %d transcripts\n", address, config.script_len);
+
+	while (!stopping) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		mock_conn_t *conn;
+		int client, on = 1;
+
+		if (poll(&pfd, 1, 200) <= 0) {
+			continue;
+		}
+		client = accept(fd, NULL, NULL);
+		if (client < 0) {
+			continue;
+		}
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		conn = calloc(1, sizeof(*conn));
+		if (!conn || !(conn->msg = malloc(MOCK_MAX_MESSAGE + 1))) {
+			free(conn);
+			close(client);
+			continue;
+		}
+		conn->fd = client;
+		conn->id = ++id;
+		/* Each connection draws from its own sequence, the same on every run */
+		conn->rand = config.seed * 2654435761u + id;
+		conn->sample_rate = MOCK_SAMPLE_RATE;
+		__atomic_fetch_add(&stats.connections, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&stats.active, 1, __ATOMIC_RELAXED);
+		if (pthread_create(&thread, &attr, mock_conn_thread, conn)) {
+			__atomic_fetch_sub(&stats.active, 1, __ATOMIC_RELAXED);
+			close(client);
+			free(conn->msg);
+			free(conn);
+		}
+	}
+
+	close(fd);
+	fprintf(stderr, "%u connections (%u open), %" PRIu64 " messages, %" PRIu64 " bytes, "
+		"%u utterances, %u stalls, %u drops, %u pings\n",
+		stats.connections, stats.active, stats.messages, stats.bytes,
+		stats.utterances, stats.stalls, stats.drops, stats.pings);
+	return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Checks of the result message scanner
+ *
+ * Feeds vosk_result_scan the messages whose decoding is easy to get
+ * wrong and compares the text it pulls out. Exits non-zero when any
+ * case fails, so "make check" can run it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "vosk_result.h"
+
+/*! \brief Message and the text expected from it, NULL when the scan must fail */
+typedef struct check_case_t {
+	const char		*msg;
+	const char		*text;
+} check_case_t;
+
+static const check_case_t check_cases[] = {
+	{ "{\"text\" : \"hello world\"}", "hello world" },
+	{ "{\"text\" : \"a\\\"b\\\\c\\/d\"}", "a\"b\\c/d" },
+	{ "{\"text\" : \"\\u00e9t\\u00e9\"}", "\xc3\xa9t\xc3\xa9" },
+	/* Surrogate pair */
+	{ "{\"text\" : \"\\ud83d\\ude00\"}", "\xf0\x9f\x98\x80" },
+	/* High surrogate followed by a plain character */
+	{ "{\"text\" : \"\\ud83dx\"}", "\xef\xbf\xbdx" },
+	/* High surrogate followed by an escape that is no low surrogate */
+	{ "{\"text\" : \"\\ud83d\\u0041\"}", "\xef\xbf\xbd" "A" },
+	/* Two high surrogates, the second one pairs */
+	{ "{\"text\" : \"\\ud83d\\ud83d\\ude00\"}", "\xef\xbf\xbd\xf0\x9f\x98\x80" },
+	/* High surrogate at the end of the string */
+	{ "{\"text\" : \"x\\ud83d\"}", "x\xef\xbf\xbd" },
+	/* Low surrogate on its own */
+	{ "{\"text\" : \"\\ude00y\"}", "\xef\xbf\xbdy" },
+	/* Broken escapes */
+	{ "{\"text\" : \"\\ud83d\\uzzzz\"}", NULL },
+	{ "{\"text\" : \"\\u12\"}", NULL },
+};
+
+int main(void)
+{
+	vosk_result_t result;
+	const check_case_t *c;
+	size_t i;
+	int res, failed = 0;
+
+	for (i = 0; i < sizeof(check_cases) / sizeof(check_cases[0]); i++) {
+		c = &check_cases[i];
+		res = vosk_result_scan(&result, c->msg, strlen(c->msg));
+		if (!c->text) {
+			if (!res && result.kind == VOSK_RESULT_TEXT) {
+				printf("FAIL %s: scanned '%s', expected an error\n", c->msg, result.text);
+				failed++;
+			}
+			continue;
+		}
+		if (res || result.kind != VOSK_RESULT_TEXT || strcmp(result.text, c->text)
+			|| result.text_len != strlen(c->text)) {
+			printf("FAIL %s: %s '%s'\n", c->msg, res ? "error" : "scanned", res ? "" : result.text);
+			failed++;
+		}
+	}
+	printf("%zu cases, %d failed\n", i, failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,553 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Websocket client of the benchmark harness
+ *
+ * Plain ws:// client with the semantics of res_http_websocket that the
+ * module depends on: buffered input, so wait_for_input also reports data
+ * already read; optional reassembly of fragmented messages; client
+ * frames masked into a copy of the payload; and sessions that are ao2
+ * objects whose lock serializes writers, as Asterisk does. The server's
+ * accept key is not verified.
+ */
+
+#include "asterisk.h"
+
+#include <netdb.h>
+#include <poll.h>
+#include <netinet/in.h>
+
+#include "shim.h"
+
+/* Largest frame accepted from the server */
+#define WS_MAX_FRAME 65535
+/* Longest wait for the rest of a frame that started to arrive (ms) */
+#define WS_READ_TIMEOUT 1000
+/* Input read from the socket at once */
+#define WS_BUFFER_SIZE 16384
+
+struct ast_websocket {
+	int			fd;
+	/* Set once a close frame was sent or received */
+	int			closing;
+	/* Serializes input of concurrent readers, the object lock serializes writers */
+	ast_mutex_t		read_lock;
+	/* Buffered input */
+	char			buf[WS_BUFFER_SIZE];
+	size_t			buf_pos;
+	size_t			buf_len;
+	/* Payload of the current message, reassembled up to reconstruct bytes */
+	char			*payload;
+	size_t			payload_size;
+	size_t			payload_len;
+	size_t			reconstruct;
+	enum ast_websocket_opcode opcode;
+	/* Frame being written, header followed by the masked payload */
+	char			*frame;
+	size_t			frame_size;
+};
+
+static int ws_count;
+
+int bench_websocket_count(void)
+{
+	return __atomic_load_n(&ws_count, __ATOMIC_RELAXED);
+}
+
+static void ws_destroy(void *obj)
+{
+	struct ast_websocket *ws = obj;
+
+	if (ws->fd >= 0) {
+		close(ws->fd);
+	}
+	ast_mutex_destroy(&ws->read_lock);
+	ast_free(ws->payload);
+	ast_free(ws->frame);
+	__atomic_fetch_sub(&ws_count, 1, __ATOMIC_RELAXED);
+}
+
+void ast_websocket_ref(struct ast_websocket *session)
+{
+	ao2_ref(session, +1);
+}
+
+void ast_websocket_unref(struct ast_websocket *session)
+{
+	if (session) {
+		ao2_ref(session, -1);
+	}
+}
+
+int ast_websocket_is_secure(struct ast_websocket *session)
+{
+	return 0;
+}
+
+int ast_websocket_fd(struct ast_websocket *session)
+{
+	return __atomic_load_n(&session->closing, __ATOMIC_ACQUIRE) ? -1 : session->fd;
+}
+
+void ast_websocket_reconstruct_enable(struct ast_websocket *session, size_t bytes)
+{
+	session->reconstruct = MIN(bytes, WS_MAX_FRAME);
+}
+
+/* Send all of buf, the socket is blocking */
+static int ws_send_all(int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int ast_websocket_write(struct ast_websocket *session, enum ast_websocket_opcode opcode, char *payload, uint64_t payload_size)
+{
+	size_t header_size = 2 + 4;
+	uint32_t key = ast_random();
+	uint8_t *mask = (uint8_t *) &key;
+	uint8_t *frame;
+	uint64_t i;
+	int res;
+
+	if (payload_size >= 65536) {
+		header_size += 8;
+	} else if (payload_size >= 126) {
+		header_size += 2;
+	}
+
+	ao2_lock(session);
+	if (header_size + payload_size > session->frame_size) {
+		char *buf = ast_realloc(session->frame, header_size + payload_size);
+		if (!buf) {
+			ao2_unlock(session);
+			return -1;
+		}
+		session->frame = buf;
+		session->frame_size = header_size + payload_size;
+	}
+	frame = (uint8_t *) session->frame;
+	frame[0] = opcode | 0x80;
+	if (payload_size >= 65536) {
+		frame[1] = 127;
+		for (i = 0; i < 8; i++) {
+			frame[2 + i] = payload_size >> (56 - 8 * i);
+		}
+	} else if (payload_size >= 126) {
+		frame[1] = 126;
+		frame[2] = payload_size >> 8;
+		frame[3] = payload_size;
+	} else {
+		frame[1] = payload_size;
+	}
+	/* Clients mask every frame */
+	frame[1] |= 0x80;
+	memcpy(frame + header_size - 4, mask, 4);
+	for (i = 0; i < payload_size; i++) {
+		frame[header_size + i] = payload[i] ^ mask[i % 4];
+	}
+	res = ws_send_all(session->fd, session->frame, header_size + payload_size);
+	ao2_unlock(session);
+
+	return res;
+}
+
+int ast_websocket_write_string(struct ast_websocket *ws, const char *buf)
+{
+	return ast_websocket_write(ws, AST_WEBSOCKET_OPCODE_TEXT, (char *) buf, strlen(buf));
+}
+
+int ast_websocket_close(struct ast_websocket *session, uint16_t reason)
+{
+	char frame[2] = { reason >> 8, reason & 0xff };
+
+	if (__atomic_exchange_n(&session->closing, 1, __ATOMIC_ACQ_REL)) {
+		return 0;
+	}
+	return ast_websocket_write(session, AST_WEBSOCKET_OPCODE_CLOSE, frame, sizeof(frame));
+}
+
+int ast_websocket_wait_for_input(struct ast_websocket *session, int timeout)
+{
+	if (session->buf_len > session->buf_pos) {
+		return 1;
+	}
+	return ast_wait_for_input(session->fd, timeout);
+}
+
+/* Make at least len bytes of input available at buf_pos */
+static int ws_fill(struct ast_websocket *ws, size_t len)
+{
+	while (ws->buf_len - ws->buf_pos < len) {
+		ssize_t n;
+
+		if (ws->buf_pos) {
+			memmove(ws->buf, ws->buf + ws->buf_pos, ws->buf_len - ws->buf_pos);
+			ws->buf_len -= ws->buf_pos;
+			ws->buf_pos = 0;
+		}
+		if (ast_wait_for_input(ws->fd, WS_READ_TIMEOUT) <= 0) {
+			return -1;
+		}
+		n = recv(ws->fd, ws->buf + ws->buf_len, sizeof(ws->buf) - ws->buf_len, 0);
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		ws->buf_len += n;
+	}
+	return 0;
+}
+
+/* Copy len bytes of input to out, which may be NULL to skip them */
+static int ws_take(struct ast_websocket *ws, char *out, size_t len)
+{
+	while (len) {
+		size_t n = MIN(len, sizeof(ws->buf));
+
+		if (ws_fill(ws, n)) {
+			return -1;
+		}
+		if (out) {
+			memcpy(out, ws->buf + ws->buf_pos, n);
+			out += n;
+		}
+		ws->buf_pos += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int ast_websocket_read(struct ast_websocket *session, char **payload, uint64_t *payload_len,
+	enum ast_websocket_opcode *opcode, int *fragmented)
+{
+	uint8_t header[14];
+	size_t header_size = 2;
+	uint64_t frame_len;
+	uint8_t *mask = NULL;
+	int fin, i;
+	char *data;
+
+	*payload = NULL;
+	*payload_len = 0;
+	*fragmented = 0;
+
+	ast_mutex_lock(&session->read_lock);
+	if (ws_fill(session, 2)) {
+		goto error;
+	}
+	memcpy(header, session->buf + session->buf_pos, 2);
+	fin = header[0] & 0x80;
+	*opcode = header[0] & 0x0f;
+	frame_len = header[1] & 0x7f;
+	header_size += frame_len == 126 ? 2 : frame_len == 127 ? 8 : 0;
+	header_size += header[1] & 0x80 ? 4 : 0;
+	if (ws_take(session, (char *) header, header_size)) {
+		goto error;
+	}
+	if (frame_len == 126) {
+		frame_len = (header[2] << 8) | header[3];
+	} else if (frame_len == 127) {
+		for (frame_len = 0, i = 0; i < 8; i++) {
+			frame_len = (frame_len << 8) | header[2 + i];
+		}
+	}
+	if (header[1] & 0x80) {
+		mask = header + header_size - 4;
+	}
+	if (frame_len > WS_MAX_FRAME) {
+		ast_log(LOG_WARNING, "Cannot fit huge websocket frame of %" PRIu64 " bytes\n", frame_len);
+		goto error;
+	}
+
+	/* Continuations append to the message being reassembled */
+	if (*opcode != AST_WEBSOCKET_OPCODE_CONTINUATION) {
+		session->payload_len = 0;
+	}
+	if (session->payload_len + frame_len + 1 > session->payload_size) {
+		char *buf = ast_realloc(session->payload, session->payload_len + frame_len + 1);
+		if (!buf) {
+			goto error;
+		}
+		session->payload = buf;
+		session->payload_size = session->payload_len + frame_len + 1;
+	}
+	data = session->payload + session->payload_len;
+	if (ws_take(session, data, frame_len)) {
+		goto error;
+	}
+	if (mask) {
+		for (i = 0; (uint64_t) i < frame_len; i++) {
+			data[i] ^= mask[i % 4];
+		}
+	}
+	session->payload_len += frame_len;
+	session->payload[session->payload_len] = '\0';
+
+	switch (*opcode) {
+	case AST_WEBSOCKET_OPCODE_PING:
+		ast_mutex_unlock(&session->read_lock);
+		ast_websocket_write(session, AST_WEBSOCKET_OPCODE_PONG, session->payload, session->payload_len);
+		*payload = session->payload;
+		*payload_len = session->payload_len;
+		return 0;
+	case AST_WEBSOCKET_OPCODE_CLOSE:
+		ast_mutex_unlock(&session->read_lock);
+		ast_websocket_close(session, 1000);
+		*payload = session->payload;
+		*payload_len = session->payload_len;
+		return 0;
+	case AST_WEBSOCKET_OPCODE_TEXT:
+	case AST_WEBSOCKET_OPCODE_BINARY:
+	case AST_WEBSOCKET_OPCODE_CONTINUATION:
+		break;
+	default:
+		ast_log(LOG_WARNING, "Unknown websocket opcode %d\n", *opcode);
+		goto error;
+	}
+
+	if (!fin && session->reconstruct && session->payload_len < session->reconstruct) {
+		/* Not final yet, hand out the whole message once it is complete */
+		if (*opcode != AST_WEBSOCKET_OPCODE_CONTINUATION) {
+			session->opcode = *opcode;
+		}
+		*opcode = AST_WEBSOCKET_OPCODE_CONTINUATION;
+	} else {
+		if (*opcode == AST_WEBSOCKET_OPCODE_CONTINUATION) {
+			if (!fin) {
+				*fragmented = 1;
+			} else {
+				*opcode = session->opcode;
+			}
+		} else if (!fin) {
+			session->opcode = *opcode;
+			*fragmented = 1;
+		}
+		*payload = session->payload;
+		*payload_len = session->payload_len;
+		session->payload_len = 0;
+	}
+	ast_mutex_unlock(&session->read_lock);
+	return 0;
+
+error:
+	ast_mutex_unlock(&session->read_lock);
+	return -1;
+}
+
+static void base64_encode(char *dst, const uint8_t *src, size_t len)
+{
+	static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t i;
+
+	for (i = 0; i + 2 < len; i += 3) {
+		*dst++ = b64[src[i] >> 2];
+		*dst++ = b64[((src[i] & 0x03) << 4) | (src[i + 1] >> 4)];
+		*dst++ = b64[((src[i + 1] & 0x0f) << 2) | (src[i + 2] >> 6)];
+		*dst++ = b64[src[i + 2] & 0x3f];
+	}
+	if (i < len) {
+		*dst++ = b64[src[i] >> 2];
+		if (i + 1 < len) {
+			*dst++ = b64[((src[i] & 0x03) << 4) | (src[i + 1] >> 4)];
+			*dst++ = b64[(src[i + 1] & 0x0f) << 2];
+		} else {
+			*dst++ = b64[(src[i] & 0x03) << 4];
+			*dst++ = '=';
+		}
+		*dst++ = '=';
+	}
+	*dst = '\0';
+}
+
+/* Split ws://host[:port][/path] */
+static int ws_parse_uri(const char *uri, char **host, char **port, char **path)
+{
+	char *parse, *slash, *colon;
+
+	if (strncasecmp(uri, "ws://", 5)) {
+		return -1;
+	}
+	parse = ast_strdupa(uri + 5);
+	slash = strchr(parse, '/');
+	*path = ast_strdup(slash ? slash : "/");
+	if (slash) {
+		*slash = '\0';
+	}
+	colon = strrchr(parse, ':');
+	if (colon && !strchr(colon, ']')) {
+		*colon++ = '\0';
+	}
+	*port = ast_strdup(colon && *colon ? colon : "80");
+	if (*parse == '[') {
+		parse++;
+		parse[strcspn(parse, "]")] = '\0';
+	}
+	*host = ast_strdup(parse);
+	return ast_strlen_zero(*host) ? -1 : 0;
+}
+
+static int ws_tcp_connect(const char *host, const char *port, int timeout)
+{
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+	struct addrinfo *res, *ai;
+	struct timeval tv = { .tv_sec = timeout / 1000, .tv_usec = timeout % 1000 * 1000 };
+	int fd = -1;
+
+	if (getaddrinfo(host, port, &hints, &res)) {
+		return -2;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+		/* Bounds the connect and, until cleared, the handshake */
+		if (timeout > 0) {
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		}
+		if (!connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+/* Send the upgrade request and read the response header */
+static enum ast_websocket_result ws_handshake(struct ast_websocket *ws, const char *host, const char *port,
+	const char *path, const char *protocols)
+{
+	char request[1024];
+	char key[32];
+	uint8_t nonce[16];
+	char *end;
+	int len, i;
+
+	for (i = 0; i < (int) sizeof(nonce); i++) {
+		nonce[i] = ast_random();
+	}
+	base64_encode(key, nonce, sizeof(nonce));
+	len = snprintf(request, sizeof(request),
+		"GET %s HTTP/1.1\r\n"
+		"Host: %s:%s\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Key: %s\r\n"
+		"Sec-WebSocket-Version: 13\r\n"
+		"%s%s%s"
+		"\r\n",
+		path, host, port, key,
+		protocols ? "Sec-WebSocket-Protocol: " : "", protocols ? protocols : "", protocols ? "\r\n" : "");
+	if (len >= (int) sizeof(request) || ws_send_all(ws->fd, request, len)) {
+		return WS_WRITE_ERROR;
+	}
+
+	/* The response header goes through the input buffer, what follows it stays there */
+	for (;;) {
+		ws->buf[ws->buf_len] = '\0';
+		if ((end = strstr(ws->buf, "\r\n\r\n"))) {
+			break;
+		}
+		if (ws->buf_len + 1 >= sizeof(ws->buf) || ws_fill(ws, ws->buf_len + 1)) {
+			return WS_INVALID_RESPONSE;
+		}
+	}
+	if (strncmp(ws->buf, "HTTP/1.1 101", 12)) {
+		ast_log(LOG_WARNING, "Websocket upgrade refused: %.*s\n", (int) strcspn(ws->buf, "\r\n"), ws->buf);
+		return WS_BAD_STATUS;
+	}
+	ws->buf_pos = end + 4 - ws->buf;
+	return WS_OK;
+}
+
+struct ast_websocket *ast_websocket_client_create(const char *uri, const char *protocols,
+	struct ast_tls_config *tls_cfg, enum ast_websocket_result *result)
+{
+	struct ast_websocket_client_options options = {
+		.uri = uri,
+		.protocols = protocols,
+		.timeout = -1,
+		.tls_cfg = tls_cfg,
+	};
+
+	return ast_websocket_client_create_with_options(&options, result);
+}
+
+struct ast_websocket *ast_websocket_client_create_with_options(struct ast_websocket_client_options *options,
+	enum ast_websocket_result *result)
+{
+	static const struct timeval blocking = { 0, 0 };
+	struct ast_websocket *ws;
+	char *host = NULL, *port = NULL, *path = NULL;
+
+	if (ws_parse_uri(options->uri, &host, &port, &path)) {
+		ast_log(LOG_ERROR, "Unable to parse websocket uri %s, only ws:// is supported\n", options->uri);
+		*result = WS_URI_PARSE_ERROR;
+		goto failed;
+	}
+	ws = ao2_alloc(sizeof(*ws), ws_destroy);
+	if (!ws) {
+		*result = WS_ALLOCATE_ERROR;
+		goto failed;
+	}
+	ast_mutex_init(&ws->read_lock);
+	__atomic_fetch_add(&ws_count, 1, __ATOMIC_RELAXED);
+
+	ws->fd = ws_tcp_connect(host, port, options->timeout);
+	if (ws->fd < 0) {
+		*result = ws->fd == -2 ? WS_URI_RESOLVE_ERROR : WS_CLIENT_START_ERROR;
+		ws->fd = -1;
+		ao2_ref(ws, -1);
+		goto failed;
+	}
+	*result = ws_handshake(ws, host, port, path, options->protocols);
+	if (*result != WS_OK) {
+		ao2_ref(ws, -1);
+		goto failed;
+	}
+	if (options->timeout > 0) {
+		setsockopt(ws->fd, SOL_SOCKET, SO_SNDTIMEO, &blocking, sizeof(blocking));
+		setsockopt(ws->fd, SOL_SOCKET, SO_RCVTIMEO, &blocking, sizeof(blocking));
+	}
+
+	ast_free(host);
+	ast_free(port);
+	ast_free(path);
+	return ws;
+
+failed:
+	ast_free(host);
+	ast_free(port);
+	ast_free(path);
+	return NULL;
+}
@@ -37,292 +37,6136 @@
 #include <asterisk/format_cache.h>
 #include <asterisk/json.h>
 #include <asterisk/lock.h>
+#include <asterisk/astobj2.h>
+#include <asterisk/linkedlists.h>
+#include <asterisk/utils.h>
+#include <asterisk/vector.h>
+#include <asterisk/cli.h>
+#include <asterisk/pbx.h>
+#include <asterisk/datastore.h>
+#include <asterisk/manager.h>
 
 #include <asterisk/http_websocket.h>
 
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "vosk_dsp.h"
+#include "vosk_result.h"
+#include "vosk_hist.h"
+
+#ifdef HAVE_VOSK_API
+#include <vosk_api.h>
+#endif
+
+/*** DOCUMENTATION
+	<function name="VOSK_PREWARM" language="en_US">
+		<synopsis>
+			Open the Vosk connection of the next SpeechCreate ahead of time.
+		</synopsis>
+		<syntax>
+			<parameter name="engine">
+				<para>Engine the connection is for, the first one configured
+				when omitted.</para>
+			</parameter>
+		</syntax>
+		<description>
+			<para>Reserves a backend session of the engine for the channel and
+			opens and configures its connection in the background, e.g. while
+			a greeting plays. The next SpeechCreate of that engine on the
+			channel attaches to it instead of connecting. The reservation goes
+			through admission control without waiting in its queue. Returns
+			<literal>1</literal> when a connection is reserved and
+			<literal>0</literal> otherwise, with the reason in
+			<literal>VOSK_ADMISSION()</literal>; the reservation is released
+			when the channel hangs up unused.</para>
+			<example title="Prewarm during the greeting">
+			same => n,Set(WARM=${VOSK_PREWARM(vosk-en)})
+			same => n,Playback(welcome)
+			same => n,SpeechCreate(vosk-en)
+			</example>
+		</description>
+	</function>
+	<function name="VOSK_ADMISSION" language="en_US">
+		<synopsis>
+			Tell how admission of the last SpeechCreate went.
+		</synopsis>
+		<syntax />
+		<description>
+			<para>Returns <literal>ADMITTED</literal>, <literal>QUEUED</literal>
+			(admitted after waiting), <literal>REJECTED</literal>,
+			<literal>TIMEOUT</literal> or <literal>UNAVAILABLE</literal> for the
+			last Vosk SpeechCreate on the channel, and nothing when there was
+			none.</para>
+			<example title="Fall back to DTMF">
+			same => n,SpeechCreate(vosk)
+			same => n,GotoIf($["${VOSK_ADMISSION()}" = "ADMITTED" | "${VOSK_ADMISSION()}" = "QUEUED"]?speech:dtmf)
+			</example>
+		</description>
+	</function>
+	<manager name="VoskShowStats" language="en_US">
+		<synopsis>
+			Show Vosk recognition statistics.
+		</synopsis>
+		<syntax>
+			<xi:include xpointer="xpointer(/docs/manager[@name='Login']/syntax/parameter[@name='ActionID'])" />
+		</syntax>
+		<description>
+			<para>Sends one <literal>VoskStats</literal> event per backend of
+			every engine, or one per engine doing in-process recognition in
+			local modes, followed by <literal>VoskStatsComplete</literal>.
+			Latencies are in milliseconds.</para>
+		</description>
+	</manager>
+ ***/
+
+/* Engine of a configuration without engine sections */
 #define VOSK_ENGINE_NAME "vosk"
 #define VOSK_ENGINE_CONFIG "res_speech_vosk.conf"
-#define VOSK_BUF_SIZE 3200
+/* Audio sent per websocket message (ms) */
+#define VOSK_CHUNK_SIZE 100
+/* Longest time audio may wait for its chunk to fill up (ms) */
+#define VOSK_CHUNK_LATENCY 100
+/* Longest time audio waits for a decoding batch to fill up (ms) */
+#define VOSK_BATCH_DELAY 20
+/* Sessions decoded together in one batch */
+#define VOSK_BATCH_SIZE 64
+/* Bounds for chunk_size (ms) */
+#define VOSK_CHUNK_SIZE_MIN 10
+#define VOSK_CHUNK_SIZE_MAX 1000
+/* Largest message a sender builds: VOSK_CHUNK_SIZE_MAX of 16 kHz audio */
+#define VOSK_CHUNK_MAX_BYTES 32000
+/* Longest frame header of a client message, masking key included */
+#define VOSK_FRAME_HEADER_MAX 14
+
+/* Connection pool defaults (sizes in connections, timeout in milliseconds) */
+#define VOSK_POOL_MIN_SIZE 0
+#define VOSK_POOL_MAX_SIZE 8
+#define VOSK_POOL_IDLE_TIMEOUT 30000
+/* Delay before the pool retries a failed connect */
+#define VOSK_POOL_RETRY_INTERVAL 1000
+/* Period of the pool maintenance pass */
+#define VOSK_POOL_CHECK_INTERVAL 1000
+/* Longest connect to a server, handshake included (ms) */
+#define VOSK_CONNECT_TIMEOUT 3000
+/* Circuit breaker defaults: failures in a row that open it (0 disables), time
+ * before an open backend gets a trial session and slowest final result (ms, 0 disables) */
+#define VOSK_BREAKER_FAILURES 5
+#define VOSK_BREAKER_COOLDOWN 10000
+#define VOSK_BREAKER_LATENCY 0
+/* Period of the backend health probes (ms, 0 disables) */
+#define VOSK_HEALTH_INTERVAL 5000
+/* Result reader threads watching session sockets */
+#define VOSK_READER_THREADS 1
+/* Events fetched per epoll_wait */
+#define VOSK_READER_EVENTS 64
+/* Audio sender threads draining session rings */
+#define VOSK_SENDER_THREADS 1
+/* Audio queued per session before the overflow policy applies (ms) */
+#define VOSK_SEND_BUFFER 1000
+/* Retry interval for sessions whose socket is not writable (ms) */
+#define VOSK_SEND_RETRY_INTERVAL 5
+/* Audio of the current utterance kept for replay after a failover (ms, 0 disables) */
+#define VOSK_REPLAY_BUFFER 10000
+/* Failovers one session may go through */
+#define VOSK_FAILOVER_MAX 3
+/* Default hedge delays: no partial since speech onset, no final since end of speech (ms, 0 disables) */
+#define VOSK_HEDGE_DELAY 0
+#define VOSK_HEDGE_FINAL_DELAY 0
+/* Default share of the utterances of a backend that may be hedged (percent) */
+#define VOSK_HEDGE_BUDGET 5
+/* Default admission control: open sessions (0 is unlimited), sessions waiting and their longest wait (ms) */
+#define VOSK_MAX_SESSIONS 0
+#define VOSK_ADMISSION_QUEUE_SIZE 0
+#define VOSK_ADMISSION_WAIT 2000
+/* Admission outcomes kept for VOSK_ADMISSION() until the channel reads them, a power of two */
+#define VOSK_ADMISSION_NOTES 4096
+/* Marks the epoll data of a hedge connection, session objects are pointer aligned */
+#define VOSK_HEDGE_TAG ((uintptr_t) 1)
+/* Default sample rate of the audio fed to the recognizer */
+#define VOSK_SAMPLE_RATE 8000
+/* Voice activity gate defaults: RMS level (0 disables), pre-roll and hangover (ms) */
+#define VOSK_VAD_THRESHOLD 0
+#define VOSK_VAD_PREROLL 300
+#define VOSK_VAD_HANGOVER 800
+/* Endpointing defaults: trailing silence (ms, 0 disables) and RMS level of speech */
+#define VOSK_ENDPOINT_SILENCE 0
+#define VOSK_ENDPOINT_THRESHOLD 300
+/* Speech needed before trailing silence can end an utterance (ms) */
+#define VOSK_ENDPOINT_MIN_SPEECH 100
+/* Captured audio a session buffers for the capture writer (ms) */
+#define VOSK_CAPTURE_BUFFER 2000
+/* Interval at which the capture writer flushes the sessions (ms) */
+#define VOSK_CAPTURE_INTERVAL 200
 
 /** \brief Forward declaration of speech (client object) */
 typedef struct vosk_speech_t vosk_speech_t;
-/** \brief Forward declaration of engine (global object) */
+/** \brief Forward declaration of engine (one per configuration section) */
 typedef struct vosk_engine_t vosk_engine_t;
+/** \brief Forward declaration of pooled connection */
+typedef struct vosk_conn_t vosk_conn_t;
+/** \brief Forward declaration of connection pool */
+typedef struct vosk_pool_t vosk_pool_t;
+/** \brief Forward declaration of server backend */
+typedef struct vosk_backend_t vosk_backend_t;
+/** \brief Forward declaration of result reader */
+typedef struct vosk_reader_t vosk_reader_t;
+/** \brief Forward declaration of audio sender */
+typedef struct vosk_sender_t vosk_sender_t;
+/** \brief Forward declaration of local decoder */
+typedef struct vosk_decoder_t vosk_decoder_t;
+/** \brief Forward declaration of prewarmed connection */
+typedef struct vosk_prewarm_t vosk_prewarm_t;
+/** \brief Forward declaration of audio capture */
+typedef struct vosk_capture_t vosk_capture_t;
+
+/** \brief Declaration of recognition statistics, updated without locking */
+typedef struct vosk_stats_t {
+	/* Time from SpeechCreate to a usable recognizer (ms) */
+	vosk_hist_t		connect;
+	/* Time from speech onset to the first result with words (ms) */
+	vosk_hist_t		first_partial;
+	/* Time from the last speech frame to the final result (ms) */
+	vosk_hist_t		final_latency;
+	/* Audio handed to the recognizer */
+	uint64_t		bytes;
+	uint64_t		frames;
+	/* Sessions created */
+	uint64_t		sessions;
+	/* Sessions moved away from the backend after it failed them */
+	uint64_t		failovers;
+	/* Utterances started, those hedged to another backend and those the hedge answered first */
+	uint64_t		utterances;
+	uint64_t		hedges;
+	uint64_t		hedge_wins;
+} vosk_stats_t;
+
+/** \brief Where recognition runs */
+enum vosk_engine_mode {
+	/* Remote vosk-server over websocket */
+	VOSK_MODE_SERVER = 0,
+	/* In-process libvosk with a model loaded at module load */
+	VOSK_MODE_LOCAL,
+	/* In-process libvosk, audio of all sessions decoded in batches */
+	VOSK_MODE_BATCH,
+};
+
+/** \brief Encoding of the audio written by the channel */
+enum vosk_input_codec {
+	/* Signed linear, 8 or 16 kHz */
+	VOSK_INPUT_SLIN = 0,
+	/* G.711 mu-law, 8 kHz */
+	VOSK_INPUT_ULAW,
+	/* G.711 A-law, 8 kHz */
+	VOSK_INPUT_ALAW,
+};
+
+/** \brief What to do when the server does not keep up with the audio */
+enum vosk_overflow_policy {
+	/* Discard the oldest queued audio */
+	VOSK_OVERFLOW_DROP_OLDEST = 0,
+	/* Give up on the session, it ends without a result */
+	VOSK_OVERFLOW_DROP_SESSION,
+	/* Move the session to a fresh connection, preferably on another backend */
+	VOSK_OVERFLOW_FAILOVER,
+};
+
+/** \brief Circuit breaker state of a backend */
+enum vosk_breaker_state {
+	/* Healthy, takes sessions */
+	VOSK_BREAKER_CLOSED = 0,
+	/* Failing, takes no sessions until the cooldown is over or a probe succeeds */
+	VOSK_BREAKER_OPEN,
+	/* Takes a single trial session, its outcome decides */
+	VOSK_BREAKER_HALF_OPEN,
+};
+
+/** \brief Why an utterance gets hedged */
+enum vosk_hedge_reason {
+	VOSK_HEDGE_NONE = 0,
+	/* No partial result within hedge_delay of speech onset */
+	VOSK_HEDGE_PARTIAL,
+	/* No final result within hedge_final_delay of the end of speech */
+	VOSK_HEDGE_FINAL,
+};
+
+/** \brief Outcome of admission control, reported by VOSK_ADMISSION() */
+enum vosk_admission {
+	/* Admitted right away */
+	VOSK_ADMISSION_ADMITTED = 0,
+	/* Admitted after waiting in the queue */
+	VOSK_ADMISSION_QUEUED,
+	/* Turned away at once, the wait queue is full */
+	VOSK_ADMISSION_REJECTED,
+	/* Turned away after waiting admission_timeout */
+	VOSK_ADMISSION_TIMEOUT,
+	/* Turned away at once, no backend is up */
+	VOSK_ADMISSION_UNAVAILABLE,
+	VOSK_ADMISSION_COUNT,
+};
+
+/*!
+ * \brief Session waiting for admission
+ *
+ * Lives on the stack of the waiting channel thread. The thread freeing a
+ * slot hands it over, backend slot included, and signals.
+ */
+typedef struct vosk_waiter_t {
+	ast_cond_t		cond;
+	/* Set once admitted, with the backend slot taken for the session */
+	int			admitted;
+	vosk_backend_t		*backend;
+	AST_LIST_ENTRY(vosk_waiter_t) list;
+} vosk_waiter_t;
+
+/*!
+ * \brief Declaration of single producer, single consumer byte ring
+ *
+ * head is only advanced by the producer and tail only by the consumer,
+ * both are free running and masked on access.
+ */
+typedef struct vosk_ring_t {
+	char			*data;
+	/* Capacity, power of two */
+	size_t			size;
+	size_t			head;
+	size_t			tail;
+} vosk_ring_t;
+
+/*!
+ * \brief Audio of the current utterance the server already got
+ *
+ * Sender thread only. Replayed to the new server when the session fails
+ * over mid-utterance; an utterance longer than replay_buffer cannot be
+ * replayed, the next one can again.
+ */
+typedef struct vosk_replay_t {
+	char			*data;
+	size_t			len;
+	size_t			size;
+	/* Set once the utterance outgrew replay_buffer */
+	int			overflow;
+	/* Set while a new connection still gets the kept audio from pos on, ahead of the ring */
+	int			pending;
+	size_t			pos;
+} vosk_replay_t;
+
+/*!
+ * \brief Rest of a websocket message the socket did not take yet
+ *
+ * Sender thread. The connection is set and cleared under its lock, so the
+ * reader can tell when a pong would land in the middle of the frame and
+ * stops watching the connection until the sender wrote the rest. Text
+ * messages queue up behind it, audio waits in the ring.
+ */
+typedef struct vosk_wsout_t {
+	/* Connection the bytes go to, referenced; NULL when nothing is left */
+	struct ast_websocket	*ws;
+	/* Masked frames, written from pos on */
+	char			*buf;
+	size_t			size;
+	size_t			pos;
+	size_t			len;
+	/* Event data the reader stopped watching the connection with, guarded by its lock */
+	void			*deferred;
+} vosk_wsout_t;
 
 /** \brief Declaration of Vosk speech structure */
 struct vosk_speech_t {
 	/* Name of the speech object to be used for logging */
 	char			*name;
+	/* Engine the session was created on */
+	vosk_engine_t		*engine;
+	/* Backend serving the session */
+	vosk_backend_t		*backend;
 	/* Websocket connection */
 	struct			ast_websocket *ws;
-	/* Buffer for frames */
-	char			buf[VOSK_BUF_SIZE];
-	int			offset;
-	char			*last_result;
+	/* Encoding and sample rate of the channel audio */
+	enum vosk_input_codec	codec;
+	int			input_rate;
+	/* Last input sample, carries resampling across frames */
+	int16_t			resample_last;
+	/* Conversion scratch area, channel thread only */
+	int16_t			*convert_buf;
+	size_t			convert_size;
+	/* Bytes of converted audio per millisecond */
+	size_t			bytes_per_ms;
+	/* Voice activity gate state, channel thread only */
+	int			vad_speaking;
+	/* Trailing silence since the last voiced frame (ms) */
+	int			vad_silence;
+	/* Latest gated silence, replayed when speech starts */
+	vosk_ring_t		preroll;
+	size_t			preroll_bytes;
+	/* Silence kept from the recognizer (bytes) */
+	unsigned int		suppressed;
+	/* Endpointing settings of this channel: trailing silence (ms) and RMS level */
+	int			endpoint_silence;
+	int			endpoint_threshold;
+	/* Voiced audio and trailing silence of the utterance (ms), channel thread only */
+	int			endpoint_voiced;
+	int			endpoint_trailing;
+	/* Set once the utterance ended, no audio is taken until the next start */
+	int			endpointed;
+	/* Asks the consumer to finalize once the queued audio is through */
+	int			finalize;
+	/* Set while the final result of a finalize request is outstanding */
+	int			finalizing;
+	/* Set once audio was queued since the last start, channel thread only */
+	int			dirty;
+	/* Asks the consumer to reset the recognizer once the ring tail reaches reset_pos */
+	int			reset;
+	size_t			reset_pos;
+	/* Server results still to come for audio of previous utterances */
+	int			discard;
+	/* Bytes making up one websocket message */
+	size_t			chunk_bytes;
+	/* Longest time queued audio waits for its chunk (ms) */
+	int			chunk_latency;
+	/* Bytes queued since the sender was last kicked */
+	size_t			unflushed;
+	/* Time the oldest of those bytes was queued */
+	struct timeval		unflushed_since;
+	/* Latest result and its confidence, guarded by the object lock */
+	char			last_result[VOSK_RESULT_SIZE];
+	double			last_conf;
+	/* Scratch area of the thread handling recognizer messages */
+	vosk_result_t		scan;
+	/* Time of the first speech frame of the utterance (ms), -1 once its first words came */
+	int64_t			speech_onset;
+	/* Time of the last speech frame (ms) */
+	int64_t			last_speech;
+	/* Hash of the last partial taken and earliest time for the next one */
+	uint32_t		partial_hash;
+	struct timeval		partial_next;
+	/* Set by the reader when a final result arrived */
+	int			done;
+	/* Reader thread watching the websocket */
+	vosk_reader_t		*reader;
+	/* Set once the websocket is closed, guarded by the object lock */
+	int			closed;
+	AST_LIST_ENTRY(vosk_speech_t) released;
+	/* Audio queued for the sender thread */
+	vosk_ring_t		ring;
+	/* Queued audio above which the overflow policy applies (bytes) */
+	size_t			high_water;
+	/* Oldest queued bytes the sender should discard */
+	size_t			drop_bytes;
+	/* Sender thread draining the ring */
+	vosk_sender_t		*sender;
+	/* Set while the session sits in the sender queue */
+	int			queued;
+	/* Set when the sender should move the session to a new connection */
+	int			failover;
+	/* Failovers so far, sender thread only */
+	int			failovers;
+	/* Audio to replay after a failover */
+	vosk_replay_t		replay;
+	/* Messages the connections of the session did not take in full */
+	vosk_wsout_t		out[2];
+	/* Second connection racing the first on the current utterance, guarded by the object lock */
+	struct ast_websocket	*hedge_ws;
+	vosk_backend_t		*hedge_backend;
+	/* Hedge the sender is setting up: its connection and the audio of the utterance it got, sender thread only */
+	vosk_prewarm_t		*hedge_conn;
+	size_t			hedge_pos;
+	/* Set while the hedge still owes its server the finalize of the utterance, sender thread only */
+	int			hedge_finalize;
+	/* Asks the sender to start a hedge, set to its reason */
+	int			hedge;
+	/* Set once the current utterance asked for a hedge, channel thread only */
+	int			hedged;
+	/* Set when the session gave up, no more audio is sent */
+	int			failed;
+	/* Set while the session holds an engine slot */
+	int			admitted;
+	/* Audio discarded by the overflow policy (bytes) */
+	unsigned int		dropped;
+	AST_LIST_ENTRY(vosk_speech_t) send_list;
+	/* Copy of the recognizer input for the capture writer, NULL if not captured */
+	vosk_capture_t		*capture;
+#ifdef HAVE_VOSK_API
+	/* In-process recognizer, local mode only */
+	VoskRecognizer		*recognizer;
+	/* Decoder whose queue the session joins */
+	vosk_decoder_t		*decoder;
+	/* Batched recognizer, batch mode only */
+	VoskBatchRecognizer	*batch_recognizer;
+	/* Recognizer of the previous utterance until its stream was evaluated, and whether the current stream is finished, scheduler thread only */
+	VoskBatchRecognizer	*batch_retired;
+	int			batch_finished;
+	/* Entry in a decoder queue or the batch */
+	AST_LIST_ENTRY(vosk_speech_t) decode_list;
+#endif
+};
+
+/** \brief Declaration of idle pre-connected websocket */
+struct vosk_conn_t {
+	/* Websocket connection, handshake already completed */
+	struct			ast_websocket *ws;
+	/* Time the connection was put into the pool */
+	struct timeval		idle_since;
+	AST_LIST_ENTRY(vosk_conn_t) list;
+};
+
+/** \brief Declaration of websocket connection pool */
+struct vosk_pool_t {
+	ast_mutex_t		lock;
+	/* Wakes up the refill thread */
+	ast_cond_t		cond;
+	/* Idle connections, most recently connected first */
+	AST_LIST_HEAD_NOLOCK(, vosk_conn_t) idle;
+	int			idle_count;
+	/* Number of idle connections the refill thread maintains */
+	int			target;
+	/* Configured bounds for target */
+	int			min_size;
+	int			max_size;
+	/* Idle connections older than this are dropped (ms, 0 disables) */
+	int			idle_timeout;
+	/* Longest connect (ms) */
+	int			connect_timeout;
+	/* Prewarms waiting for a connection, oldest first, each holding a reference */
+	AST_LIST_HEAD_NOLOCK(, vosk_prewarm_t) prewarms;
+	/* Websocket url the connections are made to */
+	const char		*url;
+	/* Message sent on every new connection, owned by the engine */
+	const char		*config;
+	/* Backend the pool belongs to, told about failed connects */
+	vosk_backend_t		*backend;
+	pthread_t		thread;
+	int			stop;
+};
+
+#ifdef HAVE_VOSK_API
+/*!
+ * \brief Declaration of local decoder
+ *
+ * Decoders run the in-process recognizers so that decoding never happens
+ * on a channel thread. Every session has a home decoder whose queue it
+ * joins when audio is ready; idle decoders steal from the other queues.
+ */
+struct vosk_decoder_t {
+	ast_mutex_t		lock;
+	/* Sessions with audio to decode, each holding a reference */
+	AST_LIST_HEAD_NOLOCK(, vosk_speech_t) queue;
+	pthread_t		thread;
+	/* Audio handed to the recognizer */
+	char			buf[VOSK_CHUNK_MAX_BYTES];
+};
+#endif
+
+/*!
+ * \brief Declaration of connection reserved ahead of SpeechCreate
+ *
+ * Referenced by the channel datastore and, until claimed, by the list
+ * of prewarmed connections; whatever is left over is released when the
+ * last reference goes. Hedges open their connection the same way,
+ * referenced by their session instead.
+ */
+struct vosk_prewarm_t {
+	/* Call the connection is reserved for */
+	ast_callid		callid;
+	/* Engine the next SpeechCreate of the call has to use to claim it */
+	vosk_engine_t		*engine;
+	/* Backend slot held for the session */
+	vosk_backend_t		*backend;
+	/* Set once admitted, the engine slot is held for the session too */
+	int			admitted;
+	/* Connection, guarded by the object lock */
+	struct ast_websocket	*ws;
+	/* Set while the pool opens the connection and the session still wants it, guarded by the object lock */
+	int			connecting;
+	ast_cond_t		cond;
+	AST_LIST_ENTRY(vosk_prewarm_t) list;
+	/* Entry in the queue of the pool opening the connection */
+	AST_LIST_ENTRY(vosk_prewarm_t) pool_list;
+};
+
+/*! \brief End of a captured utterance, queued for the capture writer */
+typedef struct vosk_capture_cut_t {
+	/* Ring position the utterance ends at */
+	size_t			pos;
+	/* Time of its first and last audio */
+	struct timeval		start;
+	struct timeval		end;
+	/* Audio lost because the writer fell behind (bytes) */
+	unsigned int		dropped;
+	AST_LIST_ENTRY(vosk_capture_cut_t) list;
+	/* Final result of the utterance */
+	char			text[0];
+} vosk_capture_cut_t;
+
+/*!
+ * \brief Declaration of audio capture
+ *
+ * The channel thread copies every converted frame into the ring and
+ * queues a cut at the end of each utterance; the capture writer drains
+ * the ring into one WAV file per utterance and writes the cut next to
+ * it. Once closed is set the session is gone and the writer frees the
+ * capture after the last cut.
+ */
+struct vosk_capture_t {
+	/* Captured audio, channel thread produces, writer consumes */
+	vosk_ring_t		ring;
+	/* Time of the first audio since the last cut and audio lost since (bytes), channel thread only */
+	struct timeval		start;
+	unsigned int		dropped;
+	/* Engine of the session and the rate of its audio */
+	const char		*engine;
+	int			sample_rate;
+	/* Backend of the session, set with the last cut */
+	const char		*backend;
+	/* Cuts not written yet, guarded by lock */
+	ast_mutex_t		lock;
+	AST_LIST_HEAD_NOLOCK(vosk_capture_cut_list, vosk_capture_cut_t) cuts;
+	/* Set once the session queued its last cut */
+	int			closed;
+	/* Capture number, file names are <id>-<utterance>, writer only from here on */
+	unsigned int		id;
+	unsigned int		utterance;
+	/* File of the current utterance and audio written to it (bytes) */
+	FILE			*file;
+	uint32_t		file_bytes;
+	AST_LIST_ENTRY(vosk_capture_t) list;
 };
 
-/** \brief Declaration of Vosk recognition engine */
+/** \brief Declaration of Vosk server backend */
+struct vosk_backend_t {
+	/* Websocket url */
+	char			*url;
+	/* Engine the backend belongs to */
+	vosk_engine_t		*engine;
+	/* Relative share of sessions */
+	int			weight;
+	/* Maximum concurrent sessions (0 is unlimited) */
+	int			max_sessions;
+	/* Recognition sessions currently open, guarded by engine lock */
+	int			active;
+	/* Total sessions served */
+	unsigned int		total;
+	/* Circuit breaker, guarded by engine lock; state is also read without it */
+	enum vosk_breaker_state	state;
+	/* Failures in a row while closed */
+	int			failures;
+	/* Time the breaker last opened */
+	struct timeval		opened;
+	/* Set while the half-open trial session runs */
+	int			trial;
+	/* Times the breaker opened */
+	unsigned int		trips;
+	/* Only takes hedges of sessions served elsewhere */
+	int			standby;
+	/* Pre-connected websockets */
+	vosk_pool_t		pool;
+	vosk_stats_t		stats;
+};
+
+/*!
+ * \brief Declaration of result reader
+ *
+ * Each reader owns an epoll set of session sockets. Sessions hold a
+ * reference for as long as they are registered; unregistered sessions
+ * are released by the reader after the current batch of events, so an
+ * event fetched before unregistering never points to freed memory.
+ */
+struct vosk_reader_t {
+	int			epfd;
+	/* Eventfd waking the thread for releases and shutdown */
+	int			wakefd;
+	pthread_t		thread;
+	int			stop;
+	ast_mutex_t		lock;
+	/* Unregistered sessions waiting to be released */
+	AST_LIST_HEAD_NOLOCK(vosk_speech_list, vosk_speech_t) released;
+};
+
+/*!
+ * \brief Declaration of audio sender
+ *
+ * Channel threads only push audio into the session ring and queue the
+ * session here; the sender thread does all network writes. Sessions whose
+ * socket is not writable are parked and retried, so a stalled server
+ * never blocks the sender or the caller's media.
+ */
+struct vosk_sender_t {
+	ast_mutex_t		lock;
+	ast_cond_t		cond;
+	/* Sessions with audio to send, each holding a reference */
+	AST_LIST_HEAD_NOLOCK(, vosk_speech_t) ready;
+	pthread_t		thread;
+	int			stop;
+	/* Copy of a text message, or of audio wrapping around the ring end on TLS */
+	char			buf[VOSK_CHUNK_MAX_BYTES];
+};
+
+/*!
+ * \brief Declaration of Vosk recognition engine
+ *
+ * One per section of the configuration, each registered as a speech
+ * engine of its own with its own backends, pools and limits. Engines
+ * live as long as the module is loaded.
+ */
 struct vosk_engine_t {
-	/* Websocket url*/
-	char			*ws_url;
+	/* Engine name as given to SpeechCreate */
+	char			*name;
+	/* Registration with the speech API */
+	struct ast_speech_engine speech;
+	enum vosk_engine_mode	mode;
+	/* Model directory, local mode only */
+	char			*model_path;
+#ifdef HAVE_VOSK_API
+	/* Model shared read-only by all recognizers, local mode only */
+	VoskModel		*model;
+	/* Model evaluating all sessions in batches, batch mode only */
+	VoskBatchModel		*batch_model;
+#endif
+	/* Sample rate of the audio fed to the recognizer */
+	int			sample_rate;
+	/* Configuration message sent to the server on connect */
+	char			*ws_config;
+	/* Longest wait for a batch to fill up (ms) and sessions per batch */
+	int			batch_delay;
+	int			batch_size;
+	/* Guards backend session counters and admission control */
+	ast_mutex_t		lock;
+	/* Server backends */
+	AST_VECTOR(, vosk_backend_t *) backends;
+	/* Admission control: open sessions and their limit (0 is unlimited) */
+	int			sessions;
+	int			max_sessions;
+	/* Sessions waiting for a slot, longest waiting first, at most admission_queue for admission_timeout (ms) */
+	AST_LIST_HEAD_NOLOCK(, vosk_waiter_t) waiters;
+	int			waiting;
+	int			admission_queue;
+	int			admission_timeout;
+	/* SpeechCreate outcomes */
+	uint64_t		admissions[VOSK_ADMISSION_COUNT];
+	/* Connection pool settings applied to every backend */
+	int			pool_min;
+	int			pool_max;
+	int			pool_idle_timeout;
+	/* Longest connect to a backend (ms) */
+	int			connect_timeout;
+	/* Circuit breaker: failures in a row that open it, cooldown and slowest final result (ms) */
+	int			breaker_failures;
+	int			breaker_cooldown;
+	int			breaker_latency;
+	/* Backend health probes: period (ms) and the thread running them, guarded by lock */
+	int			health_interval;
+	pthread_t		health_thread;
+	ast_cond_t		health_cond;
+	int			health_stop;
+	/* Queued audio per session before overflow_policy applies (ms) */
+	int			send_buffer;
+	/* Audio per websocket message and longest wait to fill one (ms) */
+	int			chunk_size;
+	int			chunk_latency;
+	/* Whether partial results are used and how many per second at most (0 is unlimited) */
+	int			partial_results;
+	int			partial_rate;
+	/* Voice activity gate: RMS level, pre-roll and hangover (ms) */
+	int			vad_threshold;
+	int			vad_preroll;
+	int			vad_hangover;
+	/* Default endpointing: trailing silence (ms) and RMS level of speech */
+	int			endpoint_silence;
+	int			endpoint_threshold;
+	enum vosk_overflow_policy overflow_policy;
+	/* Audio of the current utterance kept for replay after a failover (ms) */
+	int			replay_buffer;
+	/* Hedging: delays that start a hedge (ms, 0 disables) and share of utterances allowed (percent) */
+	int			hedge_delay;
+	int			hedge_final_delay;
+	int			hedge_budget;
+	/* Statistics of in-process recognition */
+	vosk_stats_t		local_stats;
 };
 
-static struct vosk_engine_t vosk_engine;
+/* Configured engines, fixed while the module is loaded */
+static AST_VECTOR(, vosk_engine_t *) vosk_engines;
 
-/** \brief Set up the speech structure within the engine */
-static int vosk_recog_create(struct ast_speech *speech, struct ast_format *format)
-{
-	vosk_speech_t *vosk_speech;
-	enum ast_websocket_result result;
+/* Result readers shared by all sessions */
+static vosk_reader_t *vosk_readers;
+static int vosk_reader_count = VOSK_READER_THREADS;
+static unsigned int vosk_reader_next;
 
-	vosk_speech = ast_calloc(1, sizeof(vosk_speech_t));
-	vosk_speech->name = "vosk";
-	speech->data = vosk_speech;
+/* Audio senders shared by all sessions */
+static vosk_sender_t *vosk_senders;
+static int vosk_sender_count = VOSK_SENDER_THREADS;
+static unsigned int vosk_sender_next;
 
-	ast_debug(1, "(%s) Create speech resource %s\n",vosk_speech->name, vosk_engine.ws_url);
+/* Prewarmed connections not claimed yet */
+static AST_LIST_HEAD_NOLOCK(, vosk_prewarm_t) vosk_prewarms;
+AST_MUTEX_DEFINE_STATIC(vosk_prewarm_lock);
 
-	vosk_speech->ws = ast_websocket_client_create(vosk_engine.ws_url, "ws", NULL, &result);
-	if (!vosk_speech->ws) {
-		ast_free(speech->data);
-		return -1;
-	} 
+/*!
+ * \brief Capture writer
+ *
+ * A single thread does all file I/O of audio capture, the channel thread
+ * only copies frames into the session's capture ring.
+ */
+static struct {
+	ast_mutex_t		lock;
+	ast_cond_t		cond;
+	/* Captures of live sessions and those with data left to write */
+	AST_LIST_HEAD_NOLOCK(vosk_capture_list, vosk_capture_t) captures;
+	pthread_t		thread;
+	int			started;
+	int			stop;
+	/* Last capture number handed out */
+	unsigned int		next_id;
+	/* Directory captured audio goes to, NULL when capture is off, and share of sessions captured (percent) */
+	char			*dir;
+	int			percent;
+	char			buf[VOSK_CHUNK_MAX_BYTES];
+} vosk_capture;
 
-	ast_debug(1, "(%s) Created speech resource result %d\n", vosk_speech->name, result);
+#ifdef HAVE_VOSK_API
+/* Decoders shared by all local sessions, 0 is one per CPU */
+static vosk_decoder_t *vosk_decoders;
+static int vosk_decoder_count;
+static unsigned int vosk_decoder_next;
+/* Sessions waiting in any decoder queue */
+static int vosk_decoder_pending;
+static int vosk_decoder_stop;
+/* Idle decoders sleep here */
+AST_MUTEX_DEFINE_STATIC(vosk_decoder_lock);
+static ast_cond_t vosk_decoder_cond;
 
-	return 0;
-}
+/*!
+ * \brief Batch scheduler of batch mode
+ *
+ * A single thread owns every batched recognizer. Sessions with new audio
+ * join the pending list; once batch_size sessions are pending or the
+ * oldest waited batch_delay, the scheduler feeds all their audio and lets
+ * the model evaluate it in one go.
+ */
+static struct {
+	ast_mutex_t		lock;
+	ast_cond_t		cond;
+	/* Sessions with audio or closing, each holding a reference */
+	struct vosk_speech_list	pending;
+	int			pending_count;
+	/* Time the first pending session joined */
+	struct timeval		pending_since;
+	pthread_t		thread;
+	/* Set once the structure is initialized */
+	int			started;
+	int			stop;
+	/* The engine in batch mode, there is only one batch model per process */
+	vosk_engine_t		*engine;
+	/* Sessions of the batch being decoded */
+	AST_VECTOR(, vosk_speech_t *) batch;
+	char			buf[VOSK_CHUNK_MAX_BYTES];
+} vosk_batch;
+#endif
 
-/** \brief Destroy any data set on the speech structure by the engine */
-static int vosk_recog_destroy(struct ast_speech *speech)
+/** \brief Engine of the given name, NULL if there is none */
+static vosk_engine_t *vosk_engine_find(const char *name)
 {
-	const char *eof = "{\"eof\" : 1}";
+	size_t i;
 
-	vosk_speech_t *vosk_speech = speech->data;
-	ast_debug(1, "(%s) Destroy speech resource\n",vosk_speech->name);
+	for (i = 0; i < AST_VECTOR_SIZE(&vosk_engines); i++) {
+		vosk_engine_t *engine = AST_VECTOR_GET(&vosk_engines, i);
 
-	if (vosk_speech->ws) {
-		int fd = ast_websocket_fd(vosk_speech->ws);
-		if (fd > 0) {
-			ast_websocket_write_string(vosk_speech->ws, eof);
-			ast_websocket_close(vosk_speech->ws, 1000);
-			shutdown(fd, SHUT_RDWR);
+		if (!strcasecmp(engine->name, name)) {
+			return engine;
 		}
-		ast_websocket_unref(vosk_speech->ws);
 	}
-	ast_free(vosk_speech->last_result);
-	ast_free(vosk_speech);
+	return NULL;
+}
 
+/** \brief Allocate a ring of at least min_size bytes */
+static int vosk_ring_init(vosk_ring_t *ring, size_t min_size)
+{
+	size_t size = 1;
+
+	while (size < min_size) {
+		size <<= 1;
+	}
+	ring->data = ast_malloc(size);
+	if (!ring->data) {
+		return -1;
+	}
+	ring->size = size;
+	ring->head = 0;
+	ring->tail = 0;
 	return 0;
 }
 
-/*! \brief Stop the in-progress recognition */
-static int vosk_recog_stop(struct ast_speech *speech)
+/** \brief Free the ring storage */
+static void vosk_ring_free(vosk_ring_t *ring)
 {
-	vosk_speech_t *vosk_speech = speech->data;
-	ast_debug(1, "(%s) Stop recognition\n",vosk_speech->name);
-	ast_speech_change_state(speech, AST_SPEECH_STATE_NOT_READY);
-	return 0;
+	ast_free(ring->data);
+	ring->data = NULL;
 }
 
-/*! \brief Load a local grammar on the speech structure */
-static int vosk_recog_load_grammar(struct ast_speech *speech, const char *grammar_name, const char *grammar_path)
+/** \brief Bytes queued in the ring, safe from either side */
+static size_t vosk_ring_used(vosk_ring_t *ring)
 {
-	return 0;
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
 }
 
-/** \brief Unload a local grammar */
-static int vosk_recog_unload_grammar(struct ast_speech *speech, const char *grammar_name)
+/** \brief Append data to the ring (producer), fails when it does not fit */
+static int vosk_ring_write(vosk_ring_t *ring, const void *data, size_t len)
 {
+	size_t head = ring->head;
+	size_t offset = head & (ring->size - 1);
+	size_t first;
+
+	if (ring->size - vosk_ring_used(ring) < len) {
+		return -1;
+	}
+	first = MIN(len, ring->size - offset);
+	memcpy(ring->data + offset, data, first);
+	memcpy(ring->data, (const char *) data + first, len - first);
+	__atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
 	return 0;
 }
 
-/** \brief Activate a loaded grammar */
-static int vosk_recog_activate_grammar(struct ast_speech *speech, const char *grammar_name)
+/** \brief Copy up to len bytes from the front of the ring without consuming (consumer) */
+static size_t vosk_ring_peek(vosk_ring_t *ring, void *data, size_t len)
 {
-	return 0;
+	size_t tail = ring->tail;
+	size_t offset = tail & (ring->size - 1);
+	size_t first;
+
+	len = MIN(len, vosk_ring_used(ring));
+	first = MIN(len, ring->size - offset);
+	memcpy(data, ring->data + offset, first);
+	memcpy((char *) data + first, ring->data, len - first);
+	return len;
 }
 
-/** \brief Deactivate a loaded grammar */
-static int vosk_recog_deactivate_grammar(struct ast_speech *speech, const char *grammar_name)
+/*!
+ * \brief Point at up to len bytes from the front of the ring (consumer)
+ *
+ * \return Number of slices filled in, two when the bytes wrap around
+ */
+static int vosk_ring_slices(vosk_ring_t *ring, size_t len, struct iovec slices[2])
 {
-	return 0;
+	size_t offset = ring->tail & (ring->size - 1);
+	size_t first;
+
+	len = MIN(len, vosk_ring_used(ring));
+	first = MIN(len, ring->size - offset);
+	slices[0].iov_base = ring->data + offset;
+	slices[0].iov_len = first;
+	slices[1].iov_base = ring->data;
+	slices[1].iov_len = len - first;
+	return first < len ? 2 : 1;
 }
 
-/** \brief Write audio to the speech engine */
-static int vosk_recog_write(struct ast_speech *speech, void *data, int len)
+/** \brief Drop up to len bytes from the front of the ring (consumer) */
+static void vosk_ring_consume(vosk_ring_t *ring, size_t len)
 {
-	vosk_speech_t *vosk_speech = speech->data;
-	char *res;
-	int res_len;
-
-	ast_assert (vosk_speech->offset + len < VOSK_BUF_SIZE);
-
-	memcpy(vosk_speech->buf + vosk_speech->offset, data, len);
-	vosk_speech->offset += len;
-	if (vosk_speech->offset == VOSK_BUF_SIZE) {
-		ast_websocket_write(vosk_speech->ws, AST_WEBSOCKET_OPCODE_BINARY, vosk_speech->buf, VOSK_BUF_SIZE);
-		vosk_speech->offset = 0;
-	}
-
-	ast_mutex_unlock(&speech->lock);
-	if (ast_websocket_wait_for_input(vosk_speech->ws, 0) > 0) {
-		res_len = ast_websocket_read_string(vosk_speech->ws, &res);
-		if (res_len >= 0) {
-			ast_verb(4, "(%s) Got result: '%s'\n", vosk_speech->name, res);
-			struct ast_json_error err;
-			struct ast_json *res_json = ast_json_load_string(res, &err);
-			if (res_json != NULL) {
-				const char *text = ast_json_object_string_get(res_json, "text");
-				const char *partial = ast_json_object_string_get(res_json, "partial");
-				if (partial != NULL && !ast_strlen_zero(partial)) {
-					ast_verb(4, "(%s) Partial recognition result: %s\n", vosk_speech->name, partial);
-					ast_free(vosk_speech->last_result);
-					vosk_speech->last_result = ast_strdup(partial);
-				} else if (text != NULL && !ast_strlen_zero(text)) {
-					ast_verb(4, "(%s) Recognition result: %s\n", vosk_speech->name, text);
-					ast_free(vosk_speech->last_result);
-					vosk_speech->last_result = ast_strdup(text);
-					ast_speech_change_state(speech, AST_SPEECH_STATE_DONE);
-				}
-			} else {
-				ast_log(LOG_ERROR, "(%s) JSON parse error: %s\n", vosk_speech->name, err.text);
-			}
-			ast_json_free(res_json);
-		} else {
-			ast_log(LOG_NOTICE, "(%s) Got error result %d\n", vosk_speech->name, res_len);
+	len = MIN(len, vosk_ring_used(ring));
+	__atomic_store_n(&ring->tail, ring->tail + len, __ATOMIC_RELEASE);
+}
+
+/*!
+ * \brief Open a new websocket connection to the server
+ *
+ * The configuration message goes out right after the handshake, so
+ * pooled connections are ready to take audio as soon as they are
+ * checked out. A server that does not answer within timeout
+ * milliseconds counts as unreachable.
+ */
+static struct ast_websocket *vosk_connect(const char *url, const char *config, int timeout)
+{
+	struct ast_websocket_client_options options = {
+		.uri = url,
+		.protocols = "ws",
+		.timeout = timeout,
+	};
+	struct ast_websocket *ws;
+	enum ast_websocket_result result;
+
+	ws = ast_websocket_client_create_with_options(&options, &result);
+	if (!ws) {
+		ast_log(LOG_WARNING, "Failed to connect to %s, result %d\n", url, result);
+		return NULL;
+	}
+	/* Results may come fragmented, have the websocket reassemble them */
+	ast_websocket_reconstruct_enable(ws, VOSK_RESULT_SIZE * 4);
+	if (config && ast_websocket_write_string(ws, config)) {
+		ast_log(LOG_WARNING, "Failed to configure connection to %s\n", url);
+		ast_websocket_close(ws, 1000);
+		ast_websocket_unref(ws);
+		return NULL;
+	}
+	return ws;
+}
+
+/** \brief Close a websocket that never carried a recognition session */
+static void vosk_disconnect(struct ast_websocket *ws)
+{
+	ast_websocket_close(ws, 1000);
+	ast_websocket_unref(ws);
+}
+
+static const char *vosk_breaker_state_str(enum vosk_breaker_state state)
+{
+	switch (state) {
+	case VOSK_BREAKER_CLOSED:
+		return "closed";
+	case VOSK_BREAKER_OPEN:
+		return "open";
+	case VOSK_BREAKER_HALF_OPEN:
+		return "half-open";
+	}
+	return "unknown";
+}
+
+/*!
+ * \brief Count a failure against the circuit breaker of a backend
+ *
+ * Failed connects and probes, write errors, lost connections and late
+ * final results all count. breaker_failures of them in a row open the
+ * breaker, a failed trial opens it again at once.
+ */
+static void vosk_backend_failure(vosk_engine_t *engine, vosk_backend_t *backend, const char *reason)
+{
+	if (!backend || !engine->breaker_failures) {
+		return;
+	}
+
+	ast_mutex_lock(&engine->lock);
+	switch (backend->state) {
+	case VOSK_BREAKER_CLOSED:
+		if (++backend->failures < engine->breaker_failures) {
+			ast_mutex_unlock(&engine->lock);
+			return;
 		}
+		backend->trips++;
+		break;
+	case VOSK_BREAKER_OPEN:
+		/* Still down, the cooldown starts over */
+		backend->opened = ast_tvnow();
+		ast_mutex_unlock(&engine->lock);
+		return;
+	case VOSK_BREAKER_HALF_OPEN:
+		break;
 	}
-	ast_mutex_lock(&speech->lock);
+	__atomic_store_n(&backend->state, VOSK_BREAKER_OPEN, __ATOMIC_RELEASE);
+	backend->opened = ast_tvnow();
+	backend->trial = 0;
+	ast_mutex_unlock(&engine->lock);
 
-	return 0;
+	ast_log(LOG_WARNING, "Backend %s is failing (%s), circuit breaker open\n", backend->url, reason);
 }
 
-/** \brief Signal DTMF was received */
-static int vosk_recog_dtmf(struct ast_speech *speech, const char *dtmf)
+/*!
+ * \brief Count a success for the circuit breaker of a backend
+ *
+ * Only a final result in time, verified, closes the breaker. A connect
+ * merely shows the server is up again, it lets an open breaker try a
+ * session without waiting for the cooldown.
+ */
+static void vosk_backend_success(vosk_engine_t *engine, vosk_backend_t *backend, int verified)
 {
-	vosk_speech_t *vosk_speech = speech->data;
-	ast_verb(4, "(%s) Signal DTMF %s\n",vosk_speech->name,dtmf);
-	return 0;
+	enum vosk_breaker_state state;
+
+	if (!backend || !engine->breaker_failures) {
+		return;
+	}
+	/* Healthy backends do not need the lock */
+	state = __atomic_load_n(&backend->state, __ATOMIC_ACQUIRE);
+	if (state == VOSK_BREAKER_CLOSED && (!verified || !__atomic_load_n(&backend->failures, __ATOMIC_RELAXED))) {
+		return;
+	}
+
+	ast_mutex_lock(&engine->lock);
+	if (verified) {
+		backend->failures = 0;
+		if (backend->state != VOSK_BREAKER_CLOSED) {
+			__atomic_store_n(&backend->state, VOSK_BREAKER_CLOSED, __ATOMIC_RELEASE);
+			backend->trial = 0;
+			ast_log(LOG_NOTICE, "Backend %s recovered, circuit breaker closed\n", backend->url);
+		}
+	} else if (backend->state == VOSK_BREAKER_OPEN) {
+		__atomic_store_n(&backend->state, VOSK_BREAKER_HALF_OPEN, __ATOMIC_RELEASE);
+		backend->trial = 0;
+		ast_debug(1, "Backend %s is reachable again, circuit breaker half-open\n", backend->url);
+	}
+	ast_mutex_unlock(&engine->lock);
 }
 
-/** brief Prepare engine to accept audio */
-static int vosk_recog_start(struct ast_speech *speech)
+/*!
+ * \brief Check whether the breaker lets a backend take a session
+ *
+ * Engine lock held, changes nothing. An open breaker admits once its
+ * cooldown is over, a half-open one while its trial is free.
+ */
+static int vosk_backend_available(vosk_engine_t *engine, vosk_backend_t *backend, struct timeval now)
 {
-	vosk_speech_t *vosk_speech = speech->data;
-	ast_debug(1, "(%s) Start recognition\n",vosk_speech->name);
-	ast_speech_change_state(speech, AST_SPEECH_STATE_READY);
+	switch (backend->state) {
+	case VOSK_BREAKER_CLOSED:
+		return 1;
+	case VOSK_BREAKER_OPEN:
+		return ast_tvdiff_ms(now, backend->opened) >= engine->breaker_cooldown;
+	case VOSK_BREAKER_HALF_OPEN:
+		return !backend->trial;
+	}
 	return 0;
 }
 
-/** \brief Change an engine specific setting */
-static int vosk_recog_change(struct ast_speech *speech, const char *name, const char *value)
+/*!
+ * \brief Claim the trial session of a backend the breaker keeps in doubt
+ *
+ * Engine lock held, only for a session about to be served, which
+ * vosk_backend_available has let in. An open breaker turns half-open
+ * and the session becomes its trial.
+ */
+static void vosk_backend_try_trial(vosk_backend_t *backend)
 {
-	vosk_speech_t *vosk_speech = speech->data;
-	ast_debug(1, "(%s) Change setting name: %s value:%s\n",vosk_speech->name,name,value);
-	return 0;
+	switch (backend->state) {
+	case VOSK_BREAKER_CLOSED:
+		return;
+	case VOSK_BREAKER_OPEN:
+		__atomic_store_n(&backend->state, VOSK_BREAKER_HALF_OPEN, __ATOMIC_RELEASE);
+		ast_debug(1, "Backend %s cooled down, circuit breaker half-open\n", backend->url);
+		/* Fall through */
+	case VOSK_BREAKER_HALF_OPEN:
+		backend->trial = 1;
+		return;
+	}
 }
 
-/** \brief Get an engine specific attribute */
-static int vosk_recog_get_settings(struct ast_speech *speech, const char *name, char *buf, size_t len)
+/*!
+ * \brief Check whether an idle connection is still usable
+ *
+ * The server never talks first, so any pending input on an idle socket
+ * is either a close frame or a reset connection.
+ */
+static int vosk_conn_is_stale(struct ast_websocket *ws)
 {
-	vosk_speech_t *vosk_speech = speech->data;
-	ast_debug(1, "(%s) Get settings name: %s\n",vosk_speech->name,name);
-	return -1;
+	return ast_websocket_fd(ws) < 0 || ast_websocket_wait_for_input(ws, 0) != 0;
 }
 
-/** \brief Change the type of results we want back */
-static int vosk_recog_change_results_type(struct ast_speech *speech,enum ast_speech_results_type results_type)
+/** \brief Close and free a list of pooled connections */
+static void vosk_conn_list_destroy(vosk_conn_t *conn)
 {
-	return -1;
+	vosk_conn_t *next;
+
+	for (; conn; conn = next) {
+		next = AST_LIST_NEXT(conn, list);
+		vosk_disconnect(conn->ws);
+		ast_free(conn);
+	}
 }
 
-/** \brief Try to get result */
-struct ast_speech_result* vosk_recog_get(struct ast_speech *speech)
+/*!
+ * \brief Open the connection of a prewarm, on the pool thread
+ *
+ * A prewarm given up on in the meantime, by a SpeechCreate done waiting
+ * or a hangup, is skipped, or its connection stays in the pool.
+ */
+static void vosk_pool_prewarm(vosk_pool_t *pool, vosk_prewarm_t *prewarm)
 {
-	struct ast_speech_result *speech_result;
+	struct ast_websocket *ws;
+	vosk_conn_t *conn;
+	int wanted;
 
-	vosk_speech_t *vosk_speech = speech->data;
-	speech_result = ast_calloc(sizeof(struct ast_speech_result), 1);
-	speech_result->text = ast_strdup(vosk_speech->last_result);
-	speech_result->score = 100;
+	ao2_lock(prewarm);
+	wanted = prewarm->connecting;
+	ao2_unlock(prewarm);
+	if (!wanted) {
+		ao2_ref(prewarm, -1);
+		return;
+	}
 
-	ast_set_flag(speech, AST_SPEECH_HAVE_RESULTS);
-	return speech_result;
-}
+	ws = vosk_connect(pool->url, pool->config, pool->connect_timeout);
+	if (!ws) {
+		vosk_backend_failure(pool->backend->engine, pool->backend, "connect failed");
+	}
 
-/** \brief Speech engine declaration */
-static struct ast_speech_engine ast_engine = {
-	VOSK_ENGINE_NAME,
-	vosk_recog_create,
-	vosk_recog_destroy,
-	vosk_recog_load_grammar,
-	vosk_recog_unload_grammar,
-	vosk_recog_activate_grammar,
-	vosk_recog_deactivate_grammar,
-	vosk_recog_write,
-	vosk_recog_dtmf,
-	vosk_recog_start,
-	vosk_recog_change,
-	vosk_recog_get_settings,
-	vosk_recog_change_results_type,
-	vosk_recog_get
-};
+	ao2_lock(prewarm);
+	if (prewarm->connecting) {
+		prewarm->ws = ws;
+		prewarm->connecting = 0;
+		ast_cond_broadcast(&prewarm->cond);
+		ws = NULL;
+	}
+	ao2_unlock(prewarm);
+	ao2_ref(prewarm, -1);
+
+	conn = ws && pool->max_size > 0 ? ast_calloc(1, sizeof(*conn)) : NULL;
+	if (!conn) {
+		if (ws) {
+			vosk_disconnect(ws);
+		}
+		return;
+	}
+	conn->ws = ws;
+	conn->idle_since = ast_tvnow();
+	ast_mutex_lock(&pool->lock);
+	AST_LIST_INSERT_HEAD(&pool->idle, conn, list);
+	pool->idle_count++;
+	ast_mutex_unlock(&pool->lock);
+}
 
-/** \brief Load Vosk engine configuration (/etc/asterisk/res_speech_vosk.conf)*/
-static int vosk_engine_config_load()
+/*!
+ * \brief Connection pool maintenance thread
+ *
+ * Opens the connections of prewarms first, then keeps target idle
+ * connections open, dropping connections which stayed idle for longer
+ * than idle_timeout or which were closed by the server. Idle timeouts
+ * also shrink target back towards min_size, so bursts grow the pool and
+ * quiet periods let it drain.
+ */
+static void *vosk_pool_thread(void *data)
 {
-	const char *value = NULL;
-	struct ast_flags config_flags = { 0 };
-	struct ast_config *cfg = ast_config_load(VOSK_ENGINE_CONFIG, config_flags);
-	if(!cfg) {
-		ast_log(LOG_WARNING, "No such configuration file %s\n", VOSK_ENGINE_CONFIG);
-		return -1;
+	vosk_pool_t *pool = data;
+	AST_LIST_HEAD_NOLOCK(, vosk_conn_t) evicted;
+	vosk_conn_t *conn;
+	vosk_prewarm_t *prewarm;
+	struct ast_websocket *ws;
+	struct timeval now, wait;
+	struct timespec ts;
+	int retry = 0;
+
+	ast_mutex_lock(&pool->lock);
+	while (!pool->stop) {
+		/* A channel is about to need these, they come before the refill */
+		if ((prewarm = AST_LIST_REMOVE_HEAD(&pool->prewarms, pool_list))) {
+			ast_mutex_unlock(&pool->lock);
+			vosk_pool_prewarm(pool, prewarm);
+			ast_mutex_lock(&pool->lock);
+			continue;
+		}
+
+		AST_LIST_HEAD_INIT_NOLOCK(&evicted);
+		now = ast_tvnow();
+		AST_LIST_TRAVERSE_SAFE_BEGIN(&pool->idle, conn, list) {
+			int expired = pool->idle_timeout > 0 && ast_tvdiff_ms(now, conn->idle_since) >= pool->idle_timeout;
+			if (expired || vosk_conn_is_stale(conn->ws)) {
+				AST_LIST_REMOVE_CURRENT(list);
+				AST_LIST_INSERT_TAIL(&evicted, conn, list);
+				pool->idle_count--;
+				if (expired && pool->target > pool->min_size) {
+					pool->target--;
+				}
+			}
+		}
+		AST_LIST_TRAVERSE_SAFE_END;
+
+		if (!AST_LIST_EMPTY(&evicted)) {
+			ast_mutex_unlock(&pool->lock);
+			vosk_conn_list_destroy(AST_LIST_FIRST(&evicted));
+			ast_mutex_lock(&pool->lock);
+			continue;
+		}
+
+		/* A backend behind an open breaker is left to the health probes */
+		if (!retry && pool->idle_count < pool->target
+			&& __atomic_load_n(&pool->backend->state, __ATOMIC_ACQUIRE) != VOSK_BREAKER_OPEN) {
+			ast_mutex_unlock(&pool->lock);
+			ws = vosk_connect(pool->url, pool->config, pool->connect_timeout);
+			conn = ws ? ast_calloc(1, sizeof(*conn)) : NULL;
+			if (conn) {
+				conn->ws = ws;
+				conn->idle_since = ast_tvnow();
+			} else if (ws) {
+				vosk_disconnect(ws);
+			}
+			ast_mutex_lock(&pool->lock);
+			if (conn) {
+				AST_LIST_INSERT_HEAD(&pool->idle, conn, list);
+				pool->idle_count++;
+			} else {
+				ast_mutex_unlock(&pool->lock);
+				vosk_backend_failure(pool->backend->engine, pool->backend, "connect failed");
+				ast_mutex_lock(&pool->lock);
+				retry = 1;
+			}
+			continue;
+		}
+
+		wait = ast_tvadd(ast_tvnow(), ast_samp2tv(retry ? VOSK_POOL_RETRY_INTERVAL : VOSK_POOL_CHECK_INTERVAL, 1000));
+		ts.tv_sec = wait.tv_sec;
+		ts.tv_nsec = wait.tv_usec * 1000;
+		ast_cond_timedwait(&pool->cond, &pool->lock, &ts);
+		retry = 0;
 	}
-	if((value = ast_variable_retrieve(cfg, "general", "url")) != NULL) {
-		ast_log(LOG_DEBUG, "general.url=%s\n", value);
-		vosk_engine.ws_url = ast_strdup(value);
+	ast_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/*!
+ * \brief Start the connection pool for the given url
+ *
+ * A pool without a refill thread still works, every checkout then
+ * connects inline and prewarms do not connect ahead.
+ */
+static void vosk_pool_start(vosk_pool_t *pool, vosk_backend_t *backend, const char *config)
+{
+	pool->url = backend->url;
+	pool->backend = backend;
+	pool->config = config;
+	pool->target = pool->min_size;
+	pool->thread = AST_PTHREADT_NULL;
+	AST_LIST_HEAD_INIT_NOLOCK(&pool->idle);
+	AST_LIST_HEAD_INIT_NOLOCK(&pool->prewarms);
+	ast_mutex_init(&pool->lock);
+	ast_cond_init(&pool->cond, NULL);
+
+	if (backend->engine->mode != VOSK_MODE_SERVER) {
+		/* Nothing to connect to */
+		return;
 	}
-	if (!vosk_engine.ws_url) {
-		vosk_engine.ws_url = ast_strdup("ws://localhost");
+	/* With pooling disabled the thread only opens prewarmed connections */
+
+	if (ast_pthread_create_background(&pool->thread, NULL, vosk_pool_thread, pool)) {
+		ast_log(LOG_WARNING, "Failed to start connection pool thread for %s\n", pool->url);
+		pool->thread = AST_PTHREADT_NULL;
 	}
-	ast_config_destroy(cfg);
-	return 0;
 }
 
-/** \brief Load module */
-static int load_module(void)
+/** \brief Stop the refill thread and close all idle connections */
+static void vosk_pool_stop(vosk_pool_t *pool)
 {
-	ast_log(LOG_NOTICE, "Load res_speech_vosk module\n");
+	vosk_conn_t *idle;
+	vosk_prewarm_t *prewarm;
 
-	/* Load engine configuration */
-	if (vosk_engine_config_load()) {
-		return AST_MODULE_LOAD_DECLINE;
-	}
+	ast_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	ast_cond_signal(&pool->cond);
+	ast_mutex_unlock(&pool->lock);
 
-	ast_engine.formats = ast_format_cap_alloc(AST_FORMAT_CAP_FLAG_DEFAULT);
-	if(!ast_engine.formats) {
-		ast_log(LOG_ERROR, "Failed to alloc media format capabilities\n");
-		return AST_MODULE_LOAD_FAILURE;
+	if (pool->thread != AST_PTHREADT_NULL) {
+		pthread_join(pool->thread, NULL);
+		pool->thread = AST_PTHREADT_NULL;
 	}
-	ast_format_cap_append(ast_engine.formats, ast_format_slin, 0);
 
-	if(ast_speech_register(&ast_engine)) {
-		ast_log(LOG_ERROR, "Failed to register module\n");
-		return AST_MODULE_LOAD_FAILURE;
+	/* Sessions waiting on these connect on their own */
+	while ((prewarm = AST_LIST_REMOVE_HEAD(&pool->prewarms, pool_list))) {
+		ao2_lock(prewarm);
+		prewarm->connecting = 0;
+		ast_cond_broadcast(&prewarm->cond);
+		ao2_unlock(prewarm);
+		ao2_ref(prewarm, -1);
 	}
 
-	return AST_MODULE_LOAD_SUCCESS;
+	idle = AST_LIST_FIRST(&pool->idle);
+	AST_LIST_HEAD_INIT_NOLOCK(&pool->idle);
+	pool->idle_count = 0;
+	vosk_conn_list_destroy(idle);
+
+	ast_cond_destroy(&pool->cond);
+	ast_mutex_destroy(&pool->lock);
 }
 
-/** \brief Unload module */
-static int unload_module(void)
+/*!
+ * \brief Take a ready connection out of the pool
+ *
+ * Returns NULL when the pool is empty; every miss raises the pool target
+ * so that the next burst is served warm.
+ */
+static struct ast_websocket *vosk_pool_take(vosk_pool_t *pool)
 {
-	ast_log(LOG_NOTICE, "Unload res_speech_vosk module\n");
-	if(ast_speech_unregister(VOSK_ENGINE_NAME)) {
-		ast_log(LOG_ERROR, "Failed to unregister module\n");
+	AST_LIST_HEAD_NOLOCK(, vosk_conn_t) stale;
+	vosk_conn_t *conn;
+	struct ast_websocket *ws = NULL;
+
+	AST_LIST_HEAD_INIT_NOLOCK(&stale);
+
+	ast_mutex_lock(&pool->lock);
+	while ((conn = AST_LIST_REMOVE_HEAD(&pool->idle, list))) {
+		pool->idle_count--;
+		if (!vosk_conn_is_stale(conn->ws)) {
+			break;
+		}
+		AST_LIST_INSERT_TAIL(&stale, conn, list);
 	}
+	if (!conn && pool->target < pool->max_size) {
+		pool->target++;
+	}
+	ast_cond_signal(&pool->cond);
+	ast_mutex_unlock(&pool->lock);
+
+	vosk_conn_list_destroy(AST_LIST_FIRST(&stale));
 
-	ast_free(vosk_engine.ws_url);
+	if (conn) {
+		ws = conn->ws;
+		ast_free(conn);
+	}
+
+	return ws;
+}
+
+/*!
+ * \brief Have the refill thread open the connection of a prewarm
+ *
+ * \retval 0 the prewarm is queued, it holds a reference until served
+ * \retval -1 the pool has no thread to connect on
+ */
+static int vosk_pool_queue_prewarm(vosk_pool_t *pool, vosk_prewarm_t *prewarm)
+{
+	int res = -1;
+
+	ast_mutex_lock(&pool->lock);
+	if (pool->thread != AST_PTHREADT_NULL && !pool->stop) {
+		ao2_ref(prewarm, +1);
+		AST_LIST_INSERT_TAIL(&pool->prewarms, prewarm, pool_list);
+		ast_cond_signal(&pool->cond);
+		res = 0;
+	}
+	ast_mutex_unlock(&pool->lock);
+
+	return res;
+}
+
+/** \brief Take a ready connection, connecting synchronously when the pool is empty */
+static struct ast_websocket *vosk_pool_checkout(vosk_pool_t *pool)
+{
+	struct ast_websocket *ws = vosk_pool_take(pool);
+
+	if (!ws && !(ws = vosk_connect(pool->url, pool->config, pool->connect_timeout))) {
+		vosk_backend_failure(pool->backend->engine, pool->backend, "connect failed");
+	}
+	return ws;
+}
+
+/*!
+ * \brief Parse a backend definition
+ *
+ * Format is "url[,weight=N][,max_sessions=N]".
+ */
+static vosk_backend_t *vosk_backend_alloc(const char *definition)
+{
+	vosk_backend_t *backend;
+	char *parse = ast_strdupa(definition);
+	char *url = ast_strsep(&parse, ',', AST_STRSEP_STRIP);
+	char *option;
+
+	if (ast_strlen_zero(url)) {
+		ast_log(LOG_WARNING, "Missing url in backend definition '%s'\n", definition);
+		return NULL;
+	}
+
+	backend = ast_calloc(1, sizeof(*backend));
+	if (!backend) {
+		return NULL;
+	}
+	backend->url = ast_strdup(url);
+	backend->weight = 1;
+
+	while ((option = ast_strsep(&parse, ',', AST_STRSEP_STRIP))) {
+		char *value = option;
+		char *name = ast_strsep(&value, '=', AST_STRSEP_STRIP);
+
+		if (ast_strlen_zero(value)) {
+			ast_log(LOG_WARNING, "Ignoring backend option '%s' without value for %s\n", name, url);
+		} else if (!strcasecmp(name, "weight")) {
+			backend->weight = atoi(value);
+		} else if (!strcasecmp(name, "max_sessions")) {
+			backend->max_sessions = atoi(value);
+		} else {
+			ast_log(LOG_WARNING, "Unknown backend option '%s' for %s\n", name, url);
+		}
+	}
+	if (backend->weight < 1) {
+		backend->weight = 1;
+	}
+	if (backend->max_sessions < 0) {
+		backend->max_sessions = 0;
+	}
+
+	return backend;
+}
+
+/** \brief Free a backend, its pool must already be stopped */
+static void vosk_backend_free(vosk_backend_t *backend)
+{
+	ast_free(backend->url);
+	ast_free(backend);
+}
+
+/** \brief Check whether a backend has room for a session, engine lock held */
+static int vosk_backend_has_room(vosk_engine_t *engine, vosk_backend_t *backend, struct timeval now)
+{
+	if (backend->max_sessions && backend->active >= backend->max_sessions) {
+		return 0;
+	}
+	return vosk_backend_available(engine, backend, now);
+}
+
+/** \brief Take a session slot on a backend, engine lock held */
+static void vosk_backend_reserve(vosk_backend_t *backend)
+{
+	backend->active++;
+	backend->total++;
+	vosk_backend_try_trial(backend);
+}
+
+/*!
+ * \brief Find the least loaded backend with room for a session, engine lock held
+ *
+ * Backends are compared by active sessions per unit of weight, skipping
+ * those at max_sessions, those their circuit breaker keeps out and the
+ * standby ones. The excluded backend is only chosen when no other one
+ * has room.
+ */
+static vosk_backend_t *vosk_backend_pick(vosk_engine_t *engine, vosk_backend_t *exclude, struct timeval now)
+{
+	vosk_backend_t *best = NULL;
+	size_t i;
+
+	for (i = 0; i < AST_VECTOR_SIZE(&engine->backends); i++) {
+		vosk_backend_t *backend = AST_VECTOR_GET(&engine->backends, i);
+
+		if (backend->standby || !vosk_backend_has_room(engine, backend, now)) {
+			continue;
+		}
+		if (best == exclude && backend != exclude) {
+			best = backend;
+			continue;
+		}
+		if (backend == exclude && best) {
+			continue;
+		}
+		/* active / weight < best->active / best->weight */
+		if (!best || (long) backend->active * best->weight < (long) best->active * backend->weight) {
+			best = backend;
+		}
+	}
+
+	return best;
+}
+
+/*!
+ * \brief Reserve a session slot on the least loaded backend
+ *
+ * See vosk_backend_pick. The slot is returned with vosk_backend_release.
+ * With every backend down this fails without touching the network.
+ */
+static vosk_backend_t *vosk_backend_acquire(vosk_engine_t *engine, vosk_backend_t *exclude)
+{
+	vosk_backend_t *best;
+
+	ast_mutex_lock(&engine->lock);
+	best = vosk_backend_pick(engine, exclude, ast_tvnow());
+	if (best) {
+		vosk_backend_reserve(best);
+	}
+	ast_mutex_unlock(&engine->lock);
+
+	return best;
+}
+
+/*!
+ * \brief Reserve a slot for a hedge of a session served by another backend
+ *
+ * The standby backend is preferred, otherwise the least loaded backend
+ * other than the one to hedge against.
+ */
+static vosk_backend_t *vosk_backend_acquire_hedge(vosk_engine_t *engine, vosk_backend_t *exclude)
+{
+	vosk_backend_t *best = NULL;
+	struct timeval now = ast_tvnow();
+	size_t i;
+
+	ast_mutex_lock(&engine->lock);
+	for (i = 0; i < AST_VECTOR_SIZE(&engine->backends); i++) {
+		vosk_backend_t *backend = AST_VECTOR_GET(&engine->backends, i);
+
+		if (backend == exclude || !vosk_backend_has_room(engine, backend, now)) {
+			continue;
+		}
+		if (best && best->standby != backend->standby) {
+			if (backend->standby) {
+				best = backend;
+			}
+			continue;
+		}
+		if (!best || (long) backend->active * best->weight < (long) best->active * backend->weight) {
+			best = backend;
+		}
+	}
+	if (best) {
+		vosk_backend_reserve(best);
+	}
+	ast_mutex_unlock(&engine->lock);
+
+	return best;
+}
+
+/** \brief Check whether any backend is up, its breaker not open, engine lock held */
+static int vosk_backends_up(vosk_engine_t *engine, struct timeval now)
+{
+	size_t i;
+
+	for (i = 0; i < AST_VECTOR_SIZE(&engine->backends); i++) {
+		vosk_backend_t *backend = AST_VECTOR_GET(&engine->backends, i);
+
+		if (!backend->standby && (backend->state != VOSK_BREAKER_OPEN || vosk_backend_available(engine, backend, now))) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*!
+ * \brief Take an engine slot and, in server mode, a backend slot, engine lock held
+ *
+ * Fails when the engine is at max_sessions or no backend has room.
+ */
+static int vosk_admission_try(vosk_engine_t *engine, vosk_backend_t **backend)
+{
+	if (engine->max_sessions && engine->sessions >= engine->max_sessions) {
+		return 0;
+	}
+	if (engine->mode == VOSK_MODE_SERVER) {
+		*backend = vosk_backend_pick(engine, NULL, ast_tvnow());
+		if (!*backend) {
+			return 0;
+		}
+		vosk_backend_reserve(*backend);
+	}
+	engine->sessions++;
+	return 1;
+}
+
+/** \brief Hand free slots to the sessions waiting longest, engine lock held */
+static void vosk_admission_grant(vosk_engine_t *engine)
+{
+	vosk_waiter_t *waiter;
+
+	while ((waiter = AST_LIST_FIRST(&engine->waiters)) && vosk_admission_try(engine, &waiter->backend)) {
+		AST_LIST_REMOVE_HEAD(&engine->waiters, list);
+		engine->waiting--;
+		waiter->admitted = 1;
+		ast_cond_signal(&waiter->cond);
+	}
+}
+
+/*!
+ * \brief Admit a new session, waiting for a slot if need be
+ *
+ * Runs on the channel thread of SpeechCreate. A session is admitted at
+ * once while the engine and a backend have room and nobody waits;
+ * otherwise it joins the FIFO queue for at most admission_timeout. A full
+ * queue, or every backend down, turns it away at once, so a burst costs
+ * the fleet nothing once it is saturated. In server mode the backend slot
+ * taken is returned in backend. Without queue nothing waits, a session
+ * that cannot be admitted at once is rejected. Admitted sessions end with
+ * vosk_admission_leave.
+ */
+static enum vosk_admission vosk_admission_enter(vosk_engine_t *engine, vosk_backend_t **backend, int queue)
+{
+	vosk_waiter_t waiter = { .admitted = 0 };
+	enum vosk_admission res;
+	struct timeval deadline;
+	struct timespec ts;
+
+	*backend = NULL;
+	ast_mutex_lock(&engine->lock);
+	/* Room that came up without a release, e.g. a breaker cooldown, goes to the queue first */
+	vosk_admission_grant(engine);
+	if (AST_LIST_EMPTY(&engine->waiters) && vosk_admission_try(engine, backend)) {
+		res = VOSK_ADMISSION_ADMITTED;
+	} else if (engine->mode == VOSK_MODE_SERVER && !vosk_backends_up(engine, ast_tvnow())) {
+		res = VOSK_ADMISSION_UNAVAILABLE;
+	} else if (!queue || engine->waiting >= engine->admission_queue || !engine->admission_timeout) {
+		res = VOSK_ADMISSION_REJECTED;
+	} else {
+		ast_cond_init(&waiter.cond, NULL);
+		AST_LIST_INSERT_TAIL(&engine->waiters, &waiter, list);
+		engine->waiting++;
+		deadline = ast_tvadd(ast_tvnow(), ast_samp2tv(engine->admission_timeout, 1000));
+		ts.tv_sec = deadline.tv_sec;
+		ts.tv_nsec = deadline.tv_usec * 1000;
+		while (!waiter.admitted && ast_tvdiff_ms(deadline, ast_tvnow()) > 0) {
+			ast_cond_timedwait(&waiter.cond, &engine->lock, &ts);
+		}
+		if (waiter.admitted) {
+			*backend = waiter.backend;
+			res = VOSK_ADMISSION_QUEUED;
+		} else {
+			AST_LIST_REMOVE(&engine->waiters, &waiter, list);
+			engine->waiting--;
+			res = VOSK_ADMISSION_TIMEOUT;
+		}
+		ast_cond_destroy(&waiter.cond);
+	}
+	engine->admissions[res]++;
+	ast_mutex_unlock(&engine->lock);
+
+	return res;
+}
+
+/** \brief Give back the engine slot of a session, the next waiting one may go */
+static void vosk_admission_leave(vosk_engine_t *engine)
+{
+	ast_mutex_lock(&engine->lock);
+	engine->sessions--;
+	vosk_admission_grant(engine);
+	ast_mutex_unlock(&engine->lock);
+}
+
+static const char *vosk_admission_str(enum vosk_admission admission)
+{
+	switch (admission) {
+	case VOSK_ADMISSION_ADMITTED:
+		return "ADMITTED";
+	case VOSK_ADMISSION_QUEUED:
+		return "QUEUED";
+	case VOSK_ADMISSION_REJECTED:
+		return "REJECTED";
+	case VOSK_ADMISSION_TIMEOUT:
+		return "TIMEOUT";
+	case VOSK_ADMISSION_UNAVAILABLE:
+		return "UNAVAILABLE";
+	case VOSK_ADMISSION_COUNT:
+		break;
+	}
+	return "unknown";
+}
+
+/*!
+ * \brief Last admission outcome of recent calls, for VOSK_ADMISSION()
+ *
+ * SpeechCreate does not get to see the channel, so the outcome is filed
+ * under the call id, the same way prewarmed connections are claimed. A
+ * note holds the call id in its upper half and the outcome plus one in
+ * its lower half; a later call only reuses the slot after
+ * VOSK_ADMISSION_NOTES others.
+ */
+static uint64_t vosk_admission_notes[VOSK_ADMISSION_NOTES];
+
+/*! \brief Note how admission went on the calling thread's call */
+static void vosk_admission_report(enum vosk_admission admission)
+{
+	ast_callid callid = ast_read_threadstorage_callid();
+
+	if (!callid) {
+		return;
+	}
+	__atomic_store_n(&vosk_admission_notes[callid & (VOSK_ADMISSION_NOTES - 1)],
+		(uint64_t) callid << 32 | (uint32_t) (admission + 1), __ATOMIC_RELEASE);
+}
+
+/*! \brief Admission outcome adopted by the channel, stored as the outcome plus one */
+static const struct ast_datastore_info vosk_admission_datastore = {
+	.type = "vosk_admission",
+};
+
+/*!
+ * \brief VOSK_ADMISSION() dialplan function
+ *
+ * The note of the channel's call moves into a datastore on the channel,
+ * so the outcome stays readable from any thread for as long as the
+ * channel lives, however many calls come after it.
+ */
+static int vosk_admission_read(struct ast_channel *chan, const char *cmd, char *data, char *buf, size_t len)
+{
+	struct ast_datastore *datastore;
+	ast_callid callid;
+	uint64_t note = 0;
+	uintptr_t admission = 0;
+
+	if (!chan) {
+		ast_log(LOG_WARNING, "%s requires a channel\n", cmd);
+		return -1;
+	}
+	ast_channel_lock(chan);
+	callid = ast_channel_callid(chan);
+	if (callid) {
+		note = __atomic_load_n(&vosk_admission_notes[callid & (VOSK_ADMISSION_NOTES - 1)], __ATOMIC_ACQUIRE);
+	}
+	datastore = ast_channel_datastore_find(chan, &vosk_admission_datastore, NULL);
+	if (note && note >> 32 == callid) {
+		admission = (uint32_t) note;
+		if (!datastore && (datastore = ast_datastore_alloc(&vosk_admission_datastore, NULL))
+			&& ast_channel_datastore_add(chan, datastore)) {
+			ast_datastore_free(datastore);
+			datastore = NULL;
+		}
+		if (datastore) {
+			datastore->data = (void *) admission;
+		}
+	} else if (datastore) {
+		admission = (uintptr_t) datastore->data;
+	}
+	ast_channel_unlock(chan);
+
+	*buf = '\0';
+	if (admission) {
+		ast_copy_string(buf, vosk_admission_str(admission - 1), len);
+	}
+	return 0;
+}
+
+static struct ast_custom_function vosk_admission_function = {
+	.name = "VOSK_ADMISSION",
+	.read = vosk_admission_read,
+};
+
+/** \brief Return a session slot taken with vosk_backend_acquire */
+static void vosk_backend_release(vosk_engine_t *engine, vosk_backend_t *backend)
+{
+	if (!backend) {
+		return;
+	}
+	ast_mutex_lock(&engine->lock);
+	backend->active--;
+	/* A trial that ended without a verdict lets the next one in */
+	if (backend->state == VOSK_BREAKER_HALF_OPEN) {
+		backend->trial = 0;
+	}
+	vosk_admission_grant(engine);
+	ast_mutex_unlock(&engine->lock);
+}
+
+/*!
+ * \brief Get a reference to the current session websocket
+ *
+ * The sender may swap the websocket on failover and destroy may close it,
+ * so threads other than the channel thread must use this.
+ */
+static struct ast_websocket *vosk_speech_get_ws(vosk_speech_t *vosk_speech)
+{
+	struct ast_websocket *ws;
+
+	ao2_lock(vosk_speech);
+	ws = vosk_speech->closed ? NULL : vosk_speech->ws;
+	if (ws) {
+		ast_websocket_ref(ws);
+	}
+	ao2_unlock(vosk_speech);
+
+	return ws;
+}
+
+/** \brief Get a reference to the hedge websocket of the session, if one runs */
+static struct ast_websocket *vosk_speech_get_hedge_ws(vosk_speech_t *vosk_speech)
+{
+	struct ast_websocket *ws;
+
+	ao2_lock(vosk_speech);
+	ws = vosk_speech->hedge_ws;
+	if (ws) {
+		ast_websocket_ref(ws);
+	}
+	ao2_unlock(vosk_speech);
+
+	return ws;
+}
+
+/*!
+ * \brief Message left over on a connection of the session, NULL if none
+ *
+ * Other threads must hold the connection's lock.
+ */
+static vosk_wsout_t *vosk_wsout_find(vosk_speech_t *vosk_speech, struct ast_websocket *ws)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_LEN(vosk_speech->out); i++) {
+		if (__atomic_load_n(&vosk_speech->out[i].ws, __ATOMIC_ACQUIRE) == ws) {
+			return &vosk_speech->out[i];
+		}
+	}
+	return NULL;
+}
+
+/** \brief Wall clock in milliseconds */
+static int64_t vosk_now_ms(void)
+{
+	return ast_tvdiff_ms(ast_tvnow(), ast_tv(0, 0));
+}
+
+/*!
+ * \brief Statistics the session reports to
+ *
+ * The backend may change on failover; backends live as long as the
+ * module, so a stale pointer is harmless.
+ */
+static vosk_stats_t *vosk_speech_stats(vosk_speech_t *vosk_speech)
+{
+	vosk_backend_t *backend = __atomic_load_n(&vosk_speech->backend, __ATOMIC_RELAXED);
+
+	return backend ? &backend->stats : &vosk_speech->engine->local_stats;
+}
+
+/** \brief Account audio handed to a recognizer */
+static void vosk_stats_count_audio(vosk_stats_t *stats, size_t len)
+{
+	__atomic_fetch_add(&stats->bytes, len, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->frames, 1, __ATOMIC_RELAXED);
+}
+
+/** \brief Account audio handed to the recognizer of the session */
+static void vosk_speech_count_audio(vosk_speech_t *vosk_speech, size_t len)
+{
+	vosk_stats_count_audio(vosk_speech_stats(vosk_speech), len);
+}
+
+/*!
+ * \brief Check whether the session takes a partial result now
+ *
+ * Partials only refresh last_result, so dropping the ones arriving
+ * faster than partial_rate loses nothing a final result does not bring.
+ */
+static int vosk_speech_partial_due(vosk_speech_t *vosk_speech)
+{
+	if (!vosk_speech->engine->partial_results) {
+		return 0;
+	}
+	return !vosk_speech->engine->partial_rate || ast_tvcmp(ast_tvnow(), vosk_speech->partial_next) >= 0;
+}
+
+/** \brief FNV-1a hash of a result text */
+static uint32_t vosk_result_hash(const char *text, size_t len)
+{
+	uint32_t hash = 2166136261u;
+
+	while (len--) {
+		hash = (hash ^ (unsigned char) *text++) * 16777619u;
+	}
+	return hash;
+}
+
+/*!
+ * \brief End the hedge of a session, one connection goes
+ *
+ * With promote set the hedge connection takes over the session and the
+ * first one goes, otherwise the hedge goes. The backend of the dropped
+ * connection is charged with failure, if given, and returned; NULL when
+ * no hedge was running. Backends outlive sessions, the pointer stays
+ * valid for statistics.
+ */
+static vosk_backend_t *vosk_hedge_end(vosk_speech_t *vosk_speech, int promote, const char *failure)
+{
+	struct ast_websocket *loser;
+	vosk_backend_t *loser_backend;
+
+	ao2_lock(vosk_speech);
+	if (!vosk_speech->hedge_ws) {
+		ao2_unlock(vosk_speech);
+		return NULL;
+	}
+	if (promote) {
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = vosk_speech };
+
+		loser = vosk_speech->ws;
+		loser_backend = vosk_speech->backend;
+		vosk_speech->ws = vosk_speech->hedge_ws;
+		vosk_speech->backend = vosk_speech->hedge_backend;
+		epoll_ctl(vosk_speech->reader->epfd, EPOLL_CTL_MOD, ast_websocket_fd(vosk_speech->ws), &ev);
+		/* The hedge only ever got the current utterance, only a reset still to send gets an answer to skip */
+		__atomic_store_n(&vosk_speech->discard, __atomic_load_n(&vosk_speech->reset, __ATOMIC_ACQUIRE) ? 1 : 0,
+			__ATOMIC_RELEASE);
+	} else {
+		loser = vosk_speech->hedge_ws;
+		loser_backend = vosk_speech->hedge_backend;
+	}
+	__atomic_store_n(&vosk_speech->hedge_ws, NULL, __ATOMIC_RELEASE);
+	vosk_speech->hedge_backend = NULL;
+	/* May already be gone if the reader hit an error */
+	epoll_ctl(vosk_speech->reader->epfd, EPOLL_CTL_DEL, ast_websocket_fd(loser), NULL);
+	ao2_unlock(vosk_speech);
+
+	if (failure) {
+		vosk_backend_failure(vosk_speech->engine, loser_backend, failure);
+	}
+	vosk_disconnect(loser);
+	vosk_backend_release(vosk_speech->engine, loser_backend);
+
+	return loser_backend;
+}
+
+/*!
+ * \brief Process a message received from the recognizer
+ *
+ * Runs on a reader or decoder thread. The speech state is not touched
+ * here, a final result only raises the done flag which vosk_recog_write
+ * acts upon. The message is scanned into the session's scratch result,
+ * which only ever has one such thread at a time, and copied into
+ * last_result under the object lock; nothing is allocated.
+ *
+ * While a hedge runs, hedge is set for messages of the hedge connection.
+ * Partials of both connections are taken, the first final result ends
+ * the race and the other connection.
+ */
+static void vosk_speech_handle_result(vosk_speech_t *vosk_speech, const char *res, size_t len, int hedge)
+{
+	vosk_result_t *result = &vosk_speech->scan;
+	uint32_t hash;
+	int finalized;
+
+	ast_debug(3, "(%s) Got result: '%.*s'\n", vosk_speech->name, (int) len, res);
+	if (vosk_result_scan(result, res, len)) {
+		ast_log(LOG_ERROR, "(%s) Malformed result: '%.*s'\n", vosk_speech->name, (int) len, res);
+		return;
+	}
+
+	if (hedge) {
+		/* The hedge covers a single utterance, once the next one started it has nothing to say */
+		if (__atomic_load_n(&vosk_speech->reset, __ATOMIC_ACQUIRE)) {
+			return;
+		}
+	} else if (__atomic_load_n(&vosk_speech->discard, __ATOMIC_ACQUIRE)) {
+		/* Audio of a previous utterance, the final result answering its reset closes it */
+		if (result->kind == VOSK_RESULT_TEXT) {
+			ast_atomic_fetch_sub(&vosk_speech->discard, 1, __ATOMIC_ACQ_REL);
+		}
+		return;
+	}
+
+	/* An empty final result recognized nothing, it does not end the wait for words */
+	if (result->kind == VOSK_RESULT_PARTIAL || (result->kind == VOSK_RESULT_TEXT && result->text_len)) {
+		int64_t start = __atomic_load_n(&vosk_speech->speech_onset, __ATOMIC_ACQUIRE);
+		if (start > 0 && __atomic_compare_exchange_n(&vosk_speech->speech_onset, &start, -1,
+			0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			vosk_hist_record(&vosk_speech_stats(vosk_speech)->first_partial, MAX(vosk_now_ms() - start, 0));
+		}
+	}
+
+	switch (result->kind) {
+	case VOSK_RESULT_PARTIAL:
+		if (!vosk_speech_partial_due(vosk_speech)) {
+			break;
+		}
+		/* Recognizers repeat the same partial until the next word settles */
+		hash = vosk_result_hash(result->text, result->text_len);
+		if (hash == vosk_speech->partial_hash) {
+			break;
+		}
+		vosk_speech->partial_hash = hash;
+		if (vosk_speech->engine->partial_rate) {
+			vosk_speech->partial_next = ast_tvadd(ast_tvnow(), ast_samp2tv(1, vosk_speech->engine->partial_rate));
+		}
+		ast_verb(4, "(%s) Partial recognition result: %s\n", vosk_speech->name, result->text);
+		ao2_lock(vosk_speech);
+		memcpy(vosk_speech->last_result, result->text, result->text_len + 1);
+		/* Partials carry no confidence */
+		vosk_speech->last_conf = 1.0;
+		ao2_unlock(vosk_speech);
+		break;
+	case VOSK_RESULT_TEXT:
+		/* An empty final result still ends a finalized utterance */
+		finalized = __atomic_exchange_n(&vosk_speech->finalizing, 0, __ATOMIC_ACQ_REL);
+		vosk_speech->partial_hash = 0;
+		if (result->text_len || finalized) {
+			int64_t last_speech = __atomic_load_n(&vosk_speech->last_speech, __ATOMIC_ACQUIRE);
+			vosk_backend_t *backend = __atomic_load_n(hedge ? &vosk_speech->hedge_backend : &vosk_speech->backend,
+				__ATOMIC_RELAXED);
+
+			if (last_speech) {
+				int64_t latency = MAX(vosk_now_ms() - last_speech, 0);
+
+				vosk_hist_record(backend ? &backend->stats.final_latency : &vosk_speech_stats(vosk_speech)->final_latency,
+					latency);
+				if (vosk_speech->engine->breaker_latency && latency > vosk_speech->engine->breaker_latency) {
+					vosk_backend_failure(vosk_speech->engine, backend, "slow result");
+				} else {
+					vosk_backend_success(vosk_speech->engine, backend, 1);
+				}
+			}
+			ast_verb(4, "(%s) Recognition result: %s\n", vosk_speech->name, result->text);
+			ao2_lock(vosk_speech);
+			memcpy(vosk_speech->last_result, result->text, result->text_len + 1);
+			vosk_speech->last_conf = result->words ? result->conf : 1.0;
+			ao2_unlock(vosk_speech);
+			if (__atomic_load_n(&vosk_speech->hedge_ws, __ATOMIC_ACQUIRE)) {
+				vosk_backend_t *loser = vosk_hedge_end(vosk_speech, hedge, NULL);
+
+				if (hedge && loser) {
+					__atomic_fetch_add(&loser->stats.hedge_wins, 1, __ATOMIC_RELAXED);
+					ast_verb(4, "(%s) Hedge on %s answered before %s\n", vosk_speech->name, backend->url, loser->url);
+				}
+			}
+			__atomic_store_n(&vosk_speech->done, 1, __ATOMIC_RELEASE);
+		}
+		break;
+	case VOSK_RESULT_NONE:
+		break;
+	}
+}
+
+static void vosk_sender_kick(vosk_speech_t *vosk_speech);
+static vosk_prewarm_t *vosk_prewarm_new(vosk_engine_t *engine, ast_callid callid);
+static void vosk_prewarm_connect(vosk_prewarm_t *prewarm);
+static void vosk_hedge_cancel(vosk_speech_t *vosk_speech);
+
+/*!
+ * \brief Give up on a session from a helper thread
+ *
+ * No more audio is sent and the channel thread ends the recognition with
+ * whatever result arrived so far.
+ */
+static void vosk_speech_fail(vosk_speech_t *vosk_speech, const char *reason)
+{
+	if (__atomic_exchange_n(&vosk_speech->failed, 1, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+	ast_log(LOG_WARNING, "(%s) Recognition failed: %s\n", vosk_speech->name, reason);
+	__atomic_store_n(&vosk_speech->done, 1, __ATOMIC_RELEASE);
+}
+
+/*!
+ * \brief Handle the loss of the session connection
+ *
+ * Reader thread. When the session can fail over, the sender moves it to
+ * a new connection and replays the utterance. Otherwise recognition ends
+ * now instead of waiting for a result that cannot come. A connection the
+ * sender already replaced is no news.
+ */
+static void vosk_speech_lost(vosk_speech_t *vosk_speech, struct ast_websocket *ws)
+{
+	int current;
+
+	ao2_lock(vosk_speech);
+	current = !vosk_speech->closed && vosk_speech->ws == ws;
+	ao2_unlock(vosk_speech);
+	if (!current || __atomic_load_n(&vosk_speech->failed, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	if (vosk_speech->engine->replay_buffer || vosk_speech->engine->overflow_policy == VOSK_OVERFLOW_FAILOVER) {
+		/* The sender may have noticed first, the backend failed only once */
+		if (!__atomic_exchange_n(&vosk_speech->failover, 1, __ATOMIC_ACQ_REL)) {
+			vosk_backend_failure(vosk_speech->engine, __atomic_load_n(&vosk_speech->backend, __ATOMIC_RELAXED),
+				"connection lost");
+		}
+		vosk_sender_kick(vosk_speech);
+	} else {
+		vosk_backend_failure(vosk_speech->engine, __atomic_load_n(&vosk_speech->backend, __ATOMIC_RELAXED),
+			"connection lost");
+		vosk_speech_fail(vosk_speech, "connection to server lost");
+	}
+}
+
+/*!
+ * \brief Drain every message pending on a session socket
+ *
+ * The websocket stream buffers input, so a single readiness event may
+ * carry several messages; keep reading while the stream reports data.
+ * Messages are handled straight from the websocket's own payload buffer.
+ * The event may be older than a hedge that ended or took over in the
+ * same batch, so nothing is read from a quiet socket.
+ *
+ * Reading may answer a ping, which must not land in the middle of a frame
+ * the sender left unfinished. The connection stays locked while reading,
+ * and one with such a frame is not watched until the sender wrote it.
+ */
+static void vosk_speech_read_results(vosk_reader_t *reader, vosk_speech_t *vosk_speech, int hedge)
+{
+	struct ast_websocket *ws;
+	enum ast_websocket_opcode opcode;
+	struct epoll_event ev = { .events = 0 };
+	vosk_wsout_t *out;
+	uint64_t payload_len;
+	char *payload;
+	int fragmented;
+
+	ws = hedge ? vosk_speech_get_hedge_ws(vosk_speech) : vosk_speech_get_ws(vosk_speech);
+	if (!ws) {
+		return;
+	}
+
+	ao2_lock(ws);
+	if ((out = vosk_wsout_find(vosk_speech, ws))) {
+		out->deferred = (void *) ((uintptr_t) vosk_speech | (hedge ? VOSK_HEDGE_TAG : 0));
+		ev.data.ptr = out->deferred;
+		epoll_ctl(reader->epfd, EPOLL_CTL_MOD, ast_websocket_fd(ws), &ev);
+		ao2_unlock(ws);
+		ast_websocket_unref(ws);
+		return;
+	}
+	while (ast_websocket_wait_for_input(ws, 0) > 0) {
+		if (ast_websocket_read(ws, &payload, &payload_len, &opcode, &fragmented)
+			|| opcode == AST_WEBSOCKET_OPCODE_CLOSE) {
+			/* Stop watching a dead socket, it would keep the set busy */
+			epoll_ctl(reader->epfd, EPOLL_CTL_DEL, ast_websocket_fd(ws), NULL);
+			if (hedge) {
+				ast_log(LOG_NOTICE, "(%s) Hedge connection lost\n", vosk_speech->name);
+				vosk_hedge_end(vosk_speech, 0, "connection lost");
+			} else {
+				ast_log(LOG_NOTICE, "(%s) Connection to server lost\n", vosk_speech->name);
+				vosk_speech_lost(vosk_speech, ws);
+			}
+			break;
+		}
+		/* The hedge may have ended or taken over the session meanwhile */
+		if (hedge && __atomic_load_n(&vosk_speech->hedge_ws, __ATOMIC_ACQUIRE) != ws) {
+			if (__atomic_load_n(&vosk_speech->ws, __ATOMIC_ACQUIRE) != ws) {
+				break;
+			}
+			hedge = 0;
+		}
+		/* Fragments are reassembled by the websocket, wait for the whole message */
+		if (opcode == AST_WEBSOCKET_OPCODE_TEXT && !fragmented) {
+			vosk_speech_handle_result(vosk_speech, payload, payload_len, hedge);
+		}
+	}
+	ao2_unlock(ws);
+
+	ast_websocket_unref(ws);
+}
+
+/** \brief Result reader thread */
+static void *vosk_reader_thread(void *data)
+{
+	vosk_reader_t *reader = data;
+	struct epoll_event events[VOSK_READER_EVENTS];
+	struct vosk_speech_list released;
+	vosk_speech_t *vosk_speech;
+	uint64_t count;
+	int i, n;
+
+	while (!__atomic_load_n(&reader->stop, __ATOMIC_ACQUIRE)) {
+		n = epoll_wait(reader->epfd, events, VOSK_READER_EVENTS, -1);
+		if (n < 0 && errno != EINTR) {
+			ast_log(LOG_ERROR, "epoll_wait failed: %s\n", strerror(errno));
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (!events[i].data.ptr) {
+				if (read(reader->wakefd, &count, sizeof(count)) < 0) {
+					/* Nothing to consume, another wakeup raced us */
+				}
+				continue;
+			}
+			vosk_speech_read_results(reader,
+				(vosk_speech_t *) ((uintptr_t) events[i].data.ptr & ~VOSK_HEDGE_TAG),
+				(uintptr_t) events[i].data.ptr & VOSK_HEDGE_TAG);
+		}
+
+		/* Every event of this batch is handled, drop unregistered sessions */
+		ast_mutex_lock(&reader->lock);
+		released = reader->released;
+		AST_LIST_HEAD_INIT_NOLOCK(&reader->released);
+		ast_mutex_unlock(&reader->lock);
+		while ((vosk_speech = AST_LIST_REMOVE_HEAD(&released, released))) {
+			ao2_ref(vosk_speech, -1);
+		}
+	}
+
+	return NULL;
+}
+
+/** \brief Wake up a reader thread */
+static void vosk_reader_wake(vosk_reader_t *reader)
+{
+	uint64_t one = 1;
+
+	if (write(reader->wakefd, &one, sizeof(one)) < 0) {
+		ast_log(LOG_WARNING, "Failed to wake result reader: %s\n", strerror(errno));
+	}
+}
+
+/** \brief Start result reader threads */
+static int vosk_readers_start(void)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	int i;
+
+	if (vosk_reader_count < 1) {
+		vosk_reader_count = 1;
+	}
+	vosk_readers = ast_calloc(vosk_reader_count, sizeof(*vosk_readers));
+	if (!vosk_readers) {
+		return -1;
+	}
+
+	for (i = 0; i < vosk_reader_count; i++) {
+		vosk_reader_t *reader = &vosk_readers[i];
+
+		reader->thread = AST_PTHREADT_NULL;
+		reader->epfd = -1;
+		reader->wakefd = -1;
+		ast_mutex_init(&reader->lock);
+		AST_LIST_HEAD_INIT_NOLOCK(&reader->released);
+	}
+
+	for (i = 0; i < vosk_reader_count; i++) {
+		vosk_reader_t *reader = &vosk_readers[i];
+
+		reader->epfd = epoll_create1(EPOLL_CLOEXEC);
+		reader->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (reader->epfd < 0 || reader->wakefd < 0
+			|| epoll_ctl(reader->epfd, EPOLL_CTL_ADD, reader->wakefd, &ev)
+			|| ast_pthread_create_background(&reader->thread, NULL, vosk_reader_thread, reader)) {
+			ast_log(LOG_ERROR, "Failed to start result reader %d\n", i);
+			reader->thread = AST_PTHREADT_NULL;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** \brief Stop result reader threads, all sessions must be gone */
+static void vosk_readers_stop(void)
+{
+	vosk_speech_t *vosk_speech;
+	int i;
+
+	if (!vosk_readers) {
+		return;
+	}
+	for (i = 0; i < vosk_reader_count; i++) {
+		vosk_reader_t *reader = &vosk_readers[i];
+
+		if (reader->thread != AST_PTHREADT_NULL) {
+			__atomic_store_n(&reader->stop, 1, __ATOMIC_RELEASE);
+			vosk_reader_wake(reader);
+			pthread_join(reader->thread, NULL);
+		}
+		while ((vosk_speech = AST_LIST_REMOVE_HEAD(&reader->released, released))) {
+			ao2_ref(vosk_speech, -1);
+		}
+		if (reader->epfd >= 0) {
+			close(reader->epfd);
+		}
+		if (reader->wakefd >= 0) {
+			close(reader->wakefd);
+		}
+		ast_mutex_destroy(&reader->lock);
+	}
+	ast_free(vosk_readers);
+	vosk_readers = NULL;
+}
+
+/** \brief Start watching the session socket for results */
+static int vosk_reader_register(vosk_speech_t *vosk_speech)
+{
+	unsigned int idx = ast_atomic_fetch_add(&vosk_reader_next, 1, __ATOMIC_RELAXED);
+	vosk_reader_t *reader = &vosk_readers[idx % vosk_reader_count];
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = vosk_speech };
+
+	ao2_ref(vosk_speech, +1);
+	vosk_speech->reader = reader;
+	if (epoll_ctl(reader->epfd, EPOLL_CTL_ADD, ast_websocket_fd(vosk_speech->ws), &ev)) {
+		ast_log(LOG_ERROR, "(%s) Failed to watch websocket: %s\n", vosk_speech->name, strerror(errno));
+		vosk_speech->reader = NULL;
+		ao2_ref(vosk_speech, -1);
+		return -1;
+	}
+	return 0;
+}
+
+/** \brief Watch a new websocket of the session instead of the old one */
+static int vosk_reader_move(vosk_speech_t *vosk_speech, struct ast_websocket *old_ws, struct ast_websocket *new_ws)
+{
+	vosk_reader_t *reader = vosk_speech->reader;
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = vosk_speech };
+
+	/* May already be gone if the reader hit an error */
+	epoll_ctl(reader->epfd, EPOLL_CTL_DEL, ast_websocket_fd(old_ws), NULL);
+	if (epoll_ctl(reader->epfd, EPOLL_CTL_ADD, ast_websocket_fd(new_ws), &ev)) {
+		ast_log(LOG_ERROR, "(%s) Failed to watch websocket: %s\n", vosk_speech->name, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/** \brief Stop watching the session socket, the reader drops its reference later */
+static void vosk_reader_unregister(vosk_speech_t *vosk_speech, struct ast_websocket *ws)
+{
+	vosk_reader_t *reader = vosk_speech->reader;
+
+	if (!reader) {
+		return;
+	}
+	vosk_speech->reader = NULL;
+	/* May already be gone if the reader hit an error */
+	epoll_ctl(reader->epfd, EPOLL_CTL_DEL, ast_websocket_fd(ws), NULL);
+
+	ast_mutex_lock(&reader->lock);
+	AST_LIST_INSERT_TAIL(&reader->released, vosk_speech, released);
+	ast_mutex_unlock(&reader->lock);
+	vosk_reader_wake(reader);
+}
+
+/** \brief Destructor of the speech structure, runs with the last reference */
+static void vosk_speech_destructor(void *obj)
+{
+	vosk_speech_t *vosk_speech = obj;
+	int i;
+
+	if (vosk_speech->ws) {
+		ast_websocket_unref(vosk_speech->ws);
+	}
+	for (i = 0; i < ARRAY_LEN(vosk_speech->out); i++) {
+		if (vosk_speech->out[i].ws) {
+			ast_websocket_unref(vosk_speech->out[i].ws);
+		}
+		ast_free(vosk_speech->out[i].buf);
+	}
+	if (vosk_speech->hedge_conn) {
+		ao2_ref(vosk_speech->hedge_conn, -1);
+	}
+	if (vosk_speech->admitted) {
+		vosk_admission_leave(vosk_speech->engine);
+	}
+	ast_free(vosk_speech->convert_buf);
+	ast_free(vosk_speech->replay.data);
+	vosk_ring_free(&vosk_speech->preroll);
+	vosk_ring_free(&vosk_speech->ring);
+#ifdef HAVE_VOSK_API
+	if (vosk_speech->recognizer) {
+		vosk_recognizer_free(vosk_speech->recognizer);
+	}
+	if (vosk_speech->batch_recognizer) {
+		/* Only ever reached on the scheduler thread, see vosk_batch_close */
+		vosk_batch_recognizer_free(vosk_speech->batch_recognizer);
+	}
+	if (vosk_speech->batch_retired) {
+		vosk_batch_recognizer_free(vosk_speech->batch_retired);
+	}
+#endif
+}
+
+/** \brief Build the frame header of a client message, returns its size */
+static size_t vosk_ws_header(uint8_t *header, enum ast_websocket_opcode opcode, size_t len, uint32_t key)
+{
+	size_t size = 2;
+	int i;
+
+	header[0] = 0x80 | opcode;
+	if (len < 126) {
+		header[1] = len;
+	} else if (len < 65536) {
+		header[1] = 126;
+		header[2] = len >> 8;
+		header[3] = len;
+		size += 2;
+	} else {
+		header[1] = 127;
+		for (i = 0; i < 8; i++) {
+			header[2 + i] = (uint64_t) len >> (56 - 8 * i);
+		}
+		size += 8;
+	}
+	/* Clients mask every frame */
+	header[1] |= 0x80;
+	memcpy(header + size, &key, sizeof(key));
+	return size + sizeof(key);
+}
+
+/*!
+ * \brief Write as much of the pieces as the socket takes right now
+ *
+ * The pieces are advanced past what was written. Returns the bytes taken
+ * or -1.
+ */
+static ssize_t vosk_ws_write_nowait(int fd, struct iovec *iov, int count)
+{
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = count };
+	size_t taken = 0;
+	ssize_t res;
+
+	while (msg.msg_iovlen) {
+		res = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno == EAGAIN || errno == EWOULDBLOCK ? (ssize_t) taken : -1;
+		}
+		taken += res;
+		for (; msg.msg_iovlen && (size_t) res >= msg.msg_iov->iov_len; msg.msg_iovlen--, msg.msg_iov++) {
+			res -= msg.msg_iov->iov_len;
+			msg.msg_iov->iov_len = 0;
+		}
+		if (msg.msg_iovlen) {
+			msg.msg_iov->iov_base = (char *) msg.msg_iov->iov_base + res;
+			msg.msg_iov->iov_len -= res;
+		}
+	}
+	return taken;
+}
+
+/*!
+ * \brief Keep bytes a connection did not take, behind what it has left already
+ *
+ * Sender thread, with the connection locked unless nothing of the bytes
+ * was written. Returns -1 when they cannot be kept.
+ */
+static int vosk_wsout_queue(vosk_speech_t *vosk_speech, struct ast_websocket *ws, const char *data, size_t len)
+{
+	vosk_wsout_t *out = vosk_wsout_find(vosk_speech, ws);
+
+	if (!out && !(out = vosk_wsout_find(vosk_speech, NULL))) {
+		return -1;
+	}
+	if (out->len + len > out->size && out->pos) {
+		memmove(out->buf, out->buf + out->pos, out->len - out->pos);
+		out->len -= out->pos;
+		out->pos = 0;
+	}
+	if (out->len + len > out->size) {
+		size_t size = MAX(out->size * 2, out->len + len);
+		char *buf = ast_realloc(out->buf, size);
+
+		if (!buf) {
+			return -1;
+		}
+		out->buf = buf;
+		out->size = size;
+	}
+	memcpy(out->buf + out->len, data, len);
+	out->len += len;
+	if (!out->ws) {
+		ast_websocket_ref(ws);
+		__atomic_store_n(&out->ws, ws, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+/*!
+ * \brief Forget what is left for a connection, with the connection locked
+ *
+ * The reader watches the connection again. Returns the connection, whose
+ * reference the caller drops once it let go of the lock.
+ */
+static struct ast_websocket *vosk_wsout_release(vosk_speech_t *vosk_speech, vosk_wsout_t *out)
+{
+	struct ast_websocket *ws = out->ws;
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = out->deferred };
+	int fd = ast_websocket_fd(ws);
+
+	if (out->deferred && fd >= 0) {
+		epoll_ctl(vosk_speech->reader->epfd, EPOLL_CTL_MOD, fd, &ev);
+	}
+	out->deferred = NULL;
+	out->pos = 0;
+	out->len = 0;
+	__atomic_store_n(&out->ws, NULL, __ATOMIC_RELEASE);
+	return ws;
+}
+
+/*!
+ * \brief Drop what is left for connections the session no longer uses
+ *
+ * Sender thread, once failovers and hedges changed the connections. The
+ * reader does not watch them any more.
+ */
+static void vosk_wsout_prune(vosk_speech_t *vosk_speech)
+{
+	struct ast_websocket *ws;
+	vosk_wsout_t *out;
+	int i, used;
+
+	for (i = 0; i < ARRAY_LEN(vosk_speech->out); i++) {
+		out = &vosk_speech->out[i];
+		if (!(ws = out->ws)) {
+			continue;
+		}
+		ao2_lock(vosk_speech);
+		used = ws == vosk_speech->ws || ws == vosk_speech->hedge_ws;
+		ao2_unlock(vosk_speech);
+		if (!used && vosk_speech->hedge_conn) {
+			ao2_lock(vosk_speech->hedge_conn);
+			used = ws == vosk_speech->hedge_conn->ws;
+			ao2_unlock(vosk_speech->hedge_conn);
+		}
+		if (used) {
+			continue;
+		}
+		ao2_lock(ws);
+		out->deferred = NULL;
+		vosk_wsout_release(vosk_speech, out);
+		ao2_unlock(ws);
+		ast_websocket_unref(ws);
+	}
+}
+
+/*!
+ * \brief Write what is left for a connection as far as it takes it now
+ *
+ * Sender thread, with the connection locked. Once all of it is out the
+ * connection is handed back to the reader and returned in done, for the
+ * caller to drop after unlocking. Returns 0 once all of it is out, 1 when
+ * some is left, or -1 on a write error.
+ */
+static int vosk_wsout_write(vosk_speech_t *vosk_speech, vosk_wsout_t *out, int fd, struct ast_websocket **done)
+{
+	struct iovec rest = { .iov_base = out->buf + out->pos, .iov_len = out->len - out->pos };
+	ssize_t taken = vosk_ws_write_nowait(fd, &rest, 1);
+
+	if (taken < 0) {
+		return -1;
+	}
+	if ((out->pos += taken) < out->len) {
+		return 1;
+	}
+	*done = vosk_wsout_release(vosk_speech, out);
+	return 0;
+}
+
+/*!
+ * \brief Write what is left for the connections of the session, sender thread
+ *
+ * Runs on every pass, so the rest of a message goes out even when nothing
+ * else follows it. A connection whose lock the reader holds waits for the
+ * next pass; one that fails is closed and handed back to the reader,
+ * which fails it over.
+ */
+static void vosk_wsout_flush(vosk_speech_t *vosk_speech)
+{
+	struct ast_websocket *ws, *done;
+	vosk_wsout_t *out;
+	int i, fd;
+
+	for (i = 0; i < ARRAY_LEN(vosk_speech->out); i++) {
+		out = &vosk_speech->out[i];
+		if (!(ws = out->ws) || ao2_trylock(ws)) {
+			continue;
+		}
+		done = NULL;
+		fd = ast_websocket_fd(ws);
+		if (fd < 0 || vosk_wsout_write(vosk_speech, out, fd, &done) < 0) {
+			ast_websocket_close(ws, 1011);
+			done = vosk_wsout_release(vosk_speech, out);
+		}
+		ao2_unlock(ws);
+		if (done) {
+			ast_websocket_unref(done);
+		}
+	}
+}
+
+/** \brief Whether a connection of the session has bytes left, sender thread */
+static int vosk_wsout_pending(vosk_speech_t *vosk_speech)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_LEN(vosk_speech->out); i++) {
+		if (vosk_speech->out[i].ws) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*!
+ * \brief Send a message on a connection of the session without waiting
+ *
+ * Sender thread. The frame header goes out in front of the payload with
+ * one vectored write, and the payload is masked where it lies instead of
+ * being copied into a frame. Unless the caller keeps the payload, it is
+ * left masked once the message was taken; otherwise it is unmasked again
+ * afterwards.
+ *
+ * What the socket does not take is copied and goes first on the next
+ * pass of the session. Meanwhile text messages queue up behind it and
+ * audio is refused, so that audio keeps waiting in the ring and its
+ * overflow policy still applies. The connection's lock is only tried:
+ * while the reader holds it, audio waits for the next pass and text
+ * queues up. TLS streams do their own writing and take the stock path.
+ *
+ * \return 0 when the message was taken, 1 when audio has to wait, -1 on
+ *         a write error
+ */
+static int vosk_ws_send(vosk_speech_t *vosk_speech, struct ast_websocket *ws,
+	enum ast_websocket_opcode opcode, struct iovec *payload, int count, int keep)
+{
+	struct ast_websocket *done = NULL;
+	vosk_wsout_t *out;
+	uint8_t header[VOSK_FRAME_HEADER_MAX];
+	struct iovec iov[3];
+	size_t len = 0, size, offset;
+	ssize_t taken;
+	uint32_t key;
+	int audio = opcode == AST_WEBSOCKET_OPCODE_BINARY;
+	int fd = -1, n, locked, masked = 0, res = 0;
+
+	for (n = 0; n < count; n++) {
+		len += payload[n].iov_len;
+	}
+
+	if (ast_websocket_is_secure(ws)) {
+		char *frame = vosk_speech->sender->buf;
+
+		if (audio && ast_wait_for_output(ast_websocket_fd(ws), 0) <= 0) {
+			return 1;
+		}
+		if (count == 1) {
+			return ast_websocket_write(ws, opcode, payload[0].iov_base, len) ? -1 : 0;
+		}
+		for (n = 0, size = 0; n < count; n++) {
+			memcpy(frame + size, payload[n].iov_base, payload[n].iov_len);
+			size += payload[n].iov_len;
+		}
+		return ast_websocket_write(ws, opcode, frame, len) ? -1 : 0;
+	}
+
+	key = ast_random();
+	size = vosk_ws_header(header, opcode, len, key);
+	iov[0].iov_base = header;
+	iov[0].iov_len = size;
+	memcpy(iov + 1, payload, count * sizeof(*payload));
+
+	locked = !ao2_trylock(ws);
+	if (!locked) {
+		/* The reader is at it, nothing gets written */
+		if (audio) {
+			return 1;
+		}
+	} else if ((fd = ast_websocket_fd(ws)) < 0) {
+		res = -1;
+	} else if ((out = vosk_wsout_find(vosk_speech, ws))) {
+		/* The rest of earlier messages goes first */
+		res = vosk_wsout_write(vosk_speech, out, fd, &done);
+		if (res > 0) {
+			if (audio) {
+				ao2_unlock(ws);
+				return 1;
+			}
+			res = 0;
+			fd = -1;
+		}
+	}
+
+	if (!res) {
+		for (n = 0, offset = 0; n < count; offset += payload[n].iov_len, n++) {
+			vosk_dsp_mask(payload[n].iov_base, payload[n].iov_len, (const uint8_t *) &key, offset);
+		}
+		masked = 1;
+		/* Without a usable socket right now the whole frame is kept */
+		taken = fd < 0 ? 0 : vosk_ws_write_nowait(fd, iov, count + 1);
+		if (taken < 0) {
+			res = -1;
+		}
+		for (n = 0; !res && n <= count; n++) {
+			if (iov[n].iov_len && vosk_wsout_queue(vosk_speech, ws, iov[n].iov_base, iov[n].iov_len)) {
+				res = -1;
+			}
+		}
+	}
+	if (locked) {
+		if (res < 0) {
+			/* The stream may hold part of a frame, nothing can follow it */
+			ast_websocket_close(ws, 1011);
+		}
+		ao2_unlock(ws);
+	}
+	if (done) {
+		ast_websocket_unref(done);
+	}
+	if (masked && (keep || res)) {
+		for (n = 0, offset = 0; n < count; offset += payload[n].iov_len, n++) {
+			vosk_dsp_mask(payload[n].iov_base, payload[n].iov_len, (const uint8_t *) &key, offset);
+		}
+	}
+	return res;
+}
+
+/** \brief Send a text message on a connection of the session, see vosk_ws_send */
+static int vosk_ws_send_text(vosk_speech_t *vosk_speech, struct ast_websocket *ws, const char *text)
+{
+	struct iovec payload = { .iov_base = vosk_speech->sender->buf, .iov_len = strlen(text) };
+	int res;
+
+	/* Text is masked in a copy, only ever the configuration outgrows the sender's buffer */
+	if (payload.iov_len > sizeof(vosk_speech->sender->buf) && !(payload.iov_base = ast_malloc(payload.iov_len))) {
+		return -1;
+	}
+	memcpy(payload.iov_base, text, payload.iov_len);
+	res = vosk_ws_send(vosk_speech, ws, AST_WEBSOCKET_OPCODE_TEXT, &payload, 1, 0);
+	if (payload.iov_base != vosk_speech->sender->buf) {
+		ast_free(payload.iov_base);
+	}
+	return res;
+}
+
+/*!
+ * \brief Keep audio about to be sent from the front of the ring for replay
+ *
+ * Copied before the send masks it in place. The buffer grows as the
+ * utterance does, up to replay_buffer.
+ */
+static void vosk_replay_keep(vosk_speech_t *vosk_speech, size_t len)
+{
+	vosk_replay_t *replay = &vosk_speech->replay;
+	size_t limit = (size_t) vosk_speech->engine->replay_buffer * vosk_speech->bytes_per_ms;
+
+	if (!limit || replay->overflow) {
+		return;
+	}
+	if (replay->len + len > limit) {
+		ast_debug(1, "(%s) Utterance too long to replay\n", vosk_speech->name);
+		replay->overflow = 1;
+		replay->len = 0;
+		return;
+	}
+	if (replay->len + len > replay->size) {
+		size_t size = MIN(limit, MAX(replay->size * 2, replay->len + len));
+		char *data = ast_realloc(replay->data, size);
+
+		if (!data) {
+			replay->overflow = 1;
+			replay->len = 0;
+			return;
+		}
+		replay->data = data;
+		replay->size = size;
+	}
+	replay->len += vosk_ring_peek(&vosk_speech->ring, replay->data + replay->len, len);
+}
+
+/** \brief Take back audio kept for replay whose send failed, it stays queued */
+static void vosk_replay_unkeep(vosk_speech_t *vosk_speech, size_t len)
+{
+	if (!vosk_speech->replay.overflow) {
+		vosk_speech->replay.len -= MIN(len, vosk_speech->replay.len);
+	}
+}
+
+/** \brief Start over with the next utterance */
+static void vosk_replay_clear(vosk_speech_t *vosk_speech)
+{
+	vosk_speech->replay.len = 0;
+	vosk_speech->replay.overflow = 0;
+	vosk_speech->replay.pending = 0;
+	vosk_speech->replay.pos = 0;
+}
+
+/*!
+ * \brief Send the kept audio from pos on, as far as the connection takes it now
+ *
+ * Messages have the usual size. Returns 0 once all of it is taken, 1
+ * when the connection has to catch up first and the rest waits for the
+ * next pass, or -1 on a write error.
+ */
+static int vosk_replay_step(vosk_speech_t *vosk_speech, struct ast_websocket *ws, size_t *pos, vosk_stats_t *stats)
+{
+	vosk_replay_t *replay = &vosk_speech->replay;
+	struct iovec chunk;
+	int res;
+
+	while (*pos < replay->len) {
+		chunk.iov_base = replay->data + *pos;
+		chunk.iov_len = MIN(vosk_speech->chunk_bytes, replay->len - *pos);
+		res = vosk_ws_send(vosk_speech, ws, AST_WEBSOCKET_OPCODE_BINARY, &chunk, 1, 1);
+		if (res) {
+			return res;
+		}
+		vosk_stats_count_audio(stats, chunk.iov_len);
+		*pos += chunk.iov_len;
+	}
+	return 0;
+}
+
+/*!
+ * \brief Move a session to a new connection
+ *
+ * Runs on the sender thread and prefers another backend. When the audio
+ * of the current utterance is at hand the sender replays it at full speed
+ * on its next passes, as fast as the socket takes it; the queued audio
+ * and a finalize the old server never answered follow, and the new
+ * server picks up where the old one stopped. Otherwise the queued
+ * audio is discarded and the new server starts from the next frame. A
+ * running hedge takes over the session instead.
+ */
+static int vosk_speech_failover(vosk_speech_t *vosk_speech)
+{
+	vosk_backend_t *backend, *old_backend;
+	struct ast_websocket *ws, *old_ws;
+	int replay;
+
+	if (++vosk_speech->failovers > VOSK_FAILOVER_MAX) {
+		return -1;
+	}
+	vosk_hedge_cancel(vosk_speech);
+	/* A hedge already has the utterance, it simply takes over */
+	old_backend = vosk_hedge_end(vosk_speech, 1, NULL);
+	if (old_backend) {
+		ast_log(LOG_NOTICE, "(%s) Failed over from %s to its hedge\n", vosk_speech->name, old_backend->url);
+		__atomic_fetch_add(&old_backend->stats.failovers, 1, __ATOMIC_RELAXED);
+		/* The hedge may still be behind, the rest of the utterance follows as a replay */
+		if (vosk_speech->hedge_pos < vosk_speech->replay.len) {
+			vosk_speech->replay.pending = 1;
+			vosk_speech->replay.pos = vosk_speech->hedge_pos;
+		}
+		if (vosk_speech->hedge_finalize) {
+			vosk_speech->hedge_finalize = 0;
+			__atomic_store_n(&vosk_speech->finalizing, 0, __ATOMIC_RELEASE);
+			__atomic_store_n(&vosk_speech->finalize, 1, __ATOMIC_RELEASE);
+		}
+		return 0;
+	}
+	/* A finished utterance needs nothing from the old server */
+	replay = vosk_speech->engine->replay_buffer && !vosk_speech->replay.overflow
+		&& !__atomic_load_n(&vosk_speech->done, __ATOMIC_ACQUIRE);
+
+	backend = vosk_backend_acquire(vosk_speech->engine, vosk_speech->backend);
+	if (!backend) {
+		return -1;
+	}
+	ws = vosk_pool_checkout(&backend->pool);
+	if (!ws) {
+		vosk_backend_release(vosk_speech->engine, backend);
+		return -1;
+	}
+
+	ao2_lock(vosk_speech);
+	if (vosk_speech->closed || vosk_reader_move(vosk_speech, vosk_speech->ws, ws)) {
+		ao2_unlock(vosk_speech);
+		vosk_disconnect(ws);
+		vosk_backend_release(vosk_speech->engine, backend);
+		return -1;
+	}
+	old_ws = vosk_speech->ws;
+	old_backend = vosk_speech->backend;
+	vosk_speech->ws = ws;
+	vosk_speech->backend = backend;
+	/* Answers pending on the old connection are lost, only a reset still to send gets one */
+	__atomic_store_n(&vosk_speech->discard, __atomic_load_n(&vosk_speech->reset, __ATOMIC_ACQUIRE) ? 1 : 0,
+		__ATOMIC_RELEASE);
+	ao2_unlock(vosk_speech);
+
+	ast_log(LOG_NOTICE, "(%s) Failed over from %s to %s, replaying %zu bytes\n", vosk_speech->name,
+		old_backend->url, backend->url, replay ? vosk_speech->replay.len : 0);
+	__atomic_fetch_add(&old_backend->stats.failovers, 1, __ATOMIC_RELAXED);
+	vosk_disconnect(old_ws);
+	vosk_backend_release(vosk_speech->engine, old_backend);
+
+	if (!replay) {
+		vosk_ring_consume(&vosk_speech->ring, vosk_ring_used(&vosk_speech->ring));
+		vosk_replay_clear(vosk_speech);
+		return 0;
+	}
+	vosk_speech->replay.pending = 1;
+	vosk_speech->replay.pos = 0;
+	/* Only sent once the replay and the queued audio are through */
+	if (__atomic_exchange_n(&vosk_speech->finalizing, 0, __ATOMIC_ACQ_REL)) {
+		__atomic_store_n(&vosk_speech->finalize, 1, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief Handle a failed write on the session connection
+ *
+ * Sender thread. Returns 1 when the session is to fail over, which the
+ * sender does on its next pass, or 0 when it gave up. A connection that
+ * lost a hedge race meanwhile is no failure, the audio goes to the
+ * winner on the next pass.
+ */
+static int vosk_speech_write_error(vosk_speech_t *vosk_speech, struct ast_websocket *ws)
+{
+	if (__atomic_load_n(&vosk_speech->ws, __ATOMIC_ACQUIRE) != ws) {
+		return 1;
+	}
+	if (vosk_speech->engine->replay_buffer || vosk_speech->engine->overflow_policy == VOSK_OVERFLOW_FAILOVER) {
+		/* The reader may have noticed first, the backend failed only once */
+		if (!__atomic_exchange_n(&vosk_speech->failover, 1, __ATOMIC_ACQ_REL)) {
+			vosk_backend_failure(vosk_speech->engine, vosk_speech->backend, "write error");
+		}
+		return 1;
+	}
+	vosk_backend_failure(vosk_speech->engine, vosk_speech->backend, "write error");
+	vosk_speech_fail(vosk_speech, "websocket write error");
+	return 0;
+}
+
+/*!
+ * \brief Race a second backend on the current utterance
+ *
+ * Sender thread. A connection to another backend, preferably the standby
+ * one, is asked for without waiting; vosk_hedge_advance replays the
+ * utterance to it and from then on every chunk goes to both, the first
+ * final result wins. Skipped once the hedges of the backend used up
+ * hedge_budget of its utterances, or when the utterance cannot be
+ * replayed.
+ */
+static void vosk_hedge_start(vosk_speech_t *vosk_speech, enum vosk_hedge_reason reason)
+{
+	vosk_backend_t *primary = vosk_speech->backend;
+	vosk_stats_t *stats = &primary->stats;
+	vosk_backend_t *backend;
+	vosk_prewarm_t *conn;
+	uint64_t hedges;
+
+	if (vosk_speech->hedge_ws || vosk_speech->hedge_conn || vosk_speech->replay.overflow
+		|| __atomic_load_n(&vosk_speech->done, __ATOMIC_ACQUIRE)
+		|| __atomic_load_n(&vosk_speech->reset, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	hedges = __atomic_load_n(&stats->hedges, __ATOMIC_RELAXED);
+	if ((hedges + 1) * 100 > (uint64_t) vosk_speech->engine->hedge_budget * __atomic_load_n(&stats->utterances, __ATOMIC_RELAXED)) {
+		ast_debug(1, "(%s) Hedge budget of %s used up\n", vosk_speech->name, primary->url);
+		return;
+	}
+
+	backend = vosk_backend_acquire_hedge(vosk_speech->engine, primary);
+	if (!backend) {
+		ast_debug(1, "(%s) No backend to hedge to\n", vosk_speech->name);
+		return;
+	}
+	conn = vosk_prewarm_new(vosk_speech->engine, 0);
+	if (!conn) {
+		vosk_backend_release(vosk_speech->engine, backend);
+		return;
+	}
+	conn->backend = backend;
+	vosk_prewarm_connect(conn);
+	vosk_speech->hedge_conn = conn;
+	vosk_speech->hedge_pos = 0;
+	/* A hedge for a late final result owes its server the finalize too */
+	vosk_speech->hedge_finalize = __atomic_load_n(&vosk_speech->finalizing, __ATOMIC_ACQUIRE);
+
+	__atomic_fetch_add(&stats->hedges, 1, __ATOMIC_RELAXED);
+	ast_log(LOG_NOTICE, "(%s) No %s result from %s in time, hedging to %s\n", vosk_speech->name,
+		reason == VOSK_HEDGE_FINAL ? "final" : "partial", primary->url, backend->url);
+}
+
+/** \brief Give up on a hedge still being set up, sender thread */
+static void vosk_hedge_cancel(vosk_speech_t *vosk_speech)
+{
+	vosk_prewarm_t *conn = vosk_speech->hedge_conn;
+
+	if (!conn) {
+		return;
+	}
+	vosk_speech->hedge_conn = NULL;
+	/* A connect still to come stays in the pool */
+	ao2_lock(conn);
+	conn->connecting = 0;
+	ao2_unlock(conn);
+	ao2_ref(conn, -1);
+}
+
+/*!
+ * \brief Bring a hedge being set up up to date with the utterance
+ *
+ * Sender thread, on every pass; nothing here waits. Once the pool handed
+ * over the connection, the utterance so far is replayed to it as fast as
+ * the socket takes it. When it caught up, the reader watches it and
+ * vosk_hedge_follow keeps it up to date from then on.
+ */
+static void vosk_hedge_advance(vosk_speech_t *vosk_speech)
+{
+	vosk_prewarm_t *conn = vosk_speech->hedge_conn;
+	struct epoll_event ev = { .events = EPOLLIN };
+	vosk_backend_t *backend;
+	struct ast_websocket *ws;
+	int connecting, res;
+
+	if (!conn) {
+		return;
+	}
+	/* The utterance ended or outgrew the replay while the hedge was set up */
+	if (vosk_speech->replay.overflow
+		|| __atomic_load_n(&vosk_speech->done, __ATOMIC_ACQUIRE)
+		|| __atomic_load_n(&vosk_speech->reset, __ATOMIC_ACQUIRE)) {
+		vosk_hedge_cancel(vosk_speech);
+		return;
+	}
+
+	ao2_lock(conn);
+	connecting = conn->connecting;
+	ws = conn->ws;
+	ao2_unlock(conn);
+	if (connecting) {
+		return;
+	}
+	backend = conn->backend;
+	if (!ws) {
+		/* The pool counted the failed connect */
+		ast_debug(1, "(%s) Hedge to %s could not connect\n", vosk_speech->name, backend->url);
+		vosk_hedge_cancel(vosk_speech);
+		return;
+	}
+
+	res = vosk_replay_step(vosk_speech, ws, &vosk_speech->hedge_pos, &backend->stats);
+	if (res > 0) {
+		return;
+	}
+	if (res < 0) {
+		vosk_backend_failure(vosk_speech->engine, backend, "write error");
+		vosk_hedge_cancel(vosk_speech);
+		return;
+	}
+
+	/* Caught up, the connection and the backend slot go to the session */
+	ao2_lock(conn);
+	conn->ws = NULL;
+	conn->backend = NULL;
+	ao2_unlock(conn);
+	vosk_speech->hedge_conn = NULL;
+	ao2_ref(conn, -1);
+
+	ev.data.ptr = (void *) ((uintptr_t) vosk_speech | VOSK_HEDGE_TAG);
+	ao2_lock(vosk_speech);
+	if (vosk_speech->closed || epoll_ctl(vosk_speech->reader->epfd, EPOLL_CTL_ADD, ast_websocket_fd(ws), &ev)) {
+		ao2_unlock(vosk_speech);
+		vosk_disconnect(ws);
+		vosk_backend_release(vosk_speech->engine, backend);
+		return;
+	}
+	vosk_speech->hedge_backend = backend;
+	__atomic_store_n(&vosk_speech->hedge_ws, ws, __ATOMIC_RELEASE);
+	ao2_unlock(vosk_speech);
+
+	ast_debug(1, "(%s) Hedge to %s caught up with %zu bytes\n", vosk_speech->name, backend->url, vosk_speech->hedge_pos);
+}
+
+/*!
+ * \brief Bring a running hedge up to date with the utterance
+ *
+ * Sender thread, on every pass. The hedge gets the audio kept for replay
+ * from where it stopped, as far as its socket takes it, and the finalize
+ * of the utterance once it has all of it. A hedge that fails or can no
+ * longer follow is given up.
+ */
+static void vosk_hedge_follow(vosk_speech_t *vosk_speech)
+{
+	struct ast_websocket *ws;
+	vosk_backend_t *backend;
+	int res;
+
+	ao2_lock(vosk_speech);
+	ws = vosk_speech->hedge_ws;
+	backend = vosk_speech->hedge_backend;
+	if (ws) {
+		ast_websocket_ref(ws);
+	}
+	ao2_unlock(vosk_speech);
+	if (!ws) {
+		return;
+	}
+
+	if (vosk_speech->replay.overflow) {
+		ast_debug(1, "(%s) Utterance too long to hedge\n", vosk_speech->name);
+		vosk_hedge_end(vosk_speech, 0, NULL);
+	} else {
+		res = vosk_replay_step(vosk_speech, ws, &vosk_speech->hedge_pos, &backend->stats);
+		if (!res && vosk_speech->hedge_finalize) {
+			res = vosk_ws_send_text(vosk_speech, ws, "{\"reset\" : 1}");
+			vosk_speech->hedge_finalize = 0;
+		}
+		if (res < 0) {
+			vosk_hedge_end(vosk_speech, 0, "write error");
+		}
+	}
+	ast_websocket_unref(ws);
+}
+
+/*!
+ * \brief Bytes the consumer may take ahead of a pending utterance reset
+ *
+ * Audio queued before vosk_recog_start belongs to the previous utterance
+ * and still goes to the recognizer first; 0 means it is all through and
+ * the reset is due.
+ */
+static size_t vosk_speech_reset_limit(vosk_speech_t *vosk_speech, size_t len)
+{
+	ssize_t before;
+
+	if (!__atomic_load_n(&vosk_speech->reset, __ATOMIC_ACQUIRE)) {
+		return len;
+	}
+	before = (ssize_t) (vosk_speech->reset_pos - vosk_speech->ring.tail);
+	return before <= 0 ? 0 : MIN(len, (size_t) before);
+}
+
+/*!
+ * \brief Reset the server side recognizer
+ *
+ * The reset is answered with the final result of the previous utterance,
+ * which the reader discards; the configuration is sent again so every
+ * utterance starts from the same settings.
+ */
+static int vosk_speech_send_reset(vosk_speech_t *vosk_speech, struct ast_websocket *ws)
+{
+	if (vosk_ws_send_text(vosk_speech, ws, "{\"reset\" : 1}")) {
+		return -1;
+	}
+	return vosk_speech->engine->ws_config ? vosk_ws_send_text(vosk_speech, ws, vosk_speech->engine->ws_config) : 0;
+}
+
+/** \brief Send audio from the front of the ring as one binary message, see vosk_ws_send */
+static int vosk_ws_write_ring(vosk_speech_t *vosk_speech, struct ast_websocket *ws, size_t len)
+{
+	struct iovec slices[2];
+	int count;
+
+	count = vosk_ring_slices(&vosk_speech->ring, len, slices);
+	return vosk_ws_send(vosk_speech, ws, AST_WEBSOCKET_OPCODE_BINARY, slices, count, 0);
+}
+
+/*!
+ * \brief Send queued audio of a session
+ *
+ * Runs on the sender thread. Returns 1 when the socket stopped accepting
+ * data and the session should be retried later.
+ */
+static int vosk_speech_send(vosk_sender_t *sender, vosk_speech_t *vosk_speech)
+{
+	struct ast_websocket *ws;
+	enum vosk_hedge_reason reason;
+	size_t drop, len;
+	int res = 0;
+
+	if (__atomic_load_n(&vosk_speech->failed, __ATOMIC_ACQUIRE)) {
+		vosk_ring_consume(&vosk_speech->ring, vosk_ring_used(&vosk_speech->ring));
+		return 0;
+	}
+
+	if (__atomic_exchange_n(&vosk_speech->failover, 0, __ATOMIC_ACQ_REL)
+		&& vosk_speech_failover(vosk_speech)) {
+		vosk_speech_fail(vosk_speech, vosk_speech->failovers > VOSK_FAILOVER_MAX
+			? "too many failovers" : "no backend to fail over to");
+		return 0;
+	}
+
+	reason = __atomic_exchange_n(&vosk_speech->hedge, VOSK_HEDGE_NONE, __ATOMIC_ACQ_REL);
+	if (reason) {
+		vosk_hedge_start(vosk_speech, reason);
+	}
+	vosk_wsout_prune(vosk_speech);
+	vosk_wsout_flush(vosk_speech);
+	vosk_hedge_advance(vosk_speech);
+
+	drop = __atomic_exchange_n(&vosk_speech->drop_bytes, 0, __ATOMIC_ACQ_REL);
+	if (drop) {
+		vosk_ring_consume(&vosk_speech->ring, drop);
+	}
+
+	ws = vosk_speech_get_ws(vosk_speech);
+	if (!ws) {
+		return 0;
+	}
+
+	/* After a failover the new connection gets the utterance so far first */
+	if (vosk_speech->replay.pending) {
+		res = vosk_replay_step(vosk_speech, ws, &vosk_speech->replay.pos, vosk_speech_stats(vosk_speech));
+		if (res) {
+			res = res < 0 ? vosk_speech_write_error(vosk_speech, ws) : 1;
+			ast_websocket_unref(ws);
+			return res;
+		}
+		vosk_speech->replay.pending = 0;
+	}
+
+	for (;;) {
+		size_t limit = vosk_speech_reset_limit(vosk_speech, vosk_speech->chunk_bytes);
+
+		if (!limit) {
+			/* The utterance ended without a final result, so did its race */
+			vosk_hedge_cancel(vosk_speech);
+			vosk_hedge_end(vosk_speech, 0, NULL);
+			if (vosk_speech_send_reset(vosk_speech, ws)) {
+				res = vosk_speech_write_error(vosk_speech, ws);
+				break;
+			}
+			__atomic_store_n(&vosk_speech->reset, 0, __ATOMIC_RELEASE);
+			vosk_replay_clear(vosk_speech);
+			continue;
+		}
+		if (!(len = MIN(limit, vosk_ring_used(&vosk_speech->ring)))) {
+			break;
+		}
+		vosk_replay_keep(vosk_speech, len);
+		res = vosk_ws_write_ring(vosk_speech, ws, len);
+		if (res) {
+			vosk_replay_unkeep(vosk_speech, len);
+			res = res < 0 ? vosk_speech_write_error(vosk_speech, ws) : 1;
+			break;
+		}
+		vosk_ring_consume(&vosk_speech->ring, len);
+		vosk_speech_count_audio(vosk_speech, len);
+	}
+
+	/* The utterance ended locally, have the server finish it now */
+	if (!res && !vosk_ring_used(&vosk_speech->ring)
+		&& __atomic_exchange_n(&vosk_speech->finalize, 0, __ATOMIC_ACQ_REL)) {
+		__atomic_store_n(&vosk_speech->finalizing, 1, __ATOMIC_RELEASE);
+		if (vosk_ws_send_text(vosk_speech, ws, "{\"reset\" : 1}")) {
+			res = vosk_speech_write_error(vosk_speech, ws);
+		}
+		if (__atomic_load_n(&vosk_speech->hedge_ws, __ATOMIC_ACQUIRE) || vosk_speech->hedge_conn) {
+			vosk_speech->hedge_finalize = 1;
+		}
+	}
+	vosk_hedge_follow(vosk_speech);
+
+	/* Whatever a socket did not take goes out on a later pass */
+	if (!res && vosk_wsout_pending(vosk_speech)) {
+		res = 1;
+	}
+
+	ast_websocket_unref(ws);
+	return res;
+}
+
+/** \brief Audio sender thread */
+static void *vosk_sender_thread(void *data)
+{
+	vosk_sender_t *sender = data;
+	AST_LIST_HEAD_NOLOCK(, vosk_speech_t) ready, parked;
+	vosk_speech_t *vosk_speech;
+	struct timeval wait;
+	struct timespec ts;
+
+	AST_LIST_HEAD_INIT_NOLOCK(&parked);
+
+	ast_mutex_lock(&sender->lock);
+	while (!sender->stop) {
+		if (AST_LIST_EMPTY(&sender->ready)) {
+			if (AST_LIST_EMPTY(&parked)) {
+				ast_cond_wait(&sender->cond, &sender->lock);
+			} else {
+				wait = ast_tvadd(ast_tvnow(), ast_samp2tv(VOSK_SEND_RETRY_INTERVAL, 1000));
+				ts.tv_sec = wait.tv_sec;
+				ts.tv_nsec = wait.tv_usec * 1000;
+				ast_cond_timedwait(&sender->cond, &sender->lock, &ts);
+			}
+			/* Parked sessions get another chance on every wakeup */
+			while ((vosk_speech = AST_LIST_REMOVE_HEAD(&parked, send_list))) {
+				AST_LIST_INSERT_TAIL(&sender->ready, vosk_speech, send_list);
+			}
+			continue;
+		}
+		AST_LIST_FIRST(&ready) = AST_LIST_FIRST(&sender->ready);
+		AST_LIST_LAST(&ready) = AST_LIST_LAST(&sender->ready);
+		AST_LIST_HEAD_INIT_NOLOCK(&sender->ready);
+		ast_mutex_unlock(&sender->lock);
+
+		while ((vosk_speech = AST_LIST_REMOVE_HEAD(&ready, send_list))) {
+			/* Producer queues the session again if more audio arrives from now on */
+			__atomic_store_n(&vosk_speech->queued, 0, __ATOMIC_RELEASE);
+			if (vosk_speech_send(sender, vosk_speech)
+				&& !__atomic_exchange_n(&vosk_speech->queued, 1, __ATOMIC_ACQ_REL)) {
+				AST_LIST_INSERT_TAIL(&parked, vosk_speech, send_list);
+				continue;
+			}
+			ao2_ref(vosk_speech, -1);
+		}
+
+		ast_mutex_lock(&sender->lock);
+	}
+	ast_mutex_unlock(&sender->lock);
+
+	while ((vosk_speech = AST_LIST_REMOVE_HEAD(&parked, send_list))) {
+		ao2_ref(vosk_speech, -1);
+	}
+
+	return NULL;
+}
+
+/** \brief Hand a session with queued audio to its sender */
+static void vosk_sender_kick(vosk_speech_t *vosk_speech)
+{
+	vosk_sender_t *sender = vosk_speech->sender;
+
+	if (__atomic_exchange_n(&vosk_speech->queued, 1, __ATOMIC_ACQ_REL)) {
+		/* Already waiting, the sender will see the new audio */
+		return;
+	}
+	ao2_ref(vosk_speech, +1);
+	ast_mutex_lock(&sender->lock);
+	AST_LIST_INSERT_TAIL(&sender->ready, vosk_speech, send_list);
+	ast_cond_signal(&sender->cond);
+	ast_mutex_unlock(&sender->lock);
+}
+
+/** \brief Start audio sender threads */
+static int vosk_senders_start(void)
+{
+	int i;
+
+	if (vosk_sender_count < 1) {
+		vosk_sender_count = 1;
+	}
+	vosk_senders = ast_calloc(vosk_sender_count, sizeof(*vosk_senders));
+	if (!vosk_senders) {
+		return -1;
+	}
+
+	for (i = 0; i < vosk_sender_count; i++) {
+		vosk_sender_t *sender = &vosk_senders[i];
+
+		sender->thread = AST_PTHREADT_NULL;
+		ast_mutex_init(&sender->lock);
+		ast_cond_init(&sender->cond, NULL);
+		AST_LIST_HEAD_INIT_NOLOCK(&sender->ready);
+	}
+
+	for (i = 0; i < vosk_sender_count; i++) {
+		vosk_sender_t *sender = &vosk_senders[i];
+
+		if (ast_pthread_create_background(&sender->thread, NULL, vosk_sender_thread, sender)) {
+			ast_log(LOG_ERROR, "Failed to start audio sender %d\n", i);
+			sender->thread = AST_PTHREADT_NULL;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** \brief Stop audio sender threads */
+static void vosk_senders_stop(void)
+{
+	vosk_speech_t *vosk_speech;
+	int i;
+
+	if (!vosk_senders) {
+		return;
+	}
+	for (i = 0; i < vosk_sender_count; i++) {
+		vosk_sender_t *sender = &vosk_senders[i];
+
+		if (sender->thread != AST_PTHREADT_NULL) {
+			ast_mutex_lock(&sender->lock);
+			sender->stop = 1;
+			ast_cond_signal(&sender->cond);
+			ast_mutex_unlock(&sender->lock);
+			pthread_join(sender->thread, NULL);
+		}
+		while ((vosk_speech = AST_LIST_REMOVE_HEAD(&sender->ready, send_list))) {
+			ao2_ref(vosk_speech, -1);
+		}
+		ast_cond_destroy(&sender->cond);
+		ast_mutex_destroy(&sender->lock);
+	}
+	ast_free(vosk_senders);
+	vosk_senders = NULL;
+}
+
+/*!
+ * \brief Attach a capture to a new session
+ *
+ * Only capture_percent of the sessions are captured. The capture joins
+ * the writer right away, the file is opened once audio arrives.
+ */
+static void vosk_capture_attach(vosk_speech_t *vosk_speech)
+{
+	vosk_capture_t *capture;
+
+	if (!vosk_capture.started || (vosk_capture.percent < 100
+		&& ast_random() % 100 >= vosk_capture.percent)) {
+		return;
+	}
+	capture = ast_calloc(1, sizeof(*capture));
+	if (!capture) {
+		return;
+	}
+	if (vosk_ring_init(&capture->ring, (size_t) VOSK_CAPTURE_BUFFER * vosk_speech->bytes_per_ms)) {
+		ast_free(capture);
+		return;
+	}
+	ast_mutex_init(&capture->lock);
+	AST_LIST_HEAD_INIT_NOLOCK(&capture->cuts);
+	capture->engine = vosk_speech->engine->name;
+	capture->sample_rate = vosk_speech->engine->sample_rate;
+
+	ast_mutex_lock(&vosk_capture.lock);
+	capture->id = ++vosk_capture.next_id;
+	AST_LIST_INSERT_TAIL(&vosk_capture.captures, capture, list);
+	ast_mutex_unlock(&vosk_capture.lock);
+
+	vosk_speech->capture = capture;
+	ast_debug(1, "(%s) Capturing audio as %u\n", vosk_speech->name, capture->id);
+}
+
+/*!
+ * \brief Copy recognizer input into the capture, channel thread only
+ *
+ * Never waits for the writer; audio that does not fit is lost and
+ * accounted in the utterance metadata.
+ */
+static void vosk_capture_audio(vosk_capture_t *capture, const char *audio, size_t len)
+{
+	if (ast_tvzero(capture->start)) {
+		capture->start = ast_tvnow();
+	}
+	if (vosk_ring_write(&capture->ring, audio, len)) {
+		capture->dropped += len;
+	}
+}
+
+/*!
+ * \brief End the captured utterance, channel thread only
+ *
+ * Queues the final result for the writer. Nothing is queued when no
+ * audio came since the last cut. With last set the session is done and
+ * the capture belongs to the writer from here on.
+ */
+static void vosk_capture_cut(vosk_speech_t *vosk_speech, int last)
+{
+	vosk_capture_t *capture = vosk_speech->capture;
+	vosk_capture_cut_t *cut = NULL;
+
+	if (!capture) {
+		return;
+	}
+
+	if (!ast_tvzero(capture->start)) {
+		ao2_lock(vosk_speech);
+		cut = ast_calloc(1, sizeof(*cut) + strlen(vosk_speech->last_result) + 1);
+		if (cut) {
+			strcpy(cut->text, vosk_speech->last_result);
+		}
+		ao2_unlock(vosk_speech);
+	}
+	if (cut) {
+		cut->pos = capture->ring.head;
+		cut->start = capture->start;
+		cut->end = ast_tvnow();
+		cut->dropped = capture->dropped;
+	}
+	capture->start = ast_tv(0, 0);
+	capture->dropped = 0;
+
+	ast_mutex_lock(&capture->lock);
+	if (cut) {
+		AST_LIST_INSERT_TAIL(&capture->cuts, cut, list);
+	}
+	if (last) {
+		capture->backend = vosk_speech->backend ? vosk_speech->backend->url : "local";
+		__atomic_store_n(&capture->closed, 1, __ATOMIC_RELEASE);
+		vosk_speech->capture = NULL;
+	}
+	ast_mutex_unlock(&capture->lock);
+}
+
+/* RIFF header of 16 bit mono PCM, sizes are filled in when the file is done */
+static void vosk_capture_wav_header(FILE *file, uint32_t rate, uint32_t data_bytes)
+{
+	uint8_t header[44];
+
+#define PUT16(p, v) do { (p)[0] = (v) & 0xff; (p)[1] = ((v) >> 8) & 0xff; } while (0)
+#define PUT32(p, v) do { PUT16(p, (v) & 0xffff); PUT16((p) + 2, (v) >> 16); } while (0)
+	memcpy(header, "RIFF", 4);
+	PUT32(header + 4, 36 + data_bytes);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	PUT32(header + 16, 16);
+	PUT16(header + 20, 1);
+	PUT16(header + 22, 1);
+	PUT32(header + 24, rate);
+	PUT32(header + 28, rate * 2);
+	PUT16(header + 32, 2);
+	PUT16(header + 34, 16);
+	memcpy(header + 36, "data", 4);
+	PUT32(header + 40, data_bytes);
+#undef PUT16
+#undef PUT32
+
+	if (fwrite(header, sizeof(header), 1, file) != 1) {
+		ast_log(LOG_WARNING, "Failed to write capture header: %s\n", strerror(errno));
+	}
+}
+
+/** \brief Write captured audio up to the ring position, opening the file on demand */
+static void vosk_capture_drain(vosk_capture_t *capture, size_t pos)
+{
+	char path[PATH_MAX];
+	size_t len;
+
+	while ((len = vosk_ring_peek(&capture->ring, vosk_capture.buf,
+		MIN(sizeof(vosk_capture.buf), pos - capture->ring.tail)))) {
+		if (!capture->file && !capture->file_bytes) {
+			snprintf(path, sizeof(path), "%s/%u-%u.wav", vosk_capture.dir, capture->id, capture->utterance);
+			capture->file = fopen(path, "wb");
+			if (!capture->file) {
+				ast_log(LOG_WARNING, "Failed to open capture file %s: %s\n", path, strerror(errno));
+			} else {
+				vosk_capture_wav_header(capture->file, capture->sample_rate, 0);
+			}
+		}
+		if (capture->file && fwrite(vosk_capture.buf, 1, len, capture->file) != len) {
+			ast_log(LOG_WARNING, "Failed to write capture %u-%u: %s\n", capture->id, capture->utterance, strerror(errno));
+			fclose(capture->file);
+			capture->file = NULL;
+		}
+		/* Counted even without a file, so a failed open is not retried within the utterance */
+		capture->file_bytes += len;
+		vosk_ring_consume(&capture->ring, len);
+	}
+}
+
+/** \brief Finish the utterance file and write its metadata */
+static void vosk_capture_finish(vosk_capture_t *capture, vosk_capture_cut_t *cut)
+{
+	struct ast_json *meta;
+	char path[PATH_MAX];
+	char *text;
+	FILE *file;
+
+	vosk_capture_drain(capture, cut->pos);
+	if (capture->file) {
+		rewind(capture->file);
+		vosk_capture_wav_header(capture->file, capture->sample_rate, capture->file_bytes);
+		fclose(capture->file);
+		capture->file = NULL;
+
+		meta = ast_json_pack("{s: s, s: s, s: s, s: i, s: I, s: I, s: I, s: I}",
+			"text", cut->text,
+			"engine", capture->engine,
+			"backend", capture->backend ? capture->backend : "",
+			"sample_rate", capture->sample_rate,
+			"start", (ast_json_int_t) ast_tvdiff_ms(cut->start, ast_tv(0, 0)),
+			"end", (ast_json_int_t) ast_tvdiff_ms(cut->end, ast_tv(0, 0)),
+			"duration", (ast_json_int_t) (capture->file_bytes / 2 * 1000 / capture->sample_rate),
+			"dropped", (ast_json_int_t) (cut->dropped / 2 * 1000 / capture->sample_rate));
+		text = meta ? ast_json_dump_string(meta) : NULL;
+		snprintf(path, sizeof(path), "%s/%u-%u.json", vosk_capture.dir, capture->id, capture->utterance);
+		if (text && (file = fopen(path, "w"))) {
+			fprintf(file, "%s\n", text);
+			fclose(file);
+		} else {
+			ast_log(LOG_WARNING, "Failed to write capture metadata %s\n", path);
+		}
+		ast_json_free(text);
+		ast_json_unref(meta);
+	}
+	capture->file_bytes = 0;
+	capture->utterance++;
+}
+
+/*!
+ * \brief Write out what a capture has, returns non-zero once it is done
+ *
+ * closed is read first, so the cuts taken afterwards include the last.
+ * A capture that is done only waits to be freed.
+ */
+static int vosk_capture_flush(vosk_capture_t *capture)
+{
+	struct vosk_capture_cut_list cuts;
+	vosk_capture_cut_t *cut;
+	int closed = __atomic_load_n(&capture->closed, __ATOMIC_ACQUIRE);
+
+	ast_mutex_lock(&capture->lock);
+	cuts = capture->cuts;
+	AST_LIST_HEAD_INIT_NOLOCK(&capture->cuts);
+	ast_mutex_unlock(&capture->lock);
+
+	while ((cut = AST_LIST_REMOVE_HEAD(&cuts, list))) {
+		vosk_capture_finish(capture, cut);
+		ast_free(cut);
+	}
+	if (!closed) {
+		/* The utterance in progress, its file is finished with the next cut */
+		vosk_capture_drain(capture, capture->ring.head);
+		return 0;
+	}
+	return 1;
+}
+
+/** \brief Free a capture the writer is done with */
+static void vosk_capture_free(vosk_capture_t *capture)
+{
+	if (capture->file) {
+		fclose(capture->file);
+	}
+	vosk_ring_free(&capture->ring);
+	ast_mutex_destroy(&capture->lock);
+	ast_free(capture);
+}
+
+/** \brief Capture writer thread */
+static void *vosk_capture_thread(void *data)
+{
+	struct vosk_capture_list captures;
+	vosk_capture_t *capture;
+	struct timeval wait;
+	struct timespec ts;
+	int stop;
+
+	ast_mutex_lock(&vosk_capture.lock);
+	do {
+		stop = vosk_capture.stop;
+		captures = vosk_capture.captures;
+		AST_LIST_HEAD_INIT_NOLOCK(&vosk_capture.captures);
+		ast_mutex_unlock(&vosk_capture.lock);
+
+		AST_LIST_TRAVERSE_SAFE_BEGIN(&captures, capture, list) {
+			if (vosk_capture_flush(capture)) {
+				AST_LIST_REMOVE_CURRENT(list);
+				vosk_capture_free(capture);
+			}
+		}
+		AST_LIST_TRAVERSE_SAFE_END;
+
+		ast_mutex_lock(&vosk_capture.lock);
+		/* Captures attached meanwhile go after the older ones */
+		AST_LIST_APPEND_LIST(&captures, &vosk_capture.captures, list);
+		vosk_capture.captures = captures;
+		if (!stop && !vosk_capture.stop) {
+			wait = ast_tvadd(ast_tvnow(), ast_samp2tv(VOSK_CAPTURE_INTERVAL, 1000));
+			ts.tv_sec = wait.tv_sec;
+			ts.tv_nsec = wait.tv_usec * 1000;
+			ast_cond_timedwait(&vosk_capture.cond, &vosk_capture.lock, &ts);
+		}
+	} while (!stop);
+	ast_mutex_unlock(&vosk_capture.lock);
+
+	return NULL;
+}
+
+/** \brief Start the capture writer when a capture directory is configured */
+static int vosk_capture_start(void)
+{
+	if (ast_strlen_zero(vosk_capture.dir) || vosk_capture.percent <= 0) {
+		return 0;
+	}
+	if (ast_mkdir(vosk_capture.dir, 0755)) {
+		ast_log(LOG_ERROR, "Failed to create capture directory %s: %s\n", vosk_capture.dir, strerror(errno));
+		return -1;
+	}
+
+	ast_mutex_init(&vosk_capture.lock);
+	ast_cond_init(&vosk_capture.cond, NULL);
+	AST_LIST_HEAD_INIT_NOLOCK(&vosk_capture.captures);
+	vosk_capture.stop = 0;
+	if (ast_pthread_create_background(&vosk_capture.thread, NULL, vosk_capture_thread, NULL)) {
+		ast_log(LOG_ERROR, "Failed to start capture writer\n");
+		ast_cond_destroy(&vosk_capture.cond);
+		ast_mutex_destroy(&vosk_capture.lock);
+		return -1;
+	}
+	vosk_capture.started = 1;
+	ast_log(LOG_NOTICE, "Capturing %d%% of the sessions to %s\n", vosk_capture.percent, vosk_capture.dir);
+	return 0;
+}
+
+/*!
+ * \brief Stop the capture writer, all sessions must be gone
+ *
+ * The writer makes one last pass, so every finished capture is written.
+ */
+static void vosk_capture_stop(void)
+{
+	if (!vosk_capture.started) {
+		return;
+	}
+	ast_mutex_lock(&vosk_capture.lock);
+	vosk_capture.stop = 1;
+	ast_cond_signal(&vosk_capture.cond);
+	ast_mutex_unlock(&vosk_capture.lock);
+	pthread_join(vosk_capture.thread, NULL);
+	vosk_capture.started = 0;
+
+	ast_cond_destroy(&vosk_capture.cond);
+	ast_mutex_destroy(&vosk_capture.lock);
+}
+
+#ifdef HAVE_VOSK_API
+/*!
+ * \brief Load the model for local mode
+ *
+ * The model is immutable once loaded and libvosk allows any number of
+ * recognizers to share it, so it is loaded once for the whole module.
+ */
+static int vosk_local_load(vosk_engine_t *engine)
+{
+	ast_log(LOG_NOTICE, "Loading Vosk model from %s\n", engine->model_path);
+	engine->model = vosk_model_new(engine->model_path);
+	if (!engine->model) {
+		ast_log(LOG_ERROR, "Failed to load Vosk model from %s\n", engine->model_path);
+		return -1;
+	}
+	return 0;
+}
+
+/** \brief Drop the module reference to the model, recognizers keep their own */
+static void vosk_local_unload(vosk_engine_t *engine)
+{
+	if (engine->model) {
+		vosk_model_free(engine->model);
+		engine->model = NULL;
+	}
+}
+
+/** \brief Create the in-process recognizer of a session */
+static int vosk_local_create(vosk_speech_t *vosk_speech)
+{
+	vosk_speech->recognizer = vosk_recognizer_new(vosk_speech->engine->model, vosk_speech->engine->sample_rate);
+	if (!vosk_speech->recognizer) {
+		ast_log(LOG_ERROR, "(%s) Failed to create recognizer\n", vosk_speech->name);
+		return -1;
+	}
+	vosk_speech->decoder = &vosk_decoders[ast_atomic_fetch_add(&vosk_decoder_next, 1, __ATOMIC_RELAXED) % vosk_decoder_count];
+	return 0;
+}
+
+/*!
+ * \brief Decode the audio queued by a session
+ *
+ * Runs on a decoder thread which owns the session until its queued flag
+ * is cleared, so a recognizer is never used by two threads at once.
+ * Partial results are fetched once per chunk, they are costly to compute
+ * and nobody looks at them more often.
+ */
+static void vosk_local_decode(vosk_decoder_t *decoder, vosk_speech_t *vosk_speech)
+{
+	const char *json;
+	size_t drop, len;
+	int res;
+
+	do {
+		drop = __atomic_exchange_n(&vosk_speech->drop_bytes, 0, __ATOMIC_ACQ_REL);
+		if (drop) {
+			vosk_ring_consume(&vosk_speech->ring, drop);
+		}
+		while (!__atomic_load_n(&vosk_speech->closed, __ATOMIC_ACQUIRE)) {
+			size_t limit = vosk_speech_reset_limit(vosk_speech, vosk_speech->chunk_bytes);
+
+			if (!limit) {
+				/* Results come back in order here, nothing stale follows the reset */
+				vosk_recognizer_reset(vosk_speech->recognizer);
+				ao2_lock(vosk_speech);
+				vosk_speech->last_result[0] = '\0';
+				ao2_unlock(vosk_speech);
+				__atomic_store_n(&vosk_speech->done, 0, __ATOMIC_RELEASE);
+				vosk_speech->partial_hash = 0;
+				__atomic_store_n(&vosk_speech->reset, 0, __ATOMIC_RELEASE);
+				continue;
+			}
+			if (!(len = vosk_ring_peek(&vosk_speech->ring, decoder->buf, limit))) {
+				break;
+			}
+			res = vosk_recognizer_accept_waveform(vosk_speech->recognizer, decoder->buf, len);
+			vosk_ring_consume(&vosk_speech->ring, len);
+			vosk_speech_count_audio(vosk_speech, len);
+			if (res < 0) {
+				vosk_speech_fail(vosk_speech, "recognizer rejected audio");
+			} else if (res || vosk_speech_partial_due(vosk_speech)) {
+				/* Building a partial is not free either, skip it when it would be dropped */
+				json = res ? vosk_recognizer_result(vosk_speech->recognizer)
+					: vosk_recognizer_partial_result(vosk_speech->recognizer);
+				vosk_speech_handle_result(vosk_speech, json, strlen(json), 0);
+			}
+		}
+		if (!__atomic_load_n(&vosk_speech->closed, __ATOMIC_ACQUIRE) && !vosk_ring_used(&vosk_speech->ring)
+			&& __atomic_exchange_n(&vosk_speech->finalize, 0, __ATOMIC_ACQ_REL)) {
+			/* Flushes the decoder, the recognizer then starts a new utterance */
+			__atomic_store_n(&vosk_speech->finalizing, 1, __ATOMIC_RELEASE);
+			json = vosk_recognizer_final_result(vosk_speech->recognizer);
+			vosk_speech_handle_result(vosk_speech, json, strlen(json), 0);
+		}
+		/* Give the session back, then make sure no audio slipped in meanwhile */
+		__atomic_store_n(&vosk_speech->queued, 0, __ATOMIC_RELEASE);
+	} while ((vosk_ring_used(&vosk_speech->ring) || __atomic_load_n(&vosk_speech->finalize, __ATOMIC_ACQUIRE)
+			|| __atomic_load_n(&vosk_speech->reset, __ATOMIC_ACQUIRE))
+		&& !__atomic_load_n(&vosk_speech->closed, __ATOMIC_ACQUIRE)
+		&& !__atomic_exchange_n(&vosk_speech->queued, 1, __ATOMIC_ACQ_REL));
+}
+
+/*!
+ * \brief Take the next session to decode
+ *
+ * The own queue comes first, an idle decoder then steals from the other
+ * queues so that one busy decoder does not hold back its sessions.
+ */
+static vosk_speech_t *vosk_decoder_next_session(vosk_decoder_t *decoder)
+{
+	vosk_speech_t *vosk_speech;
+	int i, idx = decoder - vosk_decoders;
+
+	for (i = 0; i < vosk_decoder_count; i++) {
+		vosk_decoder_t *victim = &vosk_decoders[(idx + i) % vosk_decoder_count];
+
+		ast_mutex_lock(&victim->lock);
+		vosk_speech = AST_LIST_REMOVE_HEAD(&victim->queue, decode_list);
+		ast_mutex_unlock(&victim->lock);
+		if (vosk_speech) {
+			ast_atomic_fetch_sub(&vosk_decoder_pending, 1, __ATOMIC_ACQ_REL);
+			return vosk_speech;
+		}
+	}
+	return NULL;
+}
+
+/** \brief Decoder thread */
+static void *vosk_decoder_thread(void *data)
+{
+	vosk_decoder_t *decoder = data;
+	vosk_speech_t *vosk_speech;
+
+	for (;;) {
+		vosk_speech = vosk_decoder_next_session(decoder);
+		if (vosk_speech) {
+			vosk_local_decode(decoder, vosk_speech);
+			ao2_ref(vosk_speech, -1);
+			continue;
+		}
+
+		ast_mutex_lock(&vosk_decoder_lock);
+		while (!vosk_decoder_stop && !__atomic_load_n(&vosk_decoder_pending, __ATOMIC_ACQUIRE)) {
+			ast_cond_wait(&vosk_decoder_cond, &vosk_decoder_lock);
+		}
+		if (vosk_decoder_stop) {
+			ast_mutex_unlock(&vosk_decoder_lock);
+			break;
+		}
+		ast_mutex_unlock(&vosk_decoder_lock);
+	}
+
+	return NULL;
+}
+
+/** \brief Queue a session with new audio on its home decoder */
+static void vosk_decoder_kick(vosk_speech_t *vosk_speech)
+{
+	vosk_decoder_t *decoder = vosk_speech->decoder;
+
+	if (__atomic_exchange_n(&vosk_speech->queued, 1, __ATOMIC_ACQ_REL)) {
+		/* Queued or being decoded, the decoder will see the new audio */
+		return;
+	}
+	ao2_ref(vosk_speech, +1);
+	ast_mutex_lock(&decoder->lock);
+	AST_LIST_INSERT_TAIL(&decoder->queue, vosk_speech, decode_list);
+	ast_mutex_unlock(&decoder->lock);
+
+	ast_mutex_lock(&vosk_decoder_lock);
+	ast_atomic_fetch_add(&vosk_decoder_pending, 1, __ATOMIC_ACQ_REL);
+	ast_cond_signal(&vosk_decoder_cond);
+	ast_mutex_unlock(&vosk_decoder_lock);
+}
+
+/** \brief Start decoder threads, by default one per online CPU */
+static int vosk_decoders_start(void)
+{
+	int i;
+
+	if (vosk_decoder_count < 1) {
+		vosk_decoder_count = sysconf(_SC_NPROCESSORS_ONLN);
+		if (vosk_decoder_count < 1) {
+			vosk_decoder_count = 1;
+		}
+	}
+	vosk_decoders = ast_calloc(vosk_decoder_count, sizeof(*vosk_decoders));
+	if (!vosk_decoders) {
+		return -1;
+	}
+	vosk_decoder_stop = 0;
+	ast_cond_init(&vosk_decoder_cond, NULL);
+
+	for (i = 0; i < vosk_decoder_count; i++) {
+		vosk_decoder_t *decoder = &vosk_decoders[i];
+
+		decoder->thread = AST_PTHREADT_NULL;
+		ast_mutex_init(&decoder->lock);
+		AST_LIST_HEAD_INIT_NOLOCK(&decoder->queue);
+	}
+
+	for (i = 0; i < vosk_decoder_count; i++) {
+		vosk_decoder_t *decoder = &vosk_decoders[i];
+
+		if (ast_pthread_create_background(&decoder->thread, NULL, vosk_decoder_thread, decoder)) {
+			ast_log(LOG_ERROR, "Failed to start decoder %d\n", i);
+			decoder->thread = AST_PTHREADT_NULL;
+			return -1;
+		}
+	}
+	ast_verb(2, "Started %d Vosk decoder threads\n", vosk_decoder_count);
+	return 0;
+}
+
+/** \brief Stop decoder threads */
+static void vosk_decoders_stop(void)
+{
+	vosk_speech_t *vosk_speech;
+	int i;
+
+	if (!vosk_decoders) {
+		return;
+	}
+
+	ast_mutex_lock(&vosk_decoder_lock);
+	vosk_decoder_stop = 1;
+	ast_cond_broadcast(&vosk_decoder_cond);
+	ast_mutex_unlock(&vosk_decoder_lock);
+
+	for (i = 0; i < vosk_decoder_count; i++) {
+		vosk_decoder_t *decoder = &vosk_decoders[i];
+
+		if (decoder->thread != AST_PTHREADT_NULL) {
+			pthread_join(decoder->thread, NULL);
+		}
+		while ((vosk_speech = AST_LIST_REMOVE_HEAD(&decoder->queue, decode_list))) {
+			ao2_ref(vosk_speech, -1);
+		}
+		ast_mutex_destroy(&decoder->lock);
+	}
+	ast_free(vosk_decoders);
+	vosk_decoders = NULL;
+	vosk_decoder_pending = 0;
+	ast_cond_destroy(&vosk_decoder_cond);
+}
+
+/*!
+ * \brief Load the batch model for batch mode
+ *
+ * Only a libvosk built with CUDA has a batch model; a CPU-only build
+ * returns none for any path.
+ */
+static int vosk_batch_load(vosk_engine_t *engine)
+{
+	ast_log(LOG_NOTICE, "Loading Vosk batch model from %s\n", engine->model_path);
+	vosk_gpu_init();
+	engine->batch_model = vosk_batch_model_new(engine->model_path);
+	if (!engine->batch_model) {
+		ast_log(LOG_ERROR, "Failed to load Vosk batch model from %s: batch mode requires a CUDA-enabled libvosk and a GPU\n",
+			engine->model_path);
+		return -1;
+	}
+	return 0;
+}
+
+/** \brief Free the batch model, the scheduler must be stopped */
+static void vosk_batch_unload(vosk_engine_t *engine)
+{
+	if (engine->batch_model) {
+		vosk_batch_model_free(engine->batch_model);
+		engine->batch_model = NULL;
+	}
+}
+
+/** \brief Create the batched recognizer of a session */
+static int vosk_batch_create(vosk_speech_t *vosk_speech)
+{
+	vosk_speech->batch_recognizer = vosk_batch_recognizer_new(vosk_speech->engine->batch_model, vosk_speech->engine->sample_rate);
+	if (!vosk_speech->batch_recognizer) {
+		ast_log(LOG_ERROR, "(%s) Failed to create batch recognizer\n", vosk_speech->name);
+		return -1;
+	}
+	return 0;
+}
+
+/*!
+ * \brief Add a session to the pending list, taking over one reference
+ *
+ * Returns -1 without taking the reference when the session is pending
+ * already.
+ */
+static int vosk_batch_enqueue(vosk_speech_t *vosk_speech)
+{
+	if (__atomic_exchange_n(&vosk_speech->queued, 1, __ATOMIC_ACQ_REL)) {
+		return -1;
+	}
+	ast_mutex_lock(&vosk_batch.lock);
+	if (AST_LIST_EMPTY(&vosk_batch.pending)) {
+		vosk_batch.pending_since = ast_tvnow();
+	}
+	AST_LIST_INSERT_TAIL(&vosk_batch.pending, vosk_speech, decode_list);
+	vosk_batch.pending_count++;
+	if (vosk_batch.pending_count == 1 || vosk_batch.pending_count >= vosk_batch.engine->batch_size) {
+		/* Start the delay timer or cut the batch short */
+		ast_cond_signal(&vosk_batch.cond);
+	}
+	ast_mutex_unlock(&vosk_batch.lock);
+	return 0;
+}
+
+/** \brief Queue a session with new audio for the next batch */
+static void vosk_batch_kick(vosk_speech_t *vosk_speech)
+{
+	ao2_ref(vosk_speech, +1);
+	if (vosk_batch_enqueue(vosk_speech)) {
+		ao2_ref(vosk_speech, -1);
+	}
+}
+
+/*!
+ * \brief Hand the channel's reference of a closing session to the scheduler
+ *
+ * The batched recognizer must not be freed while the model may still be
+ * evaluating its audio, so the last reference is always dropped by the
+ * scheduler after a batch completed.
+ */
+static void vosk_batch_close(vosk_speech_t *vosk_speech)
+{
+	__atomic_store_n(&vosk_speech->closed, 1, __ATOMIC_RELEASE);
+	if (vosk_batch_enqueue(vosk_speech)) {
+		/* Pending already, the scheduler holds a reference */
+		ao2_ref(vosk_speech, -1);
+	}
+}
+
+/*!
+ * \brief Give a session a new batched recognizer for its next utterance
+ *
+ * Scheduler thread, before the session's audio of this batch is fed.
+ * Batch streams cannot be restarted: the old one is finished unless it
+ * was already, and its recognizer retired until the model evaluated this
+ * batch. Audio of the previous utterance still queued is dropped.
+ */
+static int vosk_batch_restart(vosk_speech_t *vosk_speech)
+{
+	VoskBatchRecognizer *old_recognizer;
+	size_t stale;
+
+	stale = vosk_speech_reset_limit(vosk_speech, vosk_ring_used(&vosk_speech->ring));
+	if (stale) {
+		vosk_ring_consume(&vosk_speech->ring, stale);
+	}
+
+	ast_mutex_lock(&vosk_batch.lock);
+	old_recognizer = vosk_speech->batch_recognizer;
+	if (vosk_batch_create(vosk_speech)) {
+		vosk_speech->batch_recognizer = old_recognizer;
+		ast_mutex_unlock(&vosk_batch.lock);
+		__atomic_store_n(&vosk_speech->reset, 0, __ATOMIC_RELEASE);
+		vosk_speech_fail(vosk_speech, "cannot restart batch recognizer");
+		return -1;
+	}
+	ast_mutex_unlock(&vosk_batch.lock);
+	if (!vosk_speech->batch_finished) {
+		vosk_batch_recognizer_finish_stream(old_recognizer);
+	}
+	vosk_speech->batch_retired = old_recognizer;
+	vosk_speech->batch_finished = 0;
+
+	vosk_speech->partial_hash = 0;
+	__atomic_store_n(&vosk_speech->reset, 0, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/** \brief Feed, evaluate and collect one batch */
+static void vosk_batch_run(void)
+{
+	vosk_speech_t *vosk_speech;
+	const char *res;
+	size_t i, drop, len;
+
+	for (i = 0; i < AST_VECTOR_SIZE(&vosk_batch.batch); i++) {
+		vosk_speech = AST_VECTOR_GET(&vosk_batch.batch, i);
+		/* Audio arriving from now on goes to the next batch */
+		__atomic_store_n(&vosk_speech->queued, 0, __ATOMIC_RELEASE);
+		if (__atomic_load_n(&vosk_speech->closed, __ATOMIC_ACQUIRE)) {
+			continue;
+		}
+		drop = __atomic_exchange_n(&vosk_speech->drop_bytes, 0, __ATOMIC_ACQ_REL);
+		if (drop) {
+			vosk_ring_consume(&vosk_speech->ring, drop);
+		}
+		if (__atomic_load_n(&vosk_speech->reset, __ATOMIC_ACQUIRE) && vosk_batch_restart(vosk_speech)) {
+			continue;
+		}
+		while ((len = vosk_ring_peek(&vosk_speech->ring, vosk_batch.buf, vosk_speech->chunk_bytes))) {
+			vosk_batch_recognizer_accept_waveform(vosk_speech->batch_recognizer, vosk_batch.buf, len);
+			vosk_ring_consume(&vosk_speech->ring, len);
+			vosk_speech_count_audio(vosk_speech, len);
+		}
+		if (__atomic_exchange_n(&vosk_speech->finalize, 0, __ATOMIC_ACQ_REL)) {
+			/* Ends the stream, the next utterance gets a new recognizer */
+			__atomic_store_n(&vosk_speech->finalizing, 1, __ATOMIC_RELEASE);
+			vosk_batch_recognizer_finish_stream(vosk_speech->batch_recognizer);
+			vosk_speech->batch_finished = 1;
+		}
+	}
+
+	vosk_batch_model_wait(vosk_batch.engine->batch_model);
+
+	for (i = 0; i < AST_VECTOR_SIZE(&vosk_batch.batch); i++) {
+		vosk_speech = AST_VECTOR_GET(&vosk_batch.batch, i);
+		if (vosk_speech->batch_retired) {
+			/* Results of the previous utterance come too late to matter */
+			vosk_batch_recognizer_free(vosk_speech->batch_retired);
+			vosk_speech->batch_retired = NULL;
+		}
+		if (!__atomic_load_n(&vosk_speech->closed, __ATOMIC_ACQUIRE)) {
+			while ((res = vosk_batch_recognizer_front_result(vosk_speech->batch_recognizer))
+				&& !ast_strlen_zero(res)) {
+				vosk_speech_handle_result(vosk_speech, res, strlen(res), 0);
+				vosk_batch_recognizer_pop(vosk_speech->batch_recognizer);
+			}
+		}
+		ao2_ref(vosk_speech, -1);
+	}
+	AST_VECTOR_RESET(&vosk_batch.batch, AST_VECTOR_ELEM_CLEANUP_NOOP);
+}
+
+/** \brief Batch scheduler thread */
+static void *vosk_batch_thread(void *data)
+{
+	vosk_speech_t *vosk_speech;
+	struct timeval deadline;
+	struct timespec ts;
+
+	vosk_gpu_thread_init();
+
+	ast_mutex_lock(&vosk_batch.lock);
+	while (!vosk_batch.stop) {
+		if (AST_LIST_EMPTY(&vosk_batch.pending)) {
+			ast_cond_wait(&vosk_batch.cond, &vosk_batch.lock);
+			continue;
+		}
+		if (vosk_batch.pending_count < vosk_batch.engine->batch_size) {
+			deadline = ast_tvadd(vosk_batch.pending_since, ast_samp2tv(vosk_batch.engine->batch_delay, 1000));
+			if (ast_tvcmp(deadline, ast_tvnow()) > 0) {
+				ts.tv_sec = deadline.tv_sec;
+				ts.tv_nsec = deadline.tv_usec * 1000;
+				ast_cond_timedwait(&vosk_batch.cond, &vosk_batch.lock, &ts);
+				continue;
+			}
+		}
+
+		/* Sessions leave the list before queued is cleared, they may rejoin right away */
+		while ((vosk_speech = AST_LIST_REMOVE_HEAD(&vosk_batch.pending, decode_list))) {
+			if (AST_VECTOR_APPEND(&vosk_batch.batch, vosk_speech)) {
+				__atomic_store_n(&vosk_speech->queued, 0, __ATOMIC_RELEASE);
+				ao2_ref(vosk_speech, -1);
+			}
+		}
+		vosk_batch.pending_count = 0;
+		ast_mutex_unlock(&vosk_batch.lock);
+
+		vosk_batch_run();
+
+		ast_mutex_lock(&vosk_batch.lock);
+	}
+	ast_mutex_unlock(&vosk_batch.lock);
+
+	return NULL;
+}
+
+/** \brief Start the batch scheduler of the engine */
+static int vosk_batch_start(vosk_engine_t *engine)
+{
+	vosk_batch.engine = engine;
+	ast_mutex_init(&vosk_batch.lock);
+	ast_cond_init(&vosk_batch.cond, NULL);
+	AST_LIST_HEAD_INIT_NOLOCK(&vosk_batch.pending);
+	AST_VECTOR_INIT(&vosk_batch.batch, engine->batch_size);
+	vosk_batch.stop = 0;
+	vosk_batch.started = 1;
+
+	if (ast_pthread_create_background(&vosk_batch.thread, NULL, vosk_batch_thread, NULL)) {
+		ast_log(LOG_ERROR, "Failed to start batch scheduler\n");
+		vosk_batch.thread = AST_PTHREADT_NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/** \brief Stop the batch scheduler */
+static void vosk_batch_stop(void)
+{
+	vosk_speech_t *vosk_speech;
+
+	if (!vosk_batch.started) {
+		return;
+	}
+	vosk_batch.started = 0;
+
+	ast_mutex_lock(&vosk_batch.lock);
+	vosk_batch.stop = 1;
+	ast_cond_signal(&vosk_batch.cond);
+	ast_mutex_unlock(&vosk_batch.lock);
+
+	if (vosk_batch.thread != AST_PTHREADT_NULL) {
+		pthread_join(vosk_batch.thread, NULL);
+		vosk_batch.thread = AST_PTHREADT_NULL;
+	}
+	while ((vosk_speech = AST_LIST_REMOVE_HEAD(&vosk_batch.pending, decode_list))) {
+		ao2_ref(vosk_speech, -1);
+	}
+	AST_VECTOR_FREE(&vosk_batch.batch);
+	ast_cond_destroy(&vosk_batch.cond);
+	ast_mutex_destroy(&vosk_batch.lock);
+}
+
+/*!
+ * \brief Load the model of the engine and start the threads driving in-process recognizers
+ *
+ * Decoder threads are shared by all engines in local mode, they are
+ * started with the first one.
+ */
+static int vosk_local_start(vosk_engine_t *engine)
+{
+	if (engine->mode == VOSK_MODE_BATCH) {
+		if (vosk_batch.started) {
+			ast_log(LOG_ERROR, "Engine %s: only one engine can use batch mode, %s does already\n",
+				engine->name, vosk_batch.engine->name);
+			return -1;
+		}
+		return vosk_batch_load(engine) || vosk_batch_start(engine);
+	}
+	return vosk_local_load(engine) || (!vosk_decoders && vosk_decoders_start());
+}
+
+/** \brief Stop in-process recognition threads, the models are freed with their engines */
+static void vosk_local_stop(void)
+{
+	vosk_batch_stop();
+	vosk_decoders_stop();
+}
+#endif
+
+/** \brief Hand a session with queued audio to whoever consumes it */
+static void vosk_speech_kick(vosk_speech_t *vosk_speech)
+{
+#ifdef HAVE_VOSK_API
+	if (vosk_speech->recognizer) {
+		vosk_decoder_kick(vosk_speech);
+		return;
+	}
+	if (vosk_speech->batch_recognizer) {
+		vosk_batch_kick(vosk_speech);
+		return;
+	}
+#endif
+	vosk_sender_kick(vosk_speech);
+}
+
+/*!
+ * \brief Queue audio for the sender or decoder, never blocks
+ *
+ * The sender is kicked once a full chunk is queued or the oldest queued
+ * audio waited chunk_latency, whichever comes first. Frames of any size
+ * are accepted, chunks are cut by the sender. The latency is checked as
+ * frames arrive, which during recognition is every frame period.
+ *
+ * Applies the overflow policy once more than high_water bytes wait in
+ * the ring, which only happens when the server does not keep up.
+ */
+static void vosk_speech_queue_audio(vosk_speech_t *vosk_speech, const char *data, size_t len)
+{
+	size_t used = vosk_ring_used(&vosk_speech->ring);
+	struct timeval now = ast_tvnow();
+
+	if (used + len > vosk_speech->high_water) {
+		switch (vosk_speech->engine->overflow_policy) {
+		case VOSK_OVERFLOW_DROP_OLDEST:
+			ast_atomic_fetch_add(&vosk_speech->drop_bytes, len, __ATOMIC_ACQ_REL);
+			vosk_speech->dropped += len;
+			break;
+		case VOSK_OVERFLOW_DROP_SESSION:
+			vosk_speech_fail(vosk_speech, "server does not keep up with audio");
+			return;
+		case VOSK_OVERFLOW_FAILOVER:
+			if (!vosk_speech->ws) {
+				/* Nothing to fail over to in local mode, drop the oldest audio */
+				ast_atomic_fetch_add(&vosk_speech->drop_bytes, len, __ATOMIC_ACQ_REL);
+				vosk_speech->dropped += len;
+			} else if (!__atomic_exchange_n(&vosk_speech->failover, 1, __ATOMIC_ACQ_REL)) {
+				ast_log(LOG_NOTICE, "(%s) Server does not keep up with audio, failing over\n", vosk_speech->name);
+			}
+			break;
+		}
+	}
+
+	if (vosk_ring_write(&vosk_speech->ring, data, len)) {
+		/* The sender did not catch up with drops yet, lose the newest audio instead */
+		vosk_speech->dropped += len;
+		return;
+	}
+	vosk_speech->dirty = 1;
+
+	if (!vosk_speech->unflushed) {
+		vosk_speech->unflushed_since = now;
+	}
+	vosk_speech->unflushed += len;
+	if (vosk_speech->unflushed >= vosk_speech->chunk_bytes
+		|| ast_tvdiff_ms(now, vosk_speech->unflushed_since) >= vosk_speech->chunk_latency) {
+		vosk_speech->unflushed = 0;
+		vosk_speech_kick(vosk_speech);
+	}
+}
+
+/*!
+ * \brief Bring channel audio to signed linear at the engine sample rate
+ *
+ * Returns the audio to queue and its length in bytes, either the frame
+ * itself or the session scratch area. G.711 frames are decoded here so
+ * that the channel never needs a translation path to slin.
+ */
+static const char *vosk_speech_convert(vosk_speech_t *vosk_speech, const char *data, size_t *len)
+{
+	const int16_t *pcm = (const int16_t *) data;
+	size_t samples;
+	size_t need;
+	int16_t *out;
+
+	if (vosk_speech->codec == VOSK_INPUT_SLIN && vosk_speech->input_rate == vosk_speech->engine->sample_rate) {
+		return data;
+	}
+
+	samples = vosk_speech->codec == VOSK_INPUT_SLIN ? *len / 2 : *len;
+	/* Decoded samples followed by twice as many resampled ones at most */
+	need = 3 * samples;
+	if (need > vosk_speech->convert_size) {
+		int16_t *buf = ast_realloc(vosk_speech->convert_buf, need * sizeof(int16_t));
+		if (!buf) {
+			*len = 0;
+			return NULL;
+		}
+		vosk_speech->convert_buf = buf;
+		vosk_speech->convert_size = need;
+	}
+
+	if (vosk_speech->codec == VOSK_INPUT_ULAW) {
+		vosk_dsp_ulaw_decode(vosk_speech->convert_buf, (const uint8_t *) data, samples);
+		pcm = vosk_speech->convert_buf;
+	} else if (vosk_speech->codec == VOSK_INPUT_ALAW) {
+		vosk_dsp_alaw_decode(vosk_speech->convert_buf, (const uint8_t *) data, samples);
+		pcm = vosk_speech->convert_buf;
+	}
+
+	out = vosk_speech->convert_buf + samples;
+	if (vosk_speech->input_rate < vosk_speech->engine->sample_rate) {
+		vosk_dsp_upsample2(out, pcm, samples, &vosk_speech->resample_last);
+		samples *= 2;
+	} else if (vosk_speech->input_rate > vosk_speech->engine->sample_rate) {
+		vosk_dsp_downsample2(out, pcm, samples, &vosk_speech->resample_last);
+		samples /= 2;
+	} else {
+		out = (int16_t *) pcm;
+	}
+
+	*len = samples * sizeof(int16_t);
+	return (const char *) out;
+}
+
+/** \brief Keep the latest gated audio, at most preroll_bytes of it */
+static void vosk_speech_preroll_push(vosk_speech_t *vosk_speech, const char *audio, size_t len)
+{
+	vosk_ring_t *preroll = &vosk_speech->preroll;
+	size_t used;
+
+	if (len > vosk_speech->preroll_bytes) {
+		audio += len - vosk_speech->preroll_bytes;
+		len = vosk_speech->preroll_bytes;
+	}
+	used = vosk_ring_used(preroll);
+	if (used + len > vosk_speech->preroll_bytes) {
+		vosk_ring_consume(preroll, used + len - vosk_speech->preroll_bytes);
+	}
+	vosk_ring_write(preroll, audio, len);
+}
+
+/** \brief Queue the pre-roll ahead of the frame that starts an utterance */
+static void vosk_speech_preroll_flush(vosk_speech_t *vosk_speech)
+{
+	char buf[640];
+	size_t len;
+
+	while ((len = vosk_ring_peek(&vosk_speech->preroll, buf, sizeof(buf)))) {
+		vosk_ring_consume(&vosk_speech->preroll, len);
+		vosk_speech_queue_audio(vosk_speech, buf, len);
+	}
+}
+
+/*!
+ * \brief Voice activity gate in front of the send path
+ *
+ * Returns non-zero when the frame should reach the recognizer. Frames
+ * below vad_threshold are passed on for vad_hangover after the last
+ * voiced frame, so the recognizer still sees the pause that ends an
+ * utterance; after that they are held back in the pre-roll ring and
+ * replayed once speech starts again, so onsets are never clipped.
+ */
+static int vosk_speech_gate(vosk_speech_t *vosk_speech, const char *audio, size_t len, uint32_t power)
+{
+	uint32_t threshold = vosk_speech->engine->vad_threshold;
+
+	if (!threshold) {
+		return 1;
+	}
+
+	if (power >= threshold * threshold) {
+		vosk_speech->vad_silence = 0;
+		if (!vosk_speech->vad_speaking) {
+			vosk_speech->vad_speaking = 1;
+			vosk_speech_preroll_flush(vosk_speech);
+		}
+		return 1;
+	}
+
+	if (vosk_speech->vad_speaking) {
+		vosk_speech->vad_silence += len / vosk_speech->bytes_per_ms;
+		if (vosk_speech->vad_silence < vosk_speech->engine->vad_hangover) {
+			return 1;
+		}
+		vosk_speech->vad_speaking = 0;
+		ast_debug(2, "(%s) Silence, holding back audio\n", vosk_speech->name);
+	}
+
+	vosk_speech_preroll_push(vosk_speech, audio, len);
+	vosk_speech->suppressed += len;
+	return 0;
+}
+
+/*!
+ * \brief Check whether a frame carries speech, for latency accounting
+ *
+ * Without any level configured every frame counts, the final latency is
+ * then measured from the last audio written.
+ */
+static int vosk_speech_voiced(vosk_speech_t *vosk_speech, uint32_t power)
+{
+	uint32_t threshold = vosk_speech->endpoint_silence ? vosk_speech->endpoint_threshold : vosk_speech->engine->vad_threshold;
+
+	return !threshold || power >= threshold * threshold;
+}
+
+/*!
+ * \brief Local end of utterance detection
+ *
+ * Once the caller spoke for VOSK_ENDPOINT_MIN_SPEECH and then stayed
+ * below endpoint_threshold for endpoint_silence, the utterance is over:
+ * the queued audio is flushed and the recognizer asked for its final
+ * result right away instead of waiting for its own silence timeout.
+ */
+static void vosk_speech_endpoint(vosk_speech_t *vosk_speech, size_t len, uint32_t power)
+{
+	uint32_t threshold = vosk_speech->endpoint_threshold;
+	int ms = len / vosk_speech->bytes_per_ms;
+
+	if (!vosk_speech->endpoint_silence) {
+		return;
+	}
+
+	if (power >= threshold * threshold) {
+		vosk_speech->endpoint_voiced += ms;
+		vosk_speech->endpoint_trailing = 0;
+		return;
+	}
+	if (vosk_speech->endpoint_voiced < VOSK_ENDPOINT_MIN_SPEECH) {
+		return;
+	}
+	vosk_speech->endpoint_trailing += ms;
+	if (vosk_speech->endpoint_trailing < vosk_speech->endpoint_silence) {
+		return;
+	}
+
+	ast_debug(1, "(%s) End of speech after %d ms of silence\n", vosk_speech->name, vosk_speech->endpoint_trailing);
+	vosk_speech->endpointed = 1;
+	vosk_speech->unflushed = 0;
+	__atomic_store_n(&vosk_speech->finalize, 1, __ATOMIC_RELEASE);
+	vosk_speech_kick(vosk_speech);
+}
+
+/*!
+ * \brief Ask for a hedge once the server is late with the utterance
+ *
+ * Checked on every frame the channel writes, which keeps coming while
+ * the result is awaited. Late is no partial result hedge_delay after
+ * speech onset, or no final one hedge_final_delay after
+ * local endpointing saw the last speech. An utterance is hedged once.
+ */
+static void vosk_speech_hedge_check(vosk_speech_t *vosk_speech)
+{
+	enum vosk_hedge_reason reason = VOSK_HEDGE_NONE;
+	int64_t now, start, last_speech;
+
+	if (vosk_speech->hedged || !vosk_speech->sender) {
+		return;
+	}
+	now = vosk_now_ms();
+	start = __atomic_load_n(&vosk_speech->speech_onset, __ATOMIC_ACQUIRE);
+	last_speech = __atomic_load_n(&vosk_speech->last_speech, __ATOMIC_ACQUIRE);
+	if (vosk_speech->engine->hedge_delay && start > 0 && now - start >= vosk_speech->engine->hedge_delay) {
+		reason = VOSK_HEDGE_PARTIAL;
+	} else if (vosk_speech->engine->hedge_final_delay && vosk_speech->endpointed && last_speech
+		&& now - last_speech >= vosk_speech->engine->hedge_final_delay) {
+		reason = VOSK_HEDGE_FINAL;
+	}
+	if (!reason) {
+		return;
+	}
+	vosk_speech->hedged = 1;
+	__atomic_store_n(&vosk_speech->hedge, reason, __ATOMIC_RELEASE);
+	vosk_sender_kick(vosk_speech);
+}
+
+/*!
+ * \brief Start a new utterance on the existing recognizer
+ *
+ * Drops what the previous utterance left behind and has the consumer
+ * reset the recognizer right after the audio queued so far, so one
+ * connection serves every prompt of a call. Server results still in
+ * flight for the old audio are discarded up to the reset's answer.
+ */
+static void vosk_speech_reset(vosk_speech_t *vosk_speech)
+{
+	ast_debug(1, "(%s) Reset recognizer for the next utterance\n", vosk_speech->name);
+	vosk_speech->dirty = 0;
+	vosk_speech->unflushed = 0;
+	/* A finalize request still queued is covered by the reset */
+	__atomic_store_n(&vosk_speech->finalize, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&vosk_speech->finalizing, 0, __ATOMIC_RELEASE);
+	if (vosk_speech->ws && !__atomic_load_n(&vosk_speech->reset, __ATOMIC_ACQUIRE)) {
+		ast_atomic_fetch_add(&vosk_speech->discard, 1, __ATOMIC_ACQ_REL);
+	}
+	vosk_speech->reset_pos = vosk_speech->ring.head;
+	__atomic_store_n(&vosk_speech->reset, 1, __ATOMIC_RELEASE);
+
+	ao2_lock(vosk_speech);
+	vosk_speech->last_result[0] = '\0';
+	ao2_unlock(vosk_speech);
+	__atomic_store_n(&vosk_speech->done, 0, __ATOMIC_RELEASE);
+	vosk_speech_kick(vosk_speech);
+}
+
+/** \brief Destructor of a prewarmed connection, releases what was not claimed */
+static void vosk_prewarm_destructor(void *obj)
+{
+	vosk_prewarm_t *prewarm = obj;
+
+	if (prewarm->ws) {
+		vosk_disconnect(prewarm->ws);
+	}
+	vosk_backend_release(prewarm->engine, prewarm->backend);
+	if (prewarm->admitted) {
+		vosk_admission_leave(prewarm->engine);
+	}
+	ast_cond_destroy(&prewarm->cond);
+	ast_module_unref(ast_module_info->self);
+}
+
+/** \brief Channel datastore destroy callback, the call is gone */
+static void vosk_prewarm_datastore_destroy(void *data)
+{
+	vosk_prewarm_t *prewarm = data;
+
+	ast_mutex_lock(&vosk_prewarm_lock);
+	if (AST_LIST_REMOVE(&vosk_prewarms, prewarm, list)) {
+		ao2_ref(prewarm, -1);
+	}
+	ast_mutex_unlock(&vosk_prewarm_lock);
+	/* A connect the pool has not started yet is skipped */
+	ao2_lock(prewarm);
+	prewarm->connecting = 0;
+	ao2_unlock(prewarm);
+	ao2_ref(prewarm, -1);
+}
+
+static const struct ast_datastore_info vosk_prewarm_datastore = {
+	.type = "vosk_prewarm",
+	.destroy = vosk_prewarm_datastore_destroy,
+};
+
+/** \brief Allocate a connection request, the backend is up to the caller */
+static vosk_prewarm_t *vosk_prewarm_new(vosk_engine_t *engine, ast_callid callid)
+{
+	vosk_prewarm_t *prewarm;
+
+	prewarm = ao2_alloc(sizeof(*prewarm), vosk_prewarm_destructor);
+	if (!prewarm) {
+		return NULL;
+	}
+	/* Released by the destructor, keeps the module loaded while connections are reserved */
+	ast_module_ref(ast_module_info->self);
+	ast_cond_init(&prewarm->cond, NULL);
+	prewarm->callid = callid;
+	prewarm->engine = engine;
+
+	return prewarm;
+}
+
+/*!
+ * \brief Get a connection to the backend of a request without waiting
+ *
+ * A pooled connection is taken right away, otherwise the pool thread of
+ * the backend connects and hands it over. Without a pool thread nothing
+ * happens, the request is left with no connection.
+ */
+static void vosk_prewarm_connect(vosk_prewarm_t *prewarm)
+{
+	prewarm->ws = vosk_pool_take(&prewarm->backend->pool);
+	if (!prewarm->ws) {
+		prewarm->connecting = 1;
+		if (vosk_pool_queue_prewarm(&prewarm->backend->pool, prewarm)) {
+			prewarm->connecting = 0;
+		}
+	}
+}
+
+/*!
+ * \brief Reserve a session slot and a connection for the call
+ *
+ * Goes through admission like SpeechCreate, but never waits: the dialplan
+ * should not stall on a prewarm. A pooled connection is taken right away,
+ * otherwise the pool thread of the backend connects while the dialplan
+ * moves on.
+ */
+static vosk_prewarm_t *vosk_prewarm_alloc(vosk_engine_t *engine, ast_callid callid)
+{
+	vosk_prewarm_t *prewarm;
+	enum vosk_admission admission;
+
+	prewarm = vosk_prewarm_new(engine, callid);
+	if (!prewarm) {
+		return NULL;
+	}
+
+	admission = vosk_admission_enter(engine, &prewarm->backend, 0);
+	vosk_admission_report(admission);
+	if (admission != VOSK_ADMISSION_ADMITTED) {
+		ast_debug(1, "(%s) Prewarm not admitted: %s\n", engine->name, vosk_admission_str(admission));
+		ao2_ref(prewarm, -1);
+		return NULL;
+	}
+	prewarm->admitted = 1;
+	/* Without a pool thread the slots stay reserved, SpeechCreate connects */
+	vosk_prewarm_connect(prewarm);
+
+	return prewarm;
+}
+
+/*!
+ * \brief Claim the connection prewarmed on the engine for the calling channel
+ *
+ * SpeechCreate does not get to see the channel, but it runs on the
+ * channel's thread, whose call id the prewarm was filed under. Waits at
+ * most connect_timeout for a connect still queued or in progress, then
+ * connects on its own with the slots the prewarm holds; the pool keeps
+ * the connection when it comes late.
+ */
+static struct ast_websocket *vosk_prewarm_claim(vosk_engine_t *engine, vosk_backend_t **backend)
+{
+	ast_callid callid = ast_read_threadstorage_callid();
+	vosk_prewarm_t *prewarm;
+	struct ast_websocket *ws;
+	struct timeval deadline;
+	struct timespec ts;
+
+	if (!callid) {
+		return NULL;
+	}
+
+	ast_mutex_lock(&vosk_prewarm_lock);
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&vosk_prewarms, prewarm, list) {
+		if (prewarm->callid == callid && prewarm->engine == engine) {
+			AST_LIST_REMOVE_CURRENT(list);
+			break;
+		}
+	}
+	AST_LIST_TRAVERSE_SAFE_END;
+	ast_mutex_unlock(&vosk_prewarm_lock);
+	if (!prewarm) {
+		return NULL;
+	}
+
+	deadline = ast_tvadd(ast_tvnow(), ast_samp2tv(engine->connect_timeout, 1000));
+	ts.tv_sec = deadline.tv_sec;
+	ts.tv_nsec = deadline.tv_usec * 1000;
+	ao2_lock(prewarm);
+	while (prewarm->connecting && ast_tvdiff_ms(deadline, ast_tvnow()) > 0) {
+		ast_cond_timedwait(&prewarm->cond, ao2_object_get_lockaddr(prewarm), &ts);
+	}
+	prewarm->connecting = 0;
+	ws = prewarm->ws;
+	prewarm->ws = NULL;
+	*backend = prewarm->backend;
+	prewarm->backend = NULL;
+	prewarm->admitted = 0;
+	ao2_unlock(prewarm);
+	ao2_ref(prewarm, -1);
+
+	if (ws && vosk_conn_is_stale(ws)) {
+		vosk_disconnect(ws);
+		ws = NULL;
+	}
+	if (!ws) {
+		ast_debug(1, "(%s) Prewarmed connection to %s not ready, connecting\n", engine->name, (*backend)->url);
+		ws = vosk_pool_checkout(&(*backend)->pool);
+	}
+	if (!ws) {
+		vosk_backend_release(engine, *backend);
+		*backend = NULL;
+		vosk_admission_leave(engine);
+	}
+	return ws;
+}
+
+/** \brief Whether a prewarm still waits for SpeechCreate to claim it */
+static int vosk_prewarm_pending(vosk_prewarm_t *prewarm)
+{
+	vosk_prewarm_t *cur;
+
+	ast_mutex_lock(&vosk_prewarm_lock);
+	AST_LIST_TRAVERSE(&vosk_prewarms, cur, list) {
+		if (cur == prewarm) {
+			break;
+		}
+	}
+	ast_mutex_unlock(&vosk_prewarm_lock);
+	return cur != NULL;
+}
+
+/*!
+ * \brief VOSK_PREWARM() dialplan function
+ *
+ * SpeechCreate claims the prewarm without seeing the channel, so the
+ * datastore stays behind it. A datastore whose prewarm was claimed makes
+ * way for a new one, so the next recognition on the call is prewarmed too.
+ */
+static int vosk_prewarm_read(struct ast_channel *chan, const char *cmd, char *data, char *buf, size_t len)
+{
+	struct ast_datastore *datastore;
+	vosk_prewarm_t *prewarm;
+	vosk_engine_t *engine;
+	ast_callid callid;
+
+	if (!chan) {
+		ast_log(LOG_WARNING, "%s requires a channel\n", cmd);
+		return -1;
+	}
+	/* Without an argument the first configured engine */
+	engine = ast_strlen_zero(data) ? AST_VECTOR_GET(&vosk_engines, 0) : vosk_engine_find(data);
+	if (!engine) {
+		ast_log(LOG_WARNING, "%s: no Vosk engine '%s'\n", cmd, data);
+		return -1;
+	}
+
+	ast_copy_string(buf, "0", len);
+	if (engine->mode != VOSK_MODE_SERVER) {
+		/* Nothing to connect to in local modes */
+		return 0;
+	}
+
+	ast_channel_lock(chan);
+	callid = ast_channel_callid(chan);
+	datastore = ast_channel_datastore_find(chan, &vosk_prewarm_datastore, engine->name);
+	if (datastore) {
+		if (vosk_prewarm_pending(datastore->data)) {
+			/* Already reserved and not claimed yet */
+			ast_channel_unlock(chan);
+			ast_copy_string(buf, "1", len);
+			return 0;
+		}
+		ast_channel_datastore_remove(chan, datastore);
+		ast_datastore_free(datastore);
+	}
+	ast_channel_unlock(chan);
+	if (!callid) {
+		ast_log(LOG_WARNING, "%s: channel has no call id, nothing to prewarm\n", cmd);
+		return 0;
+	}
+
+	prewarm = vosk_prewarm_alloc(engine, callid);
+	if (!prewarm) {
+		return 0;
+	}
+	datastore = ast_datastore_alloc(&vosk_prewarm_datastore, engine->name);
+	if (!datastore) {
+		ao2_ref(prewarm, -1);
+		return 0;
+	}
+	datastore->data = prewarm;
+
+	ao2_ref(prewarm, +1);
+	ast_mutex_lock(&vosk_prewarm_lock);
+	AST_LIST_INSERT_TAIL(&vosk_prewarms, prewarm, list);
+	ast_mutex_unlock(&vosk_prewarm_lock);
+
+	ast_channel_lock(chan);
+	ast_channel_datastore_add(chan, datastore);
+	ast_channel_unlock(chan);
+
+	ast_copy_string(buf, "1", len);
+	return 0;
+}
+
+static struct ast_custom_function vosk_prewarm_function = {
+	.name = "VOSK_PREWARM",
+	.read = vosk_prewarm_read,
+};
+
+/** \brief Account a session that is ready to take audio and start its capture */
+static void vosk_speech_created(vosk_speech_t *vosk_speech, struct timeval start)
+{
+	vosk_stats_t *stats = vosk_speech_stats(vosk_speech);
+
+	vosk_hist_record(&stats->connect, MAX(ast_tvdiff_ms(ast_tvnow(), start), 0));
+	__atomic_fetch_add(&stats->sessions, 1, __ATOMIC_RELAXED);
+	vosk_capture_attach(vosk_speech);
+}
+
+/** \brief Set up the speech structure within the engine */
+static int vosk_recog_create(struct ast_speech *speech, struct ast_format *format)
+{
+	vosk_speech_t *vosk_speech;
+	enum vosk_admission admission;
+	size_t bytes_per_ms;
+	struct timeval start = ast_tvnow();
+
+	vosk_speech = ao2_alloc(sizeof(vosk_speech_t), vosk_speech_destructor);
+	if (!vosk_speech) {
+		return -1;
+	}
+	/* Engines are registered by this module only and stay until it unloads */
+	vosk_speech->engine = vosk_engine_find(speech->engine->name);
+	vosk_speech->name = vosk_speech->engine->name;
+	speech->data = vosk_speech;
+
+	vosk_speech->codec = VOSK_INPUT_SLIN;
+	vosk_speech->input_rate = 8000;
+	if (ast_format_cmp(format, ast_format_ulaw) == AST_FORMAT_CMP_EQUAL) {
+		vosk_speech->codec = VOSK_INPUT_ULAW;
+	} else if (ast_format_cmp(format, ast_format_alaw) == AST_FORMAT_CMP_EQUAL) {
+		vosk_speech->codec = VOSK_INPUT_ALAW;
+	} else if (ast_format_cmp(format, ast_format_slin16) == AST_FORMAT_CMP_EQUAL) {
+		vosk_speech->input_rate = 16000;
+	}
+	ast_debug(1, "(%s) Channel audio is %s\n", vosk_speech->name, ast_format_get_name(format));
+
+	/* Sizes below are in converted audio, signed linear at the engine rate */
+	bytes_per_ms = (size_t) vosk_speech->engine->sample_rate / 1000 * sizeof(int16_t);
+	vosk_speech->bytes_per_ms = bytes_per_ms;
+	vosk_speech->chunk_bytes = (size_t) vosk_speech->engine->chunk_size * bytes_per_ms;
+	vosk_speech->chunk_latency = vosk_speech->engine->chunk_latency;
+	vosk_speech->endpoint_silence = vosk_speech->engine->endpoint_silence;
+	vosk_speech->endpoint_threshold = vosk_speech->engine->endpoint_threshold;
+	/* A partly filled chunk is not backlog */
+	vosk_speech->high_water = (size_t) vosk_speech->engine->send_buffer * bytes_per_ms + vosk_speech->chunk_bytes;
+	if (vosk_ring_init(&vosk_speech->ring, vosk_speech->high_water + 2 * vosk_speech->chunk_bytes)) {
+		ao2_ref(vosk_speech, -1);
+		speech->data = NULL;
+		return -1;
+	}
+	if (vosk_speech->engine->vad_threshold) {
+		vosk_speech->preroll_bytes = (size_t) vosk_speech->engine->vad_preroll * bytes_per_ms;
+		if (vosk_ring_init(&vosk_speech->preroll, vosk_speech->preroll_bytes)) {
+			ao2_ref(vosk_speech, -1);
+			speech->data = NULL;
+			return -1;
+		}
+	}
+
+	/* A prewarmed connection was admitted along with its engine and backend slots */
+	if (vosk_speech->engine->mode == VOSK_MODE_SERVER
+		&& (vosk_speech->ws = vosk_prewarm_claim(vosk_speech->engine, &vosk_speech->backend))) {
+		admission = VOSK_ADMISSION_ADMITTED;
+	} else {
+		admission = vosk_admission_enter(vosk_speech->engine, &vosk_speech->backend, 1);
+	}
+	if (admission != VOSK_ADMISSION_ADMITTED && admission != VOSK_ADMISSION_QUEUED) {
+		ast_log(LOG_WARNING, "(%s) Session not admitted: %s\n", vosk_speech->name, vosk_admission_str(admission));
+		vosk_admission_report(admission);
+		ao2_ref(vosk_speech, -1);
+		speech->data = NULL;
+		return -1;
+	}
+	vosk_speech->admitted = 1;
+
+#ifdef HAVE_VOSK_API
+	if (vosk_speech->engine->mode == VOSK_MODE_LOCAL) {
+		if (vosk_local_create(vosk_speech)) {
+			vosk_admission_report(VOSK_ADMISSION_UNAVAILABLE);
+			ao2_ref(vosk_speech, -1);
+			speech->data = NULL;
+			return -1;
+		}
+		vosk_admission_report(admission);
+		vosk_speech_created(vosk_speech, start);
+		ast_debug(1, "(%s) Created local speech resource\n", vosk_speech->name);
+		return 0;
+	}
+	if (vosk_speech->engine->mode == VOSK_MODE_BATCH) {
+		if (vosk_batch_create(vosk_speech)) {
+			vosk_admission_report(VOSK_ADMISSION_UNAVAILABLE);
+			ao2_ref(vosk_speech, -1);
+			speech->data = NULL;
+			return -1;
+		}
+		vosk_admission_report(admission);
+		vosk_speech_created(vosk_speech, start);
+		ast_debug(1, "(%s) Created batched speech resource\n", vosk_speech->name);
+		return 0;
+	}
+#endif
+
+	vosk_speech->sender = &vosk_senders[ast_atomic_fetch_add(&vosk_sender_next, 1, __ATOMIC_RELAXED) % vosk_sender_count];
+
+	if (vosk_speech->ws) {
+		ast_debug(1, "(%s) Attached to prewarmed connection %s\n", vosk_speech->name, vosk_speech->backend->url);
+	} else {
+		vosk_backend_t *failed;
+		size_t attempts = AST_VECTOR_SIZE(&vosk_speech->engine->backends);
+
+		/* A backend that cannot be reached hands the session to the next one */
+		while (attempts--) {
+			ast_debug(1, "(%s) Create speech resource %s\n",vosk_speech->name, vosk_speech->backend->url);
+			vosk_speech->ws = vosk_pool_checkout(&vosk_speech->backend->pool);
+			if (vosk_speech->ws) {
+				break;
+			}
+			vosk_backend_release(vosk_speech->engine, vosk_speech->backend);
+			failed = vosk_speech->backend;
+			vosk_speech->backend = vosk_backend_acquire(vosk_speech->engine, failed);
+			if (!vosk_speech->backend || vosk_speech->backend == failed) {
+				break;
+			}
+		}
+		if (!vosk_speech->ws) {
+			ast_log(LOG_WARNING, "(%s) No backend could be reached\n", vosk_speech->name);
+			vosk_admission_report(VOSK_ADMISSION_UNAVAILABLE);
+			vosk_backend_release(vosk_speech->engine, vosk_speech->backend);
+			vosk_speech->backend = NULL;
+			ao2_ref(vosk_speech, -1);
+			speech->data = NULL;
+			return -1;
+		}
+	}
+
+	if (vosk_reader_register(vosk_speech)) {
+		vosk_admission_report(VOSK_ADMISSION_UNAVAILABLE);
+		vosk_disconnect(vosk_speech->ws);
+		vosk_speech->ws = NULL;
+		vosk_backend_release(vosk_speech->engine, vosk_speech->backend);
+		vosk_speech->backend = NULL;
+		ao2_ref(vosk_speech, -1);
+		speech->data = NULL;
+		return -1;
+	}
+
+	vosk_admission_report(admission);
+	vosk_speech_created(vosk_speech, start);
+	ast_debug(1, "(%s) Created speech resource\n", vosk_speech->name);
+
+	return 0;
+}
+
+/** \brief Destroy any data set on the speech structure by the engine */
+static int vosk_recog_destroy(struct ast_speech *speech)
+{
+	const char *eof = "{\"eof\" : 1}";
+
+	vosk_speech_t *vosk_speech = speech->data;
+	struct ast_websocket *ws, *hedge_ws;
+	vosk_backend_t *backend, *hedge_backend;
+
+	ast_debug(1, "(%s) Destroy speech resource\n",vosk_speech->name);
+	if (vosk_speech->suppressed) {
+		ast_debug(1, "(%s) Held back %u ms of silence\n", vosk_speech->name,
+			(unsigned int) (vosk_speech->suppressed / vosk_speech->bytes_per_ms));
+	}
+	vosk_capture_cut(vosk_speech, 1);
+
+#ifdef HAVE_VOSK_API
+	if (vosk_speech->recognizer) {
+		/* A decoder may still hold the session, it frees the recognizer last */
+		__atomic_store_n(&vosk_speech->closed, 1, __ATOMIC_RELEASE);
+		ao2_ref(vosk_speech, -1);
+		return 0;
+	}
+	if (vosk_speech->batch_recognizer) {
+		vosk_batch_close(vosk_speech);
+		return 0;
+	}
+#endif
+
+	/* Take the connections away from the reader and sender threads */
+	ao2_lock(vosk_speech);
+	vosk_speech->closed = 1;
+	ws = vosk_speech->ws;
+	backend = vosk_speech->backend;
+	hedge_ws = vosk_speech->hedge_ws;
+	hedge_backend = vosk_speech->hedge_backend;
+	vosk_speech->ws = NULL;
+	vosk_speech->backend = NULL;
+	vosk_speech->hedge_ws = NULL;
+	vosk_speech->hedge_backend = NULL;
+	if (hedge_ws && vosk_speech->reader) {
+		epoll_ctl(vosk_speech->reader->epfd, EPOLL_CTL_DEL, ast_websocket_fd(hedge_ws), NULL);
+	}
+	vosk_reader_unregister(vosk_speech, ws);
+	ao2_unlock(vosk_speech);
+
+	if (hedge_ws) {
+		vosk_disconnect(hedge_ws);
+		vosk_backend_release(vosk_speech->engine, hedge_backend);
+	}
+
+	if (ws) {
+		int fd = ast_websocket_fd(ws);
+		if (fd > 0) {
+			ao2_lock(ws);
+			/* After half a frame the server cannot make sense of a goodbye */
+			if (!vosk_wsout_find(vosk_speech, ws)) {
+				ast_websocket_write_string(ws, eof);
+				ast_websocket_close(ws, 1000);
+			}
+			ao2_unlock(ws);
+			shutdown(fd, SHUT_RDWR);
+		}
+		ast_websocket_unref(ws);
+	}
+	vosk_backend_release(vosk_speech->engine, backend);
+	ao2_ref(vosk_speech, -1);
+
+	return 0;
+}
+
+/*! \brief Stop the in-progress recognition */
+static int vosk_recog_stop(struct ast_speech *speech)
+{
+	vosk_speech_t *vosk_speech = speech->data;
+	ast_debug(1, "(%s) Stop recognition\n",vosk_speech->name);
+	ast_speech_change_state(speech, AST_SPEECH_STATE_NOT_READY);
+	return 0;
+}
+
+/*! \brief Load a local grammar on the speech structure */
+static int vosk_recog_load_grammar(struct ast_speech *speech, const char *grammar_name, const char *grammar_path)
+{
+	return 0;
+}
+
+/** \brief Unload a local grammar */
+static int vosk_recog_unload_grammar(struct ast_speech *speech, const char *grammar_name)
+{
+	return 0;
+}
+
+/** \brief Activate a loaded grammar */
+static int vosk_recog_activate_grammar(struct ast_speech *speech, const char *grammar_name)
+{
+	return 0;
+}
+
+/** \brief Deactivate a loaded grammar */
+static int vosk_recog_deactivate_grammar(struct ast_speech *speech, const char *grammar_name)
+{
+	return 0;
+}
+
+/** \brief Write audio to the speech engine */
+static int vosk_recog_write(struct ast_speech *speech, void *data, int len)
+{
+	vosk_speech_t *vosk_speech = speech->data;
+
+	if (len > 0 && !vosk_speech->endpointed && !__atomic_load_n(&vosk_speech->failed, __ATOMIC_ACQUIRE)) {
+		size_t size = len;
+		const char *audio = vosk_speech_convert(vosk_speech, data, &size);
+		uint32_t power = 0;
+
+		if (size) {
+			/* Captured ahead of the gate, a replay goes through the same decisions */
+			if (vosk_speech->capture) {
+				vosk_capture_audio(vosk_speech->capture, audio, size);
+			}
+			if (vosk_speech->engine->vad_threshold || vosk_speech->endpoint_silence) {
+				power = vosk_dsp_power((const int16_t *) audio, size / sizeof(int16_t));
+			}
+			if (vosk_speech_voiced(vosk_speech, power)) {
+				int64_t now = vosk_now_ms();
+
+				__atomic_store_n(&vosk_speech->last_speech, now, __ATOMIC_RELEASE);
+				/* The reader only ever moves a set onset to -1 */
+				if (!__atomic_load_n(&vosk_speech->speech_onset, __ATOMIC_RELAXED)) {
+					__atomic_store_n(&vosk_speech->speech_onset, now, __ATOMIC_RELEASE);
+					__atomic_fetch_add(&vosk_speech_stats(vosk_speech)->utterances, 1, __ATOMIC_RELAXED);
+				}
+			}
+			if (vosk_speech_gate(vosk_speech, audio, size, power)) {
+				vosk_speech_queue_audio(vosk_speech, audio, size);
+			}
+			vosk_speech_endpoint(vosk_speech, size, power);
+		}
+	}
+
+	/* Results are read by the reader thread, only pick up its verdict here */
+	if (__atomic_exchange_n(&vosk_speech->done, 0, __ATOMIC_ACQ_REL)) {
+		ast_speech_change_state(speech, AST_SPEECH_STATE_DONE);
+	} else if (vosk_speech->engine->hedge_delay || vosk_speech->engine->hedge_final_delay) {
+		vosk_speech_hedge_check(vosk_speech);
+	}
+
+	return 0;
+}
+
+/** \brief Signal DTMF was received */
+static int vosk_recog_dtmf(struct ast_speech *speech, const char *dtmf)
+{
+	vosk_speech_t *vosk_speech = speech->data;
+	ast_verb(4, "(%s) Signal DTMF %s\n",vosk_speech->name,dtmf);
+	return 0;
+}
+
+/** brief Prepare engine to accept audio */
+static int vosk_recog_start(struct ast_speech *speech)
+{
+	vosk_speech_t *vosk_speech = speech->data;
+	ast_debug(1, "(%s) Start recognition\n",vosk_speech->name);
+	/* The previous utterance ends here, with whatever result it got */
+	vosk_capture_cut(vosk_speech, 0);
+	if (vosk_speech->dirty) {
+		vosk_speech_reset(vosk_speech);
+	}
+	vosk_speech->endpoint_voiced = 0;
+	vosk_speech->endpoint_trailing = 0;
+	vosk_speech->endpointed = 0;
+	vosk_speech->hedged = 0;
+	__atomic_store_n(&vosk_speech->speech_onset, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&vosk_speech->last_speech, 0, __ATOMIC_RELEASE);
+	ast_speech_change_state(speech, AST_SPEECH_STATE_READY);
+	return 0;
+}
+
+/** \brief Change an engine specific setting */
+static int vosk_recog_change(struct ast_speech *speech, const char *name, const char *value)
+{
+	vosk_speech_t *vosk_speech = speech->data;
+	ast_debug(1, "(%s) Change setting name: %s value:%s\n",vosk_speech->name,name,value);
+	if (!strcasecmp(name, "endpoint_silence")) {
+		vosk_speech->endpoint_silence = MAX(atoi(value), 0);
+	} else if (!strcasecmp(name, "endpoint_threshold")) {
+		vosk_speech->endpoint_threshold = MIN(MAX(atoi(value), 0), 32767);
+	}
+	return 0;
+}
+
+/** \brief Get an engine specific attribute */
+static int vosk_recog_get_settings(struct ast_speech *speech, const char *name, char *buf, size_t len)
+{
+	vosk_speech_t *vosk_speech = speech->data;
+	ast_debug(1, "(%s) Get settings name: %s\n",vosk_speech->name,name);
+	if (!strcasecmp(name, "endpoint_silence")) {
+		snprintf(buf, len, "%d", vosk_speech->endpoint_silence);
+		return 0;
+	}
+	if (!strcasecmp(name, "endpoint_threshold")) {
+		snprintf(buf, len, "%d", vosk_speech->endpoint_threshold);
+		return 0;
+	}
+	return -1;
+}
+
+/** \brief Change the type of results we want back */
+static int vosk_recog_change_results_type(struct ast_speech *speech,enum ast_speech_results_type results_type)
+{
+	return -1;
+}
+
+/** \brief Try to get result */
+struct ast_speech_result* vosk_recog_get(struct ast_speech *speech)
+{
+	struct ast_speech_result *speech_result;
+
+	vosk_speech_t *vosk_speech = speech->data;
+	speech_result = ast_calloc(sizeof(struct ast_speech_result), 1);
+	ao2_lock(vosk_speech);
+	speech_result->text = ast_strlen_zero(vosk_speech->last_result) ? NULL : ast_strdup(vosk_speech->last_result);
+	speech_result->score = vosk_speech->last_conf * 100;
+	ao2_unlock(vosk_speech);
+
+	ast_set_flag(speech, AST_SPEECH_HAVE_RESULTS);
+	return speech_result;
+}
+
+/* Media formats taken by every engine */
+static struct ast_format_cap *vosk_formats;
+
+/** \brief Speech engine declaration, every configured engine registers a copy under its own name */
+static const struct ast_speech_engine vosk_speech_engine = {
+	.create = vosk_recog_create,
+	.destroy = vosk_recog_destroy,
+	.load = vosk_recog_load_grammar,
+	.unload = vosk_recog_unload_grammar,
+	.activate = vosk_recog_activate_grammar,
+	.deactivate = vosk_recog_deactivate_grammar,
+	.write = vosk_recog_write,
+	.dtmf = vosk_recog_dtmf,
+	.start = vosk_recog_start,
+	.change = vosk_recog_change,
+	.get_setting = vosk_recog_get_settings,
+	.change_results_type = vosk_recog_change_results_type,
+	.get = vosk_recog_get,
+};
+
+/** \brief Show backends and their session counts */
+static char *handle_cli_vosk_show_backends(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	size_t n, i;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "vosk show backends";
+		e->usage =
+			"Usage: vosk show backends\n"
+			"       Show the server backends of every Vosk engine with their\n"
+			"       active session counts and the state of their circuit breakers.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3) {
+		return CLI_SHOWUSAGE;
+	}
+
+#define FORMAT "%-16s %-40s %6s %8s %8s %6s %10s %-9s %6s\n"
+#define FORMAT2 "%-16s %-40s %6d %8d %8d %6d %10u %-9s %6u\n"
+	ast_cli(a->fd, FORMAT, "Engine", "URL", "Weight", "MaxSess", "Active", "Idle", "Total", "Breaker", "Trips");
+	for (n = 0; n < AST_VECTOR_SIZE(&vosk_engines); n++) {
+		vosk_engine_t *engine = AST_VECTOR_GET(&vosk_engines, n);
+
+		if (engine->mode != VOSK_MODE_SERVER) {
+			continue;
+		}
+		ast_mutex_lock(&engine->lock);
+		for (i = 0; i < AST_VECTOR_SIZE(&engine->backends); i++) {
+			vosk_backend_t *backend = AST_VECTOR_GET(&engine->backends, i);
+
+			ast_cli(a->fd, FORMAT2, engine->name, backend->url, backend->weight, backend->max_sessions,
+				backend->active, backend->pool.idle_count, backend->total,
+				vosk_breaker_state_str(backend->state), backend->trips);
+		}
+		ast_mutex_unlock(&engine->lock);
+	}
+#undef FORMAT
+#undef FORMAT2
+
+	return CLI_SUCCESS;
+}
+
+/** \brief Print the statistics of one backend */
+static void vosk_cli_show_stats(int fd, vosk_engine_t *engine, const char *name, vosk_stats_t *stats)
+{
+	const struct {
+		const char *name;
+		vosk_hist_t *hist;
+	} hists[] = {
+		{ "connect", &stats->connect },
+		{ "first_partial", &stats->first_partial },
+		{ "final_latency", &stats->final_latency },
+	};
+	size_t i;
+
+#define FORMAT "  %-14s %10s %8s %8s %8s %8s %8s\n"
+#define FORMAT2 "  %-14s %10" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n"
+	ast_cli(fd, "%s: %" PRIu64 " sessions, %" PRIu64 " failed over, %" PRIu64 " bytes in %" PRIu64 " frames\n", name,
+		__atomic_load_n(&stats->sessions, __ATOMIC_RELAXED),
+		__atomic_load_n(&stats->failovers, __ATOMIC_RELAXED),
+		__atomic_load_n(&stats->bytes, __ATOMIC_RELAXED),
+		__atomic_load_n(&stats->frames, __ATOMIC_RELAXED));
+	if (engine->hedge_delay || engine->hedge_final_delay) {
+		uint64_t utterances = __atomic_load_n(&stats->utterances, __ATOMIC_RELAXED);
+		uint64_t hedges = __atomic_load_n(&stats->hedges, __ATOMIC_RELAXED);
+
+		ast_cli(fd, "  %" PRIu64 " utterances, %" PRIu64 " hedged (%.1f%%, budget %d%%), %" PRIu64 " won by the hedge\n",
+			utterances, hedges, utterances ? 100.0 * hedges / utterances : 0.0, engine->hedge_budget,
+			__atomic_load_n(&stats->hedge_wins, __ATOMIC_RELAXED));
+	}
+	ast_cli(fd, FORMAT, "Latency (ms)", "Count", "Mean", "P50", "P90", "P99", "Max");
+	for (i = 0; i < ARRAY_LEN(hists); i++) {
+		ast_cli(fd, FORMAT2, hists[i].name, vosk_hist_count(hists[i].hist), vosk_hist_mean(hists[i].hist),
+			vosk_hist_percentile(hists[i].hist, 50), vosk_hist_percentile(hists[i].hist, 90),
+			vosk_hist_percentile(hists[i].hist, 99), vosk_hist_max(hists[i].hist));
+	}
+#undef FORMAT
+#undef FORMAT2
+}
+
+/** \brief vosk show stats */
+static char *handle_cli_vosk_show_stats(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	size_t n, i;
+
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "vosk show stats";
+		e->usage =
+			"Usage: vosk show stats\n"
+			"       Show admission counts per Vosk engine, and session counts,\n"
+			"       audio volume and latency percentiles per backend.\n";
+		return NULL;
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	if (a->argc != 3) {
+		return CLI_SHOWUSAGE;
+	}
+
+	/* Engines and their backends never go away while the module is loaded */
+	for (n = 0; n < AST_VECTOR_SIZE(&vosk_engines); n++) {
+		vosk_engine_t *engine = AST_VECTOR_GET(&vosk_engines, n);
+
+		ast_mutex_lock(&engine->lock);
+		ast_cli(a->fd, "Engine %s admission: %d open (limit %d), %d waiting (limit %d); %" PRIu64 " admitted, "
+			"%" PRIu64 " after waiting, %" PRIu64 " rejected, %" PRIu64 " timed out, %" PRIu64 " unavailable\n",
+			engine->name, engine->sessions, engine->max_sessions, engine->waiting, engine->admission_queue,
+			engine->admissions[VOSK_ADMISSION_ADMITTED], engine->admissions[VOSK_ADMISSION_QUEUED],
+			engine->admissions[VOSK_ADMISSION_REJECTED], engine->admissions[VOSK_ADMISSION_TIMEOUT],
+			engine->admissions[VOSK_ADMISSION_UNAVAILABLE]);
+		ast_mutex_unlock(&engine->lock);
+
+		if (engine->mode != VOSK_MODE_SERVER) {
+			vosk_cli_show_stats(a->fd, engine, "local", &engine->local_stats);
+			continue;
+		}
+		for (i = 0; i < AST_VECTOR_SIZE(&engine->backends); i++) {
+			vosk_backend_t *backend = AST_VECTOR_GET(&engine->backends, i);
+
+			vosk_cli_show_stats(a->fd, engine, backend->url, &backend->stats);
+		}
+	}
+
+	return CLI_SUCCESS;
+}
+
+static struct ast_cli_entry vosk_cli[] = {
+	AST_CLI_DEFINE(handle_cli_vosk_show_backends, "Show Vosk server backends"),
+	AST_CLI_DEFINE(handle_cli_vosk_show_stats, "Show Vosk recognition statistics"),
+};
+
+/** \brief Append one VoskStats event */
+static void vosk_manager_append_stats(struct mansession *s, const char *idtext, vosk_engine_t *engine,
+	const char *name, vosk_stats_t *stats)
+{
+	const struct {
+		const char *name;
+		vosk_hist_t *hist;
+	} hists[] = {
+		{ "Connect", &stats->connect },
+		{ "FirstPartial", &stats->first_partial },
+		{ "FinalLatency", &stats->final_latency },
+	};
+	size_t i;
+
+	astman_append(s,
+		"Event: VoskStats\r\n"
+		"%s"
+		"Engine: %s\r\n"
+		"Backend: %s\r\n"
+		"Sessions: %" PRIu64 "\r\n"
+		"Failovers: %" PRIu64 "\r\n"
+		"Utterances: %" PRIu64 "\r\n"
+		"Hedges: %" PRIu64 "\r\n"
+		"HedgeWins: %" PRIu64 "\r\n"
+		"HedgeBudget: %d\r\n"
+		"Bytes: %" PRIu64 "\r\n"
+		"Frames: %" PRIu64 "\r\n",
+		idtext, engine->name, name,
+		__atomic_load_n(&stats->sessions, __ATOMIC_RELAXED),
+		__atomic_load_n(&stats->failovers, __ATOMIC_RELAXED),
+		__atomic_load_n(&stats->utterances, __ATOMIC_RELAXED),
+		__atomic_load_n(&stats->hedges, __ATOMIC_RELAXED),
+		__atomic_load_n(&stats->hedge_wins, __ATOMIC_RELAXED),
+		engine->hedge_budget,
+		__atomic_load_n(&stats->bytes, __ATOMIC_RELAXED),
+		__atomic_load_n(&stats->frames, __ATOMIC_RELAXED));
+	for (i = 0; i < ARRAY_LEN(hists); i++) {
+		astman_append(s,
+			"%sCount: %" PRIu64 "\r\n"
+			"%sMean: %" PRIu64 "\r\n"
+			"%sP50: %" PRIu64 "\r\n"
+			"%sP90: %" PRIu64 "\r\n"
+			"%sP99: %" PRIu64 "\r\n"
+			"%sMax: %" PRIu64 "\r\n",
+			hists[i].name, vosk_hist_count(hists[i].hist),
+			hists[i].name, vosk_hist_mean(hists[i].hist),
+			hists[i].name, vosk_hist_percentile(hists[i].hist, 50),
+			hists[i].name, vosk_hist_percentile(hists[i].hist, 90),
+			hists[i].name, vosk_hist_percentile(hists[i].hist, 99),
+			hists[i].name, vosk_hist_max(hists[i].hist));
+	}
+	astman_append(s, "\r\n");
+}
+
+/** \brief VoskShowStats manager action */
+static int manager_vosk_show_stats(struct mansession *s, const struct message *m)
+{
+	const char *id = astman_get_header(m, "ActionID");
+	char idtext[256] = "";
+	int count = 0;
+	size_t n, i;
+
+	if (!ast_strlen_zero(id)) {
+		snprintf(idtext, sizeof(idtext), "ActionID: %s\r\n", id);
+	}
+
+	astman_send_listack(s, m, "Vosk statistics will follow", "start");
+	for (n = 0; n < AST_VECTOR_SIZE(&vosk_engines); n++) {
+		vosk_engine_t *engine = AST_VECTOR_GET(&vosk_engines, n);
+
+		if (engine->mode != VOSK_MODE_SERVER) {
+			vosk_manager_append_stats(s, idtext, engine, "local", &engine->local_stats);
+			count++;
+			continue;
+		}
+		for (i = 0; i < AST_VECTOR_SIZE(&engine->backends); i++) {
+			vosk_backend_t *backend = AST_VECTOR_GET(&engine->backends, i);
+
+			vosk_manager_append_stats(s, idtext, engine, backend->url, &backend->stats);
+			count++;
+		}
+	}
+	astman_send_list_complete_start(s, m, "VoskStatsComplete", count);
+	astman_send_list_complete_end(s);
+
+	return 0;
+}
+
+/** \brief Add a backend to the engine */
+static int vosk_engine_add_backend(vosk_engine_t *engine, const char *definition)
+{
+	vosk_backend_t *backend = vosk_backend_alloc(definition);
+
+	if (!backend) {
+		return -1;
+	}
+	backend->engine = engine;
+	if (AST_VECTOR_APPEND(&engine->backends, backend)) {
+		vosk_backend_free(backend);
+		return -1;
+	}
+	return 0;
+}
+
+/*!
+ * \brief Backend health probe thread
+ *
+ * Opens and closes a connection to every backend each health_interval,
+ * so a dead host stalls this thread rather than a channel. Failed probes
+ * count against the circuit breaker, a good one lets an open breaker try
+ * a session.
+ */
+static void *vosk_health_thread(void *data)
+{
+	vosk_engine_t *engine = data;
+	struct timeval wait;
+	struct timespec ts;
+	size_t i;
+
+	ast_mutex_lock(&engine->lock);
+	while (!engine->health_stop) {
+		for (i = 0; i < AST_VECTOR_SIZE(&engine->backends) && !engine->health_stop; i++) {
+			vosk_backend_t *backend = AST_VECTOR_GET(&engine->backends, i);
+			struct ast_websocket *ws;
+
+			ast_mutex_unlock(&engine->lock);
+			ws = vosk_connect(backend->url, NULL, engine->connect_timeout);
+			if (ws) {
+				vosk_disconnect(ws);
+				vosk_backend_success(engine, backend, 0);
+			} else {
+				vosk_backend_failure(engine, backend, "health probe failed");
+			}
+			ast_mutex_lock(&engine->lock);
+		}
+		if (engine->health_stop) {
+			break;
+		}
+		wait = ast_tvadd(ast_tvnow(), ast_samp2tv(engine->health_interval, 1000));
+		ts.tv_sec = wait.tv_sec;
+		ts.tv_nsec = wait.tv_usec * 1000;
+		ast_cond_timedwait(&engine->health_cond, &engine->lock, &ts);
+	}
+	ast_mutex_unlock(&engine->lock);
+
+	return NULL;
+}
+
+/** \brief Start connection pools of all backends and their health probes */
+static void vosk_engine_start(vosk_engine_t *engine)
+{
+	size_t i;
+
+	for (i = 0; i < AST_VECTOR_SIZE(&engine->backends); i++) {
+		vosk_backend_t *backend = AST_VECTOR_GET(&engine->backends, i);
+
+		backend->pool.min_size = engine->pool_min;
+		/* Local mode never talks to a server, keep the pools empty */
+		backend->pool.max_size = engine->mode != VOSK_MODE_SERVER ? 0 : engine->pool_max;
+		backend->pool.idle_timeout = engine->pool_idle_timeout;
+		backend->pool.connect_timeout = engine->connect_timeout;
+		vosk_pool_start(&backend->pool, backend, engine->ws_config);
+	}
+
+	if (engine->mode != VOSK_MODE_SERVER || engine->health_interval <= 0) {
+		return;
+	}
+	if (ast_pthread_create_background(&engine->health_thread, NULL, vosk_health_thread, engine)) {
+		ast_log(LOG_WARNING, "Failed to start backend health probes\n");
+		engine->health_thread = AST_PTHREADT_NULL;
+	}
+}
+
+/** \brief Stop health probes and connection pools */
+static void vosk_engine_stop(vosk_engine_t *engine)
+{
+	size_t i;
+
+	if (engine->health_thread != AST_PTHREADT_NULL) {
+		ast_mutex_lock(&engine->lock);
+		engine->health_stop = 1;
+		ast_cond_signal(&engine->health_cond);
+		ast_mutex_unlock(&engine->lock);
+		pthread_join(engine->health_thread, NULL);
+		engine->health_thread = AST_PTHREADT_NULL;
+	}
+
+	for (i = 0; i < AST_VECTOR_SIZE(&engine->backends); i++) {
+		vosk_pool_stop(&AST_VECTOR_GET(&engine->backends, i)->pool);
+	}
+}
+
+/** \brief Free an engine and its backends, stopped or never started */
+static void vosk_engine_free(vosk_engine_t *engine)
+{
+	size_t i;
+
+#ifdef HAVE_VOSK_API
+	vosk_batch_unload(engine);
+	vosk_local_unload(engine);
+#endif
+	for (i = 0; i < AST_VECTOR_SIZE(&engine->backends); i++) {
+		vosk_backend_free(AST_VECTOR_GET(&engine->backends, i));
+	}
+	AST_VECTOR_FREE(&engine->backends);
+	ast_free(engine->model_path);
+	ast_json_free(engine->ws_config);
+	ast_cond_destroy(&engine->health_cond);
+	ast_mutex_destroy(&engine->lock);
+	ast_free(engine->name);
+	ast_free(engine);
+}
+
+/** \brief Free all configured engines */
+static void vosk_engines_free(void)
+{
+	size_t i;
+
+	for (i = 0; i < AST_VECTOR_SIZE(&vosk_engines); i++) {
+		vosk_engine_free(AST_VECTOR_GET(&vosk_engines, i));
+	}
+	AST_VECTOR_FREE(&vosk_engines);
+}
+
+/** \brief Option of an engine section, [general] provides the defaults */
+static const char *vosk_config_get(struct ast_config *cfg, const char *section, const char *name)
+{
+	const char *value = ast_variable_retrieve(cfg, section, name);
+
+	if (!value && strcasecmp(section, "general")) {
+		value = ast_variable_retrieve(cfg, "general", name);
+	}
+	return value;
+}
+
+/*!
+ * \brief Load one engine from its configuration section
+ *
+ * Options the section does not set are taken from [general]. The servers
+ * go together: a section without url and backend lines uses url, backend
+ * and hedge_url of [general].
+ */
+static vosk_engine_t *vosk_engine_load(struct ast_config *cfg, const char *name, const char *section)
+{
+	const char *value = NULL;
+	const char *servers = section;
+	struct ast_variable *var;
+	vosk_engine_t *engine;
+
+	engine = ast_calloc(1, sizeof(*engine));
+	if (!engine) {
+		return NULL;
+	}
+	engine->name = ast_strdup(name);
+	engine->speech = vosk_speech_engine;
+	engine->speech.name = engine->name;
+	engine->speech.formats = vosk_formats;
+	ast_mutex_init(&engine->lock);
+	ast_cond_init(&engine->health_cond, NULL);
+	AST_LIST_HEAD_INIT_NOLOCK(&engine->waiters);
+	engine->sessions = 0;
+	engine->waiting = 0;
+	memset(engine->admissions, 0, sizeof(engine->admissions));
+	engine->health_thread = AST_PTHREADT_NULL;
+	engine->health_stop = 0;
+	AST_VECTOR_INIT(&engine->backends, 1);
+
+	engine->mode = VOSK_MODE_SERVER;
+	if((value = vosk_config_get(cfg, section, "mode")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.mode=%s\n", section, value);
+		if (!strcasecmp(value, "local")) {
+			engine->mode = VOSK_MODE_LOCAL;
+		} else if (!strcasecmp(value, "batch")) {
+			engine->mode = VOSK_MODE_BATCH;
+		} else if (strcasecmp(value, "server")) {
+			ast_log(LOG_WARNING, "Unknown mode '%s', using server\n", value);
+		}
+	}
+	if((value = vosk_config_get(cfg, section, "model")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.model=%s\n", section, value);
+		engine->model_path = ast_strdup(value);
+	}
+	if (engine->mode != VOSK_MODE_SERVER) {
+#ifdef HAVE_VOSK_API
+		if (ast_strlen_zero(engine->model_path)) {
+			ast_log(LOG_ERROR, "Engine %s: local mode requires a model path\n", name);
+			vosk_engine_free(engine);
+			return NULL;
+		}
+#else
+		ast_log(LOG_ERROR, "Engine %s: local mode requires the module to be built with libvosk\n", name);
+		vosk_engine_free(engine);
+		return NULL;
+#endif
+	}
+
+	if (!ast_variable_retrieve(cfg, section, "url") && !ast_variable_retrieve(cfg, section, "backend")) {
+		servers = "general";
+	}
+	/* A plain url is a backend with default weight and no session limit */
+	if((value = ast_variable_retrieve(cfg, servers, "url")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.url=%s\n", servers, value);
+		vosk_engine_add_backend(engine, value);
+	}
+	for (var = ast_variable_browse(cfg, servers); var; var = var->next) {
+		if (!strcasecmp(var->name, "backend")) {
+			ast_log(LOG_DEBUG, "%s.backend=%s\n", servers, var->value);
+			vosk_engine_add_backend(engine, var->value);
+		}
+	}
+	if (!AST_VECTOR_SIZE(&engine->backends)) {
+		vosk_engine_add_backend(engine, "ws://localhost");
+	}
+	/* Standby backend, only ever takes hedges */
+	if((value = ast_variable_retrieve(cfg, servers, "hedge_url")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.hedge_url=%s\n", servers, value);
+		if (!vosk_engine_add_backend(engine, value)) {
+			AST_VECTOR_GET(&engine->backends, AST_VECTOR_SIZE(&engine->backends) - 1)->standby = 1;
+		}
+	}
+
+	engine->pool_min = VOSK_POOL_MIN_SIZE;
+	engine->pool_max = VOSK_POOL_MAX_SIZE;
+	engine->pool_idle_timeout = VOSK_POOL_IDLE_TIMEOUT;
+	if((value = vosk_config_get(cfg, section, "pool_min")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.pool_min=%s\n", section, value);
+		engine->pool_min = atoi(value);
+	}
+	if((value = vosk_config_get(cfg, section, "pool_max")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.pool_max=%s\n", section, value);
+		engine->pool_max = atoi(value);
+	}
+	if((value = vosk_config_get(cfg, section, "pool_idle_timeout")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.pool_idle_timeout=%s\n", section, value);
+		engine->pool_idle_timeout = atoi(value);
+	}
+	if (engine->pool_min < 0) {
+		engine->pool_min = 0;
+	}
+	if (engine->pool_max < engine->pool_min) {
+		engine->pool_max = engine->pool_min;
+	}
+	engine->connect_timeout = VOSK_CONNECT_TIMEOUT;
+	if((value = vosk_config_get(cfg, section, "connect_timeout")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.connect_timeout=%s\n", section, value);
+		engine->connect_timeout = atoi(value);
+	}
+	if (engine->connect_timeout <= 0) {
+		engine->connect_timeout = VOSK_CONNECT_TIMEOUT;
+	}
+
+	engine->max_sessions = VOSK_MAX_SESSIONS;
+	engine->admission_queue = VOSK_ADMISSION_QUEUE_SIZE;
+	engine->admission_timeout = VOSK_ADMISSION_WAIT;
+	if((value = vosk_config_get(cfg, section, "max_sessions")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.max_sessions=%s\n", section, value);
+		engine->max_sessions = MAX(atoi(value), 0);
+	}
+	if((value = vosk_config_get(cfg, section, "admission_queue")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.admission_queue=%s\n", section, value);
+		engine->admission_queue = MAX(atoi(value), 0);
+	}
+	if((value = vosk_config_get(cfg, section, "admission_timeout")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.admission_timeout=%s\n", section, value);
+		engine->admission_timeout = MAX(atoi(value), 0);
+	}
+
+	engine->breaker_failures = VOSK_BREAKER_FAILURES;
+	engine->breaker_cooldown = VOSK_BREAKER_COOLDOWN;
+	engine->breaker_latency = VOSK_BREAKER_LATENCY;
+	engine->health_interval = VOSK_HEALTH_INTERVAL;
+	if((value = vosk_config_get(cfg, section, "breaker_failures")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.breaker_failures=%s\n", section, value);
+		engine->breaker_failures = atoi(value);
+	}
+	if((value = vosk_config_get(cfg, section, "breaker_cooldown")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.breaker_cooldown=%s\n", section, value);
+		engine->breaker_cooldown = atoi(value);
+	}
+	if((value = vosk_config_get(cfg, section, "breaker_latency")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.breaker_latency=%s\n", section, value);
+		engine->breaker_latency = atoi(value);
+	}
+	if((value = vosk_config_get(cfg, section, "health_interval")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.health_interval=%s\n", section, value);
+		engine->health_interval = atoi(value);
+	}
+	if (engine->breaker_failures < 0) {
+		engine->breaker_failures = 0;
+	}
+	if (engine->breaker_cooldown < 0) {
+		engine->breaker_cooldown = 0;
+	}
+	if (engine->breaker_latency < 0) {
+		engine->breaker_latency = 0;
+	}
+
+	engine->send_buffer = VOSK_SEND_BUFFER;
+	engine->overflow_policy = VOSK_OVERFLOW_DROP_OLDEST;
+	if((value = vosk_config_get(cfg, section, "send_buffer")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.send_buffer=%s\n", section, value);
+		engine->send_buffer = atoi(value);
+	}
+	if (engine->send_buffer < 0) {
+		engine->send_buffer = 0;
+	}
+
+	engine->chunk_size = VOSK_CHUNK_SIZE;
+	engine->chunk_latency = VOSK_CHUNK_LATENCY;
+	if((value = vosk_config_get(cfg, section, "chunk_size")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.chunk_size=%s\n", section, value);
+		engine->chunk_size = atoi(value);
+	}
+	if((value = vosk_config_get(cfg, section, "chunk_latency")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.chunk_latency=%s\n", section, value);
+		engine->chunk_latency = atoi(value);
+	}
+	if (engine->chunk_size < VOSK_CHUNK_SIZE_MIN) {
+		engine->chunk_size = VOSK_CHUNK_SIZE_MIN;
+	} else if (engine->chunk_size > VOSK_CHUNK_SIZE_MAX) {
+		engine->chunk_size = VOSK_CHUNK_SIZE_MAX;
+	}
+	if (engine->chunk_latency < 0) {
+		engine->chunk_latency = 0;
+	}
+	if((value = vosk_config_get(cfg, section, "overflow_policy")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.overflow_policy=%s\n", section, value);
+		if (!strcasecmp(value, "drop_oldest")) {
+			engine->overflow_policy = VOSK_OVERFLOW_DROP_OLDEST;
+		} else if (!strcasecmp(value, "drop_session")) {
+			engine->overflow_policy = VOSK_OVERFLOW_DROP_SESSION;
+		} else if (!strcasecmp(value, "failover")) {
+			engine->overflow_policy = VOSK_OVERFLOW_FAILOVER;
+		} else {
+			ast_log(LOG_WARNING, "Unknown overflow_policy '%s', using drop_oldest\n", value);
+		}
+	}
+
+	engine->replay_buffer = VOSK_REPLAY_BUFFER;
+	if((value = vosk_config_get(cfg, section, "replay_buffer")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.replay_buffer=%s\n", section, value);
+		engine->replay_buffer = MAX(atoi(value), 0);
+	}
+
+	engine->hedge_delay = VOSK_HEDGE_DELAY;
+	engine->hedge_final_delay = VOSK_HEDGE_FINAL_DELAY;
+	engine->hedge_budget = VOSK_HEDGE_BUDGET;
+	if((value = vosk_config_get(cfg, section, "hedge_delay")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.hedge_delay=%s\n", section, value);
+		engine->hedge_delay = MAX(atoi(value), 0);
+	}
+	if((value = vosk_config_get(cfg, section, "hedge_final_delay")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.hedge_final_delay=%s\n", section, value);
+		engine->hedge_final_delay = MAX(atoi(value), 0);
+	}
+	if((value = vosk_config_get(cfg, section, "hedge_budget")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.hedge_budget=%s\n", section, value);
+		engine->hedge_budget = MIN(MAX(atoi(value), 0), 100);
+	}
+	if ((engine->hedge_delay || engine->hedge_final_delay) && !engine->replay_buffer) {
+		ast_log(LOG_WARNING, "Engine %s: hedging replays the utterance and needs replay_buffer, hedging disabled\n", name);
+		engine->hedge_delay = 0;
+		engine->hedge_final_delay = 0;
+	}
+
+	engine->sample_rate = VOSK_SAMPLE_RATE;
+	if((value = vosk_config_get(cfg, section, "sample_rate")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.sample_rate=%s\n", section, value);
+		engine->sample_rate = atoi(value);
+		if (engine->sample_rate != 8000 && engine->sample_rate != 16000) {
+			ast_log(LOG_WARNING, "Unsupported sample_rate %s, using %d\n", value, VOSK_SAMPLE_RATE);
+			engine->sample_rate = VOSK_SAMPLE_RATE;
+		}
+	}
+	if (engine->mode == VOSK_MODE_SERVER) {
+		struct ast_json *config = ast_json_pack("{s: {s: i}}", "config", "sample_rate", engine->sample_rate);
+		if (config) {
+			engine->ws_config = ast_json_dump_string(config);
+			ast_json_unref(config);
+		}
+	}
+
+	engine->partial_results = 1;
+	engine->partial_rate = 0;
+	if((value = vosk_config_get(cfg, section, "partial_results")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.partial_results=%s\n", section, value);
+		engine->partial_results = ast_true(value);
+	}
+	if((value = vosk_config_get(cfg, section, "partial_rate")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.partial_rate=%s\n", section, value);
+		engine->partial_rate = atoi(value);
+	}
+	if (engine->partial_rate < 0) {
+		engine->partial_rate = 0;
+	}
+
+	engine->vad_threshold = VOSK_VAD_THRESHOLD;
+	engine->vad_preroll = VOSK_VAD_PREROLL;
+	engine->vad_hangover = VOSK_VAD_HANGOVER;
+	if((value = vosk_config_get(cfg, section, "vad_threshold")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.vad_threshold=%s\n", section, value);
+		engine->vad_threshold = atoi(value);
+	}
+	if((value = vosk_config_get(cfg, section, "vad_preroll")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.vad_preroll=%s\n", section, value);
+		engine->vad_preroll = atoi(value);
+	}
+	if((value = vosk_config_get(cfg, section, "vad_hangover")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.vad_hangover=%s\n", section, value);
+		engine->vad_hangover = atoi(value);
+	}
+	if (engine->vad_threshold < 0 || engine->vad_threshold > 32767) {
+		ast_log(LOG_WARNING, "vad_threshold %d out of range, gate disabled\n", engine->vad_threshold);
+		engine->vad_threshold = 0;
+	}
+	if (engine->vad_preroll < 0) {
+		engine->vad_preroll = 0;
+	}
+	if (engine->vad_hangover < 0) {
+		engine->vad_hangover = 0;
+	}
+
+	engine->endpoint_silence = VOSK_ENDPOINT_SILENCE;
+	engine->endpoint_threshold = VOSK_ENDPOINT_THRESHOLD;
+	if((value = vosk_config_get(cfg, section, "endpoint_silence")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.endpoint_silence=%s\n", section, value);
+		engine->endpoint_silence = atoi(value);
+	}
+	if((value = vosk_config_get(cfg, section, "endpoint_threshold")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.endpoint_threshold=%s\n", section, value);
+		engine->endpoint_threshold = atoi(value);
+	}
+	if (engine->endpoint_silence < 0) {
+		engine->endpoint_silence = 0;
+	}
+	if (engine->endpoint_threshold < 0 || engine->endpoint_threshold > 32767) {
+		ast_log(LOG_WARNING, "endpoint_threshold %d out of range, using %d\n",
+			engine->endpoint_threshold, VOSK_ENDPOINT_THRESHOLD);
+		engine->endpoint_threshold = VOSK_ENDPOINT_THRESHOLD;
+	}
+
+	engine->batch_delay = VOSK_BATCH_DELAY;
+	engine->batch_size = VOSK_BATCH_SIZE;
+	if((value = vosk_config_get(cfg, section, "batch_delay")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.batch_delay=%s\n", section, value);
+		engine->batch_delay = atoi(value);
+	}
+	if((value = vosk_config_get(cfg, section, "batch_size")) != NULL) {
+		ast_log(LOG_DEBUG, "%s.batch_size=%s\n", section, value);
+		engine->batch_size = atoi(value);
+	}
+	if (engine->batch_delay < 0) {
+		engine->batch_delay = 0;
+	}
+	if (engine->batch_size < 1) {
+		engine->batch_size = 1;
+	}
+	return engine;
+}
+
+/** \brief Load an engine and add it to the configured ones */
+static int vosk_engines_add(struct ast_config *cfg, const char *name, const char *section)
+{
+	vosk_engine_t *engine = vosk_engine_load(cfg, name, section);
+
+	if (!engine) {
+		return -1;
+	}
+	if (AST_VECTOR_APPEND(&vosk_engines, engine)) {
+		vosk_engine_free(engine);
+		return -1;
+	}
+	return 0;
+}
+
+/*!
+ * \brief Load the configuration (/etc/asterisk/res_speech_vosk.conf)
+ *
+ * Every section but [general] is an engine of its own, named after the
+ * section. Without such sections [general] is the one engine, named
+ * VOSK_ENGINE_NAME. Threads and audio capture are shared by all engines
+ * and only set in [general].
+ */
+static int vosk_config_load(void)
+{
+	const char *value = NULL;
+	const char *section = NULL;
+	struct ast_flags config_flags = { 0 };
+	struct ast_config *cfg = ast_config_load(VOSK_ENGINE_CONFIG, config_flags);
+	int res = 0;
+
+	if(!cfg) {
+		ast_log(LOG_WARNING, "No such configuration file %s\n", VOSK_ENGINE_CONFIG);
+		return -1;
+	}
+
+	vosk_capture.percent = 100;
+	if((value = ast_variable_retrieve(cfg, "general", "capture_dir")) != NULL) {
+		ast_log(LOG_DEBUG, "general.capture_dir=%s\n", value);
+		vosk_capture.dir = ast_strdup(value);
+	}
+	if((value = ast_variable_retrieve(cfg, "general", "capture_percent")) != NULL) {
+		ast_log(LOG_DEBUG, "general.capture_percent=%s\n", value);
+		vosk_capture.percent = MIN(MAX(atoi(value), 0), 100);
+	}
+
+	if((value = ast_variable_retrieve(cfg, "general", "reader_threads")) != NULL) {
+		ast_log(LOG_DEBUG, "general.reader_threads=%s\n", value);
+		vosk_reader_count = atoi(value);
+	}
+	if((value = ast_variable_retrieve(cfg, "general", "sender_threads")) != NULL) {
+		ast_log(LOG_DEBUG, "general.sender_threads=%s\n", value);
+		vosk_sender_count = atoi(value);
+	}
+#ifdef HAVE_VOSK_API
+	if((value = ast_variable_retrieve(cfg, "general", "decoder_threads")) != NULL) {
+		ast_log(LOG_DEBUG, "general.decoder_threads=%s\n", value);
+		vosk_decoder_count = atoi(value);
+	}
+#endif
+
+	AST_VECTOR_INIT(&vosk_engines, 1);
+	while (!res && (section = ast_category_browse(cfg, section))) {
+		if (!strcasecmp(section, "general")) {
+			continue;
+		}
+		if (vosk_engine_find(section)) {
+			ast_log(LOG_WARNING, "Engine %s is configured twice, using the first section\n", section);
+			continue;
+		}
+		res = vosk_engines_add(cfg, section, section);
+	}
+	if (!res && !AST_VECTOR_SIZE(&vosk_engines)) {
+		res = vosk_engines_add(cfg, VOSK_ENGINE_NAME, "general");
+	}
+	ast_config_destroy(cfg);
+
+	if (res) {
+		vosk_engines_free();
+		ast_free(vosk_capture.dir);
+		vosk_capture.dir = NULL;
+	}
+	return res;
+}
+
+/*!
+ * \brief Unregister the first registered engines, stop all of them and the shared threads
+ *
+ * Every engine must have been started.
+ */
+static void vosk_engines_unload(size_t registered)
+{
+	size_t i;
+
+	for (i = 0; i < registered; i++) {
+		vosk_engine_t *engine = AST_VECTOR_GET(&vosk_engines, i);
+
+		if(ast_speech_unregister(engine->name)) {
+			ast_log(LOG_ERROR, "Failed to unregister engine %s\n", engine->name);
+		}
+	}
+
+#ifdef HAVE_VOSK_API
+	vosk_local_stop();
+#endif
+	vosk_capture_stop();
+	ast_free(vosk_capture.dir);
+	vosk_capture.dir = NULL;
+	for (i = 0; i < AST_VECTOR_SIZE(&vosk_engines); i++) {
+		vosk_engine_stop(AST_VECTOR_GET(&vosk_engines, i));
+	}
+	vosk_engines_free();
+	vosk_senders_stop();
+	vosk_readers_stop();
+	ao2_cleanup(vosk_formats);
+	vosk_formats = NULL;
+}
+
+/** \brief Load module */
+static int load_module(void)
+{
+	size_t i;
+
+	ast_log(LOG_NOTICE, "Load res_speech_vosk module\n");
+
+	vosk_formats = ast_format_cap_alloc(AST_FORMAT_CAP_FLAG_DEFAULT);
+	if(!vosk_formats) {
+		ast_log(LOG_ERROR, "Failed to alloc media format capabilities\n");
+		return AST_MODULE_LOAD_FAILURE;
+	}
+	/* G.711 is decoded and slin16 resampled in the module, no translation needed */
+	ast_format_cap_append(vosk_formats, ast_format_slin, 0);
+	ast_format_cap_append(vosk_formats, ast_format_slin16, 0);
+	ast_format_cap_append(vosk_formats, ast_format_ulaw, 0);
+	ast_format_cap_append(vosk_formats, ast_format_alaw, 0);
+
+	/* Load engine configuration */
+	if (vosk_config_load()) {
+		ao2_cleanup(vosk_formats);
+		vosk_formats = NULL;
+		return AST_MODULE_LOAD_DECLINE;
+	}
+
+	for (i = 0; i < AST_VECTOR_SIZE(&vosk_engines); i++) {
+		vosk_engine_start(AST_VECTOR_GET(&vosk_engines, i));
+	}
+	if (vosk_readers_start() || vosk_senders_start()) {
+		vosk_engines_unload(0);
+		return AST_MODULE_LOAD_FAILURE;
+	}
+	if (vosk_capture_start()) {
+		/* Recognition works without it */
+		ast_log(LOG_WARNING, "Audio capture disabled\n");
+	}
+
+#ifdef HAVE_VOSK_API
+	for (i = 0; i < AST_VECTOR_SIZE(&vosk_engines); i++) {
+		vosk_engine_t *engine = AST_VECTOR_GET(&vosk_engines, i);
+
+		if (engine->mode != VOSK_MODE_SERVER && vosk_local_start(engine)) {
+			vosk_engines_unload(0);
+			return AST_MODULE_LOAD_DECLINE;
+		}
+	}
+#endif
+
+	for (i = 0; i < AST_VECTOR_SIZE(&vosk_engines); i++) {
+		vosk_engine_t *engine = AST_VECTOR_GET(&vosk_engines, i);
+
+		if(ast_speech_register(&engine->speech)) {
+			ast_log(LOG_ERROR, "Failed to register engine %s\n", engine->name);
+			vosk_engines_unload(i);
+			return AST_MODULE_LOAD_FAILURE;
+		}
+		ast_verb(2, "Registered Vosk engine %s with %d backends\n", engine->name,
+			engine->mode == VOSK_MODE_SERVER ? (int) AST_VECTOR_SIZE(&engine->backends) : 0);
+	}
+
+	ast_cli_register_multiple(vosk_cli, ARRAY_LEN(vosk_cli));
+	ast_custom_function_register(&vosk_prewarm_function);
+	ast_custom_function_register(&vosk_admission_function);
+	ast_manager_register_xml("VoskShowStats", EVENT_FLAG_SYSTEM | EVENT_FLAG_REPORTING, manager_vosk_show_stats);
+
+	return AST_MODULE_LOAD_SUCCESS;
+}
+
+/** \brief Unload module */
+static int unload_module(void)
+{
+	ast_log(LOG_NOTICE, "Unload res_speech_vosk module\n");
+	ast_manager_unregister("VoskShowStats");
+	ast_custom_function_unregister(&vosk_admission_function);
+	ast_custom_function_unregister(&vosk_prewarm_function);
+	ast_cli_unregister_multiple(vosk_cli, ARRAY_LEN(vosk_cli));
+	vosk_engines_unload(AST_VECTOR_SIZE(&vosk_engines));
 	return 0;
 }
 
@@ -0,0 +1,228 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Audio kernels of the Vosk speech engine
+ */
+
+#include <string.h>
+
+#include "vosk_dsp.h"
+
+/* Eight lanes fill a 128 bit register with 16 bit samples */
+#define VOSK_DSP_LANES 8
+/* Bytes masked per step, a multiple of the key length */
+#define VOSK_DSP_MASK_BYTES 16
+
+typedef uint8_t v8qu __attribute__((vector_size(8)));
+typedef int16_t v8hi __attribute__((vector_size(16)));
+typedef int32_t v8si __attribute__((vector_size(32)));
+typedef int64_t v8di __attribute__((vector_size(64)));
+typedef uint8_t v16qu __attribute__((vector_size(16)));
+
+static const v8si v8si_zero = { 0 };
+
+/* Scalar references, also used for the tails */
+static inline int16_t ulaw_to_slin(uint8_t u)
+{
+	int t;
+
+	u = ~u;
+	t = (((u & 0x0f) << 3) + 0x84) << ((u >> 4) & 0x07);
+	return (u & 0x80) ? (0x84 - t) : (t - 0x84);
+}
+
+static inline int16_t alaw_to_slin(uint8_t a)
+{
+	int t, seg;
+
+	a ^= 0x55;
+	t = ((a & 0x0f) << 4) + 8;
+	seg = (a >> 4) & 0x07;
+	if (seg) {
+		t = (t + 0x100) << (seg - 1);
+	}
+	return (a & 0x80) ? t : -t;
+}
+
+/*
+ * Lane loads and stores. Macros rather than functions, passing 256 bit
+ * vectors by value would tie the ABI to the target's vector extensions.
+ */
+#define LOAD_U8(dst, src) do { \
+	v8qu __v; \
+	memcpy(&__v, (src), sizeof(__v)); \
+	(dst) = __builtin_convertvector(__v, v8si); \
+} while (0)
+
+#define LOAD_S16(dst, src) do { \
+	v8hi __v; \
+	memcpy(&__v, (src), sizeof(__v)); \
+	(dst) = __builtin_convertvector(__v, v8si); \
+} while (0)
+
+#define STORE_S16(dst, v) do { \
+	v8hi __h = __builtin_convertvector((v), v8hi); \
+	memcpy((dst), &__h, sizeof(__h)); \
+} while (0)
+
+void vosk_dsp_ulaw_decode(int16_t *dst, const uint8_t *src, size_t samples)
+{
+	size_t i = 0;
+
+	for (; i + VOSK_DSP_LANES <= samples; i += VOSK_DSP_LANES) {
+		v8si u, t, neg;
+
+		LOAD_U8(u, src + i);
+		u = ~u & 0xff;
+		t = (((u & 0x0f) << 3) + 0x84) << ((u >> 4) & 0x07);
+		/* All ones in lanes with the sign bit set */
+		neg = (u & 0x80) != v8si_zero;
+		STORE_S16(dst + i, ((t - 0x84) ^ neg) - neg);
+	}
+	for (; i < samples; i++) {
+		dst[i] = ulaw_to_slin(src[i]);
+	}
+}
+
+void vosk_dsp_alaw_decode(int16_t *dst, const uint8_t *src, size_t samples)
+{
+	size_t i = 0;
+
+	for (; i + VOSK_DSP_LANES <= samples; i += VOSK_DSP_LANES) {
+		v8si a, seg, has_seg, t, neg;
+
+		LOAD_U8(a, src + i);
+		a ^= 0x55;
+		seg = (a >> 4) & 0x07;
+		has_seg = seg != v8si_zero;
+		t = ((a & 0x0f) << 4) + 8;
+		/* Segment 0 is linear, the others carry the implicit leading one */
+		t = (t + (has_seg & 0x100)) << ((seg - 1) & has_seg);
+		/* A-law codes positive values with the sign bit set */
+		neg = (a & 0x80) == v8si_zero;
+		STORE_S16(dst + i, (t ^ neg) - neg);
+	}
+	for (; i < samples; i++) {
+		dst[i] = alaw_to_slin(src[i]);
+	}
+}
+
+void vosk_dsp_upsample2(int16_t *dst, const int16_t *src, size_t samples, int16_t *last)
+{
+	static const v8si lo = { 0, 8, 1, 9, 2, 10, 3, 11 };
+	static const v8si hi = { 4, 12, 5, 13, 6, 14, 7, 15 };
+	size_t i;
+
+	if (!samples) {
+		return;
+	}
+
+	/* The first sample pairs with the last one of the previous call */
+	dst[0] = (*last + src[0]) >> 1;
+	dst[1] = src[0];
+	for (i = 1; i + VOSK_DSP_LANES <= samples; i += VOSK_DSP_LANES) {
+		v8si cur, prev;
+
+		LOAD_S16(cur, src + i);
+		LOAD_S16(prev, src + i - 1);
+		prev = (prev + cur) >> 1;
+		STORE_S16(dst + 2 * i, __builtin_shuffle(prev, cur, lo));
+		STORE_S16(dst + 2 * i + VOSK_DSP_LANES, __builtin_shuffle(prev, cur, hi));
+	}
+	for (; i < samples; i++) {
+		dst[2 * i] = (src[i - 1] + src[i]) >> 1;
+		dst[2 * i + 1] = src[i];
+	}
+	*last = src[samples - 1];
+}
+
+void vosk_dsp_downsample2(int16_t *dst, const int16_t *src, size_t samples, int16_t *last)
+{
+	static const v8si even = { 0, 2, 4, 6, 8, 10, 12, 14 };
+	static const v8si odd = { 1, 3, 5, 7, 9, 11, 13, 15 };
+	size_t out = samples / 2;
+	size_t i = 0;
+
+	if (!out) {
+		return;
+	}
+
+	/* y[i] = (x[2i - 1] + 2 x[2i] + x[2i + 1]) / 4 */
+	dst[0] = (*last + 2 * src[0] + src[1]) >> 2;
+	for (i = 1; i + VOSK_DSP_LANES <= out; i += VOSK_DSP_LANES) {
+		v8si a, b, before, after;
+
+		LOAD_S16(a, src + 2 * i);
+		LOAD_S16(b, src + 2 * i + VOSK_DSP_LANES);
+		LOAD_S16(before, src + 2 * i - 1);
+		LOAD_S16(after, src + 2 * i + VOSK_DSP_LANES - 1);
+		STORE_S16(dst + i, (__builtin_shuffle(before, after, even) + 2 * __builtin_shuffle(a, b, even)
+			+ __builtin_shuffle(a, b, odd)) >> 2);
+	}
+	for (; i < out; i++) {
+		dst[i] = (src[2 * i - 1] + 2 * src[2 * i] + src[2 * i + 1]) >> 2;
+	}
+	*last = src[2 * out - 1];
+}
+
+uint32_t vosk_dsp_power(const int16_t *src, size_t samples)
+{
+	/* Squares of 16 bit samples fit 31 bits, their sums need 64 */
+	v8di acc = { 0 };
+	uint64_t sum = 0;
+	size_t i = 0;
+	int lane;
+
+	if (!samples) {
+		return 0;
+	}
+
+	for (; i + VOSK_DSP_LANES <= samples; i += VOSK_DSP_LANES) {
+		v8si v;
+
+		LOAD_S16(v, src + i);
+		acc += __builtin_convertvector(v * v, v8di);
+	}
+	for (lane = 0; lane < VOSK_DSP_LANES; lane++) {
+		sum += acc[lane];
+	}
+	for (; i < samples; i++) {
+		sum += (int32_t) src[i] * src[i];
+	}
+	return sum / samples;
+}
+
+void vosk_dsp_mask(uint8_t *data, size_t len, const uint8_t key[4], size_t offset)
+{
+	v16qu pattern;
+	size_t i = 0;
+	int lane;
+
+	/* Key repeated over a whole vector, starting where data starts */
+	for (lane = 0; lane < VOSK_DSP_MASK_BYTES; lane++) {
+		pattern[lane] = key[(offset + lane) & 3];
+	}
+	for (; i + VOSK_DSP_MASK_BYTES <= len; i += VOSK_DSP_MASK_BYTES) {
+		v16qu v;
+
+		memcpy(&v, data + i, sizeof(v));
+		v ^= pattern;
+		memcpy(data + i, &v, sizeof(v));
+	}
+	for (; i < len; i++) {
+		data[i] ^= key[(offset + i) & 3];
+	}
+}
@@ -0,0 +1,70 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Audio kernels of the Vosk speech engine
+ *
+ * Codec conversion and resampling run on every frame of every call, so
+ * they are written with GCC vector extensions which the compiler maps to
+ * SSE2, AVX2 or NEON depending on the target, with scalar tails.
+ */
+
+#ifndef VOSK_DSP_H
+#define VOSK_DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*! \brief Decode G.711 mu-law to signed linear */
+void vosk_dsp_ulaw_decode(int16_t *dst, const uint8_t *src, size_t samples);
+
+/*! \brief Decode G.711 A-law to signed linear */
+void vosk_dsp_alaw_decode(int16_t *dst, const uint8_t *src, size_t samples);
+
+/*!
+ * \brief Double the sample rate by linear interpolation
+ *
+ * \param dst Receives 2 * samples samples
+ * \param last Last input sample of the previous call, updated
+ */
+void vosk_dsp_upsample2(int16_t *dst, const int16_t *src, size_t samples, int16_t *last);
+
+/*!
+ * \brief Halve the sample rate with a [1 2 1] / 4 low-pass
+ *
+ * \param samples Number of input samples, an odd last sample is ignored
+ * \param dst Receives samples / 2 samples
+ * \param last Last input sample of the previous call, updated
+ */
+void vosk_dsp_downsample2(int16_t *dst, const int16_t *src, size_t samples, int16_t *last);
+
+/*!
+ * \brief Mean power of a block of signed linear audio
+ *
+ * \return Mean of the squared samples, 0 for an empty block
+ */
+uint32_t vosk_dsp_power(const int16_t *src, size_t samples);
+
+/*!
+ * \brief Apply a websocket masking key in place
+ *
+ * Masking and unmasking are the same operation.
+ *
+ * \param offset Position of data within the payload, for messages masked
+ *               in several pieces
+ */
+void vosk_dsp_mask(uint8_t *data, size_t len, const uint8_t key[4], size_t offset);
+
+#endif /* VOSK_DSP_H */
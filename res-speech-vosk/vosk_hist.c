@@ -0,0 +1,103 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Latency histograms of the Vosk speech engine
+ */
+
+#include "vosk_hist.h"
+
+/*
+ * Bucket i >= 16 with shift s = i / 8 - 1 holds [m << s, (m + 1) << s)
+ * where m = i - 8 s runs from 8 to 15; below 16 buckets are exact.
+ */
+static unsigned int hist_index(uint64_t value)
+{
+	unsigned int shift = 0;
+	unsigned int index;
+
+	if (value >= 16) {
+		shift = 63 - __builtin_clzll(value) - 3;
+	}
+	index = 8 * shift + (value >> shift);
+	return index < VOSK_HIST_BUCKETS ? index : VOSK_HIST_BUCKETS - 1;
+}
+
+static uint64_t hist_lower_bound(unsigned int index)
+{
+	unsigned int shift;
+
+	if (index < 16) {
+		return index;
+	}
+	shift = index / 8 - 1;
+	return (uint64_t) (index - 8 * shift) << shift;
+}
+
+void vosk_hist_record(vosk_hist_t *hist, uint64_t value)
+{
+	uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&hist->buckets[hist_index(value)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->sum, value, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+	while (value > max
+		&& !__atomic_compare_exchange_n(&hist->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+uint64_t vosk_hist_percentile(const vosk_hist_t *hist, double percentile)
+{
+	uint64_t total = 0, seen = 0, rank;
+	unsigned int i;
+
+	/* Sum the buckets rather than trusting count, recorders may be midway */
+	for (i = 0; i < VOSK_HIST_BUCKETS; i++) {
+		total += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+	}
+	if (!total) {
+		return 0;
+	}
+	rank = (uint64_t) (percentile / 100.0 * total + 0.5);
+	if (rank < 1) {
+		rank = 1;
+	} else if (rank > total) {
+		rank = total;
+	}
+	for (i = 0; i < VOSK_HIST_BUCKETS; i++) {
+		seen += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+		if (seen >= rank) {
+			break;
+		}
+	}
+	return hist_lower_bound(i);
+}
+
+uint64_t vosk_hist_count(const vosk_hist_t *hist)
+{
+	return __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+}
+
+uint64_t vosk_hist_mean(const vosk_hist_t *hist)
+{
+	uint64_t count = vosk_hist_count(hist);
+
+	return count ? __atomic_load_n(&hist->sum, __ATOMIC_RELAXED) / count : 0;
+}
+
+uint64_t vosk_hist_max(const vosk_hist_t *hist)
+{
+	return __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,60 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Latency histograms of the Vosk speech engine
+ *
+ * Log-linear buckets in the manner of HDR histograms: exact below 16,
+ * then eight buckets per power of two, so every recorded value is known
+ * to within 12.5%. Recording is a few atomic adds and never locks.
+ */
+
+#ifndef VOSK_HIST_H
+#define VOSK_HIST_H
+
+#include <stdint.h>
+
+/* Buckets covering values up to 2^24 (over four hours in ms) */
+#define VOSK_HIST_BUCKETS 184
+
+/*! \brief Histogram of non-negative values, zero initialized */
+typedef struct vosk_hist_t {
+	uint32_t		buckets[VOSK_HIST_BUCKETS];
+	uint64_t		count;
+	uint64_t		sum;
+	uint64_t		max;
+} vosk_hist_t;
+
+/*! \brief Record a value, larger ones land in the last bucket */
+void vosk_hist_record(vosk_hist_t *hist, uint64_t value);
+
+/*!
+ * \brief Value below which the given share of the recorded values lies
+ *
+ * \param percentile 0 to 100
+ * \return Lower bound of the bucket, 0 for an empty histogram
+ */
+uint64_t vosk_hist_percentile(const vosk_hist_t *hist, double percentile);
+
+/*! \brief Number of recorded values */
+uint64_t vosk_hist_count(const vosk_hist_t *hist);
+
+/*! \brief Mean of the recorded values, 0 for an empty histogram */
+uint64_t vosk_hist_mean(const vosk_hist_t *hist);
+
+/*! \brief Largest recorded value */
+uint64_t vosk_hist_max(const vosk_hist_t *hist);
+
+#endif /* VOSK_HIST_H */
@@ -0,0 +1,407 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Result message scanner of the Vosk speech engine
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vosk_result.h"
+
+/* Nesting the scanner follows before giving up on a message */
+#define VOSK_SCAN_DEPTH 16
+/* Stands in for escapes that are no character, U+FFFD */
+#define VOSK_REPLACEMENT_CHAR 0xfffd
+
+/*! \brief Read position in a message */
+typedef struct vosk_scan_t {
+	const char		*p;
+	const char		*end;
+} vosk_scan_t;
+
+static void scan_ws(vosk_scan_t *scan)
+{
+	while (scan->p < scan->end
+		&& (*scan->p == ' ' || *scan->p == '\t' || *scan->p == '\n' || *scan->p == '\r')) {
+		scan->p++;
+	}
+}
+
+/* Consume c after optional whitespace */
+static int scan_char(vosk_scan_t *scan, char c)
+{
+	scan_ws(scan);
+	if (scan->p < scan->end && *scan->p == c) {
+		scan->p++;
+		return 1;
+	}
+	return 0;
+}
+
+static int scan_hex4(vosk_scan_t *scan, unsigned int *value)
+{
+	int i;
+
+	if (scan->end - scan->p < 4) {
+		return -1;
+	}
+	*value = 0;
+	for (i = 0; i < 4; i++) {
+		char c = *scan->p++;
+		*value <<= 4;
+		if (c >= '0' && c <= '9') {
+			*value |= c - '0';
+		} else if (c >= 'a' && c <= 'f') {
+			*value |= c - 'a' + 10;
+		} else if (c >= 'A' && c <= 'F') {
+			*value |= c - 'A' + 10;
+		} else {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Append a byte, counting the ones that do not fit */
+static void put_byte(char *out, size_t size, size_t *len, char c)
+{
+	if (out && *len + 1 < size) {
+		out[*len] = c;
+	}
+	(*len)++;
+}
+
+static void put_utf8(char *out, size_t size, size_t *len, unsigned int cp)
+{
+	if (cp < 0x80) {
+		put_byte(out, size, len, cp);
+	} else if (cp < 0x800) {
+		put_byte(out, size, len, 0xc0 | (cp >> 6));
+		put_byte(out, size, len, 0x80 | (cp & 0x3f));
+	} else if (cp < 0x10000) {
+		put_byte(out, size, len, 0xe0 | (cp >> 12));
+		put_byte(out, size, len, 0x80 | ((cp >> 6) & 0x3f));
+		put_byte(out, size, len, 0x80 | (cp & 0x3f));
+	} else {
+		put_byte(out, size, len, 0xf0 | (cp >> 18));
+		put_byte(out, size, len, 0x80 | ((cp >> 12) & 0x3f));
+		put_byte(out, size, len, 0x80 | ((cp >> 6) & 0x3f));
+		put_byte(out, size, len, 0x80 | (cp & 0x3f));
+	}
+}
+
+/*!
+ * \brief Decode a string into out, or skip it when out is NULL
+ *
+ * len receives the full decoded length, out holds at most size - 1
+ * bytes of it and is always terminated.
+ */
+static int scan_string(vosk_scan_t *scan, char *out, size_t size, size_t *len)
+{
+	const char *run;
+
+	*len = 0;
+	if (!scan_char(scan, '"')) {
+		return -1;
+	}
+	while (scan->p < scan->end) {
+		/* Copy plain runs in one go, they are the bulk of any text */
+		run = scan->p;
+		while (scan->p < scan->end && *scan->p != '"' && *scan->p != '\\') {
+			scan->p++;
+		}
+		if (out && *len + 1 < size) {
+			size_t n = scan->p - run;
+			if (n > size - 1 - *len) {
+				n = size - 1 - *len;
+			}
+			memcpy(out + *len, run, n);
+		}
+		*len += scan->p - run;
+		if (scan->p == scan->end) {
+			break;
+		}
+		if (*scan->p++ == '"') {
+			if (out && size) {
+				out[*len < size ? *len : size - 1] = '\0';
+			}
+			return 0;
+		}
+		if (scan->p == scan->end) {
+			break;
+		}
+		switch (*scan->p++) {
+		case 'b':
+			put_byte(out, size, len, '\b');
+			break;
+		case 'f':
+			put_byte(out, size, len, '\f');
+			break;
+		case 'n':
+			put_byte(out, size, len, '\n');
+			break;
+		case 'r':
+			put_byte(out, size, len, '\r');
+			break;
+		case 't':
+			put_byte(out, size, len, '\t');
+			break;
+		case 'u': {
+			unsigned int cp, low;
+
+			if (scan_hex4(scan, &cp)) {
+				return -1;
+			}
+			if (cp >= 0xd800 && cp < 0xdc00) {
+				/* A high surrogate only counts with a low one right after it */
+				const char *next = scan->p;
+
+				if (scan->end - scan->p >= 6 && scan->p[0] == '\\' && scan->p[1] == 'u') {
+					scan->p += 2;
+					if (scan_hex4(scan, &low)) {
+						return -1;
+					}
+					if (low >= 0xdc00 && low < 0xe000) {
+						cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+					} else {
+						/* Not a pair, the next escape stands on its own */
+						scan->p = next;
+					}
+				}
+			}
+			if (cp >= 0xd800 && cp < 0xe000) {
+				/* Unpaired surrogates have no UTF-8 form */
+				cp = VOSK_REPLACEMENT_CHAR;
+			}
+			put_utf8(out, size, len, cp);
+			break;
+		}
+		default:
+			/* \" \\ \/ stand for themselves */
+			put_byte(out, size, len, scan->p[-1]);
+			break;
+		}
+	}
+	return -1;
+}
+
+static int scan_number(vosk_scan_t *scan, double *value)
+{
+	char buf[32];
+	size_t n = 0;
+
+	scan_ws(scan);
+	while (scan->p < scan->end && n < sizeof(buf) - 1
+		&& *scan->p && strchr("+-0123456789.eE", *scan->p)) {
+		buf[n++] = *scan->p++;
+	}
+	if (!n) {
+		return -1;
+	}
+	buf[n] = '\0';
+	*value = strtod(buf, NULL);
+	return 0;
+}
+
+/* Skip any value, nested ones included */
+static int scan_skip(vosk_scan_t *scan, int depth)
+{
+	size_t len;
+	double number;
+
+	if (depth > VOSK_SCAN_DEPTH) {
+		return -1;
+	}
+	scan_ws(scan);
+	if (scan->p == scan->end) {
+		return -1;
+	}
+	switch (*scan->p) {
+	case '"':
+		return scan_string(scan, NULL, 0, &len);
+	case '{':
+		scan->p++;
+		if (scan_char(scan, '}')) {
+			return 0;
+		}
+		do {
+			if (scan_string(scan, NULL, 0, &len) || !scan_char(scan, ':') || scan_skip(scan, depth + 1)) {
+				return -1;
+			}
+		} while (scan_char(scan, ','));
+		return scan_char(scan, '}') ? 0 : -1;
+	case '[':
+		scan->p++;
+		if (scan_char(scan, ']')) {
+			return 0;
+		}
+		do {
+			if (scan_skip(scan, depth + 1)) {
+				return -1;
+			}
+		} while (scan_char(scan, ','));
+		return scan_char(scan, ']') ? 0 : -1;
+	case 't':
+	case 'n':
+		scan->p += 4;
+		return scan->p <= scan->end ? 0 : -1;
+	case 'f':
+		scan->p += 5;
+		return scan->p <= scan->end ? 0 : -1;
+	default:
+		return scan_number(scan, &number);
+	}
+}
+
+/* Length of the text without a trailing partial UTF-8 sequence */
+static size_t utf8_cut(const char *text, size_t len)
+{
+	size_t lead = len;
+	unsigned char c;
+	size_t need;
+
+	while (lead && ((unsigned char) text[lead - 1] & 0xc0) == 0x80) {
+		lead--;
+	}
+	if (!lead) {
+		return 0;
+	}
+	c = text[--lead];
+	need = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc0 ? 2 : 1;
+	return lead + need <= len ? len : lead;
+}
+
+/* Read the key of an object member, keys longer than the buffer never match */
+static int scan_key(vosk_scan_t *scan, char *key, size_t size)
+{
+	size_t len;
+
+	if (scan_string(scan, key, size, &len) || !scan_char(scan, ':')) {
+		return -1;
+	}
+	if (len >= size) {
+		key[0] = '\0';
+	}
+	return 0;
+}
+
+/* Sum up the confidences of the word list in "result" */
+static int scan_words(vosk_scan_t *scan, vosk_result_t *result)
+{
+	char key[16];
+	double conf;
+
+	if (!scan_char(scan, '[')) {
+		return scan_skip(scan, 1);
+	}
+	if (scan_char(scan, ']')) {
+		return 0;
+	}
+	do {
+		if (!scan_char(scan, '{')) {
+			if (scan_skip(scan, 2)) {
+				return -1;
+			}
+			continue;
+		}
+		if (scan_char(scan, '}')) {
+			continue;
+		}
+		do {
+			if (scan_key(scan, key, sizeof(key))) {
+				return -1;
+			}
+			if (!strcmp(key, "conf")) {
+				if (scan_number(scan, &conf)) {
+					return -1;
+				}
+				result->conf += conf;
+				result->words++;
+			} else if (scan_skip(scan, 3)) {
+				return -1;
+			}
+		} while (scan_char(scan, ','));
+		if (!scan_char(scan, '}')) {
+			return -1;
+		}
+	} while (scan_char(scan, ','));
+	return scan_char(scan, ']') ? 0 : -1;
+}
+
+int vosk_result_scan(vosk_result_t *result, const char *msg, size_t len)
+{
+	vosk_scan_t scan = { msg, msg + len };
+	char key[16];
+	size_t text_len;
+	double conf;
+	int has_conf = 0;
+
+	result->kind = VOSK_RESULT_NONE;
+	result->text[0] = '\0';
+	result->text_len = 0;
+	result->conf = 0;
+	result->words = 0;
+
+	if (!scan_char(&scan, '{')) {
+		return -1;
+	}
+	if (scan_char(&scan, '}')) {
+		return 0;
+	}
+	do {
+		if (scan_key(&scan, key, sizeof(key))) {
+			return -1;
+		}
+		if (!strcmp(key, "partial") || !strcmp(key, "text")) {
+			if (scan_string(&scan, result->text, sizeof(result->text), &text_len)) {
+				return -1;
+			}
+			if (text_len >= sizeof(result->text)) {
+				text_len = utf8_cut(result->text, sizeof(result->text) - 1);
+				result->text[text_len] = '\0';
+			}
+			result->text_len = text_len;
+			if (key[0] == 't') {
+				result->kind = VOSK_RESULT_TEXT;
+			} else if (text_len) {
+				result->kind = VOSK_RESULT_PARTIAL;
+			}
+		} else if (!strcmp(key, "result")) {
+			if (scan_words(&scan, result)) {
+				return -1;
+			}
+		} else if (!strcmp(key, "conf")) {
+			if (scan_number(&scan, &conf)) {
+				return -1;
+			}
+			has_conf = 1;
+		} else if (scan_skip(&scan, 1)) {
+			return -1;
+		}
+	} while (scan_char(&scan, ','));
+
+	if (!scan_char(&scan, '}')) {
+		return -1;
+	}
+	if (result->words) {
+		result->conf /= result->words;
+	} else if (has_conf) {
+		result->conf = conf;
+		result->words = 1;
+	}
+	return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Result message scanner of the Vosk speech engine
+ *
+ * Recognizers send several partial results per second and session, so
+ * instead of building a JSON tree for each of them the few fields the
+ * module uses are pulled straight out of the message into a buffer the
+ * caller keeps around. Nothing is allocated.
+ */
+
+#ifndef VOSK_RESULT_H
+#define VOSK_RESULT_H
+
+#include <stddef.h>
+
+/* Longest result text kept, longer texts are cut */
+#define VOSK_RESULT_SIZE 2048
+
+/*! \brief Kind of recognizer message */
+enum vosk_result_kind {
+	/* Nothing the module uses, e.g. an empty partial */
+	VOSK_RESULT_NONE = 0,
+	/* Hypothesis of the utterance in progress */
+	VOSK_RESULT_PARTIAL,
+	/* Final result of an utterance, the text may be empty */
+	VOSK_RESULT_TEXT,
+};
+
+/*! \brief Fields of a recognizer message */
+typedef struct vosk_result_t {
+	enum vosk_result_kind	kind;
+	/* Value of "partial" or "text", NUL terminated */
+	char			text[VOSK_RESULT_SIZE];
+	size_t			text_len;
+	/* Mean "conf" of the words in "result", or of "conf" itself */
+	double			conf;
+	/* Number of words with a confidence, 0 when the recognizer sent none */
+	int			words;
+} vosk_result_t;
+
+/*!
+ * \brief Scan a recognizer message
+ *
+ * \param msg Message, need not be NUL terminated
+ * \retval 0 on success
+ * \retval -1 if the message is not a JSON object
+ */
+int vosk_result_scan(vosk_result_t *result, const char *msg, size_t len);
+
+#endif /* VOSK_RESULT_H */